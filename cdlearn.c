@@ -52,7 +52,7 @@ double simulate(Chain * chain, Chaint *chaint, Biasmap* biasmap, simulation_para
 	double temp; //unused for MC
 	
 	Chain *chain2 = (Chain *)malloc(sizeof(Chain));
-	chain2->aa = NULL; chain2->xaa = NULL; chain2->erg = NULL; chain2->xaa_prev = NULL;
+	chain2->aa = NULL; chain2->xaa = NULL; chain2->erg = NULL; chain2->xaa_prev = NULL; chain2->sc = NULL;
 	allocmem_chain(chain2,chain->NAA,chain->Nchains);
 	
 	/* do tests at step 0 */
@@ -632,7 +632,7 @@ int main(int argc, char *argv[])
 	fprintf(stderr,"Creating PDB library.\n");
 	/* allocate memory for the original PDB library */
 	Chain *temporary = (Chain *)malloc(sizeof(Chain));
-	temporary->NAA = 0; temporary->aa = NULL; temporary->xaa = NULL; temporary->erg = NULL; temporary->xaa_prev = NULL;
+	temporary->NAA = 0; temporary->aa = NULL; temporary->xaa = NULL; temporary->erg = NULL; temporary->xaa_prev = NULL; temporary->sc = NULL;
 
 	/* PDB library */
 	Chain *all_chains = NULL;
@@ -671,7 +671,7 @@ int main(int argc, char *argv[])
 		allocmem_chain(&(all_chains[n_proteins-1]), temporary->NAA, temporary->Nchains);
 		/* chaint-s for simulate */
 		all_chaints = (Chaint*)realloc(all_chaints,n_proteins * sizeof(Chaint));
-		all_chaints[n_proteins-1].aat = NULL; all_chaints[n_proteins-1].xaat = NULL; all_chaints[n_proteins-1].ergt = NULL; all_chaints[n_proteins-1].xaat_prev = NULL; 
+		all_chaints[n_proteins-1].aat = NULL; all_chaints[n_proteins-1].xaat = NULL; all_chaints[n_proteins-1].ergt = NULL; all_chaints[n_proteins-1].xaat_prev = NULL; all_chaints[n_proteins-1].sct = NULL;
 
 		/* copy temporary into the main one */
 		copybetween(&((all_chains)[n_proteins-1]),temporary);
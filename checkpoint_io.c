@@ -58,14 +58,15 @@ void open_next_checkpoint_file(simulation_params *sim_params,char *action){
 
 
 /* Print header into the current checkpoint file.
-   The header contains information about the peptide chains (NAA, N, seq)
+   The header contains information about the peptide chains (NAA, N, Nchains, whether the entries
+   carry the side chains, whether they carry the compact energy matrix, seq)
    and NS simulation variables (iter_start, logL*, logZ, H, amplitude) */
 //!! current_iter (sim_params->iter) is how many iterations the master processor has done,
 //!! for serial runs it will be num_proc times larger than for parallel runs.
 void print_checkpoint_header(simulation_params *sim_params, FILE *outfile, int current_iter){
 
   // print numbers of aa-s and NS points
-  fprintf(outfile,"%d %d %d\n",sim_params->NAA,sim_params->N,sim_params->Nchains);
+  fprintf(outfile,"%d %d %d %d %d\n",sim_params->NAA,sim_params->N,sim_params->Nchains,sidechain_store,1);
   // print and set sequence
   fprintf(outfile,"%s\n",sim_params->seq);
 
@@ -117,6 +118,15 @@ void print_checkpoint_entry(Chain *cpoints, simulation_params *sim_params, FILE
 
 	    /* print etc and the number of amino acid in the sequence */
 	  fprintf(outfile,"%x %d %d\n",cpoints[chainloop].aa[aaloop].etc,cpoints[chainloop].aa[aaloop].num,cpoints[chainloop].aa[aaloop].chainid);   
+	    /* print the placed side chain (SideChains=1, flagged in the header) */
+	  if (sidechain_store) {
+	    Sidechain *sc = cpoints[chainloop].sc + aaloop;
+	    int nbAtoms = sidechain_valid(sc, cpoints[chainloop].aa + aaloop) ? sc->nbAtoms : 0;
+	    fprintf(outfile,"%d %d %d\n", cpoints[chainloop].aa[aaloop].SCRot, cpoints[chainloop].aa[aaloop].SCTrial, nbAtoms);
+	    for(i = 0; i < nbAtoms; i++){
+	      fprintf(outfile,"%d %12.8f %12.8f %12.8f\n", sc->atypes[i], sc->xyz[i][0], sc->xyz[i][1], sc->xyz[i][2]);
+	    }
+	  }
     }
     /* print xaa (CA-CA) vector for multiple chain starts */
     for (int chainid = 0; chainid <= cpoints[chainloop].aa[cpoints[chainloop].NAA-1].chainid; chainid++) {
@@ -126,9 +136,11 @@ void print_checkpoint_entry(Chain *cpoints, simulation_params *sim_params, FILE
       }
     }
   
-	/* print energy matrix */
-    for(aaloop = 0; aaloop < cpoints[chainloop].NAA*cpoints[chainloop].NAA; aaloop++){
-	  fprintf(outfile,"%12.8f ",cpoints[chainloop].erg[aaloop]);	   
+	/* print energy matrix, in its compact form (flagged in the header) */
+    double packed[energy_matrix_packed_size(cpoints[chainloop].NAA)];
+    energy_matrix_pack(cpoints + chainloop, packed);
+    for(aaloop = 0; aaloop < energy_matrix_packed_size(cpoints[chainloop].NAA); aaloop++){
+	  fprintf(outfile,"%12.8f ",packed[aaloop]);
     } 			
   }
 }
@@ -226,11 +238,22 @@ void read_checkpoint_header(simulation_params *sim_params){
 	stop("read_checkpoint_header: Checkpoint file is not open yet.");
   }
 
-  //read numbers of aa-s and NS points
+  //read numbers of aa-s and NS points, whether the entries carry the side chains and whether
+  //they carry the compact energy matrix (files written before the flags have neither)
   int k = 0;
-  if ((k = fscanf(sim_params->checkpoint_file,"%d %d %d\n",&(sim_params->NAA),&(sim_params->N),&(sim_params->Nchains))) != 3) {
+  char line[256];
+  sim_params->checkpoint_sidechains = 0;
+  sim_params->checkpoint_ergpacked = 0;
+  if (!fgets(line, sizeof(line), sim_params->checkpoint_file) ||
+	(k = sscanf(line,"%d %d %d %d %d",&(sim_params->NAA),&(sim_params->N),&(sim_params->Nchains),&(sim_params->checkpoint_sidechains),&(sim_params->checkpoint_ergpacked))) < 3) {
 	stop("read_checkpoint_header: Could not read amino acid and chain numbers.\n");
   }
+  if (sim_params->checkpoint_sidechains < 0 || sim_params->checkpoint_sidechains > 1) {
+	stop("read_checkpoint_header: Could not read the side chain flag.\n");
+  }
+  if (sim_params->checkpoint_ergpacked < 0 || sim_params->checkpoint_ergpacked > 1) {
+	stop("read_checkpoint_header: Could not read the energy matrix flag.\n");
+  }
   // read in and set sequence
   sim_params->seq = (char*)malloc(sizeof(char)*(sim_params->NAA+2));
   if ((k = fscanf(sim_params->checkpoint_file,"%s\n",sim_params->seq)) != 1) {
@@ -322,6 +345,38 @@ void read_checkpoint_entry(Chain *cpoints, simulation_params *sim_params){
 	    if ((k = fscanf(sim_params->checkpoint_file, "%x %d %d\n",&(cpoints->aa[aaloop].etc),&(cpoints->aa[aaloop].num),&(cpoints->aa[aaloop].chainid))) != 3) {
 		stop("read_checkpoint_entry: Could not read etc and NAA and chainid.\n");
 	    }
+	    /* read in the placed side chain if the file has them (header flag), keep it if this run does (SideChains=1) */
+	    if (sim_params->checkpoint_sidechains) {
+		int nbAtoms, atype;
+		double xyz[3];
+		if ((k = fscanf(sim_params->checkpoint_file, "%d %d %d\n", &(cpoints->aa[aaloop].SCRot), &(cpoints->aa[aaloop].SCTrial), &nbAtoms)) != 3 || nbAtoms < 0 || (cpoints->sc && nbAtoms > sidechain_room())) {
+		    stop("read_checkpoint_entry: Could not read the side chain.\n");
+		}
+		for(i = 0; i < nbAtoms; i++){
+		    if ((k = fscanf(sim_params->checkpoint_file, "%d %lf %lf %lf\n", &atype, &(xyz[0]), &(xyz[1]), &(xyz[2]))) != 4) {
+			stop("read_checkpoint_entry: Could not read the side chain atoms.\n");
+		    }
+		    if (cpoints->sc) {
+			cpoints->sc[aaloop].atypes[i] = atype;
+			castvec(cpoints->sc[aaloop].xyz[i], xyz);
+		    }
+		}
+		if (cpoints->sc) cpoints->sc[aaloop].nbAtoms = nbAtoms;
+	    }
+	    else if (cpoints->sc) {
+		/* none in the file: the side chain is placed again when it is scored */
+		cpoints->sc[aaloop].nbAtoms = 0;
+	    }
+	    if (cpoints->sc) {
+		Sidechain *sc = cpoints->sc + aaloop;
+		sc->SCRot = cpoints->aa[aaloop].SCRot;
+		sc->SCTrial = cpoints->aa[aaloop].SCTrial;
+		for(i = 0; i < 3; i++){
+		    sc->frame[i] = cpoints->aa[aaloop].n[i];
+		    sc->frame[3 + i] = cpoints->aa[aaloop].ca[i];
+		    sc->frame[6 + i] = cpoints->aa[aaloop].cb[i];
+		}
+	    }
 	}
 	/* read in the xaa (CA-CA) vector for multiple chain starts */
 	for (int chainid = 0; chainid <= cpoints->aa[sim_params->NAA-1].chainid; chainid++) {
@@ -332,11 +387,23 @@ void read_checkpoint_entry(Chain *cpoints, simulation_params *sim_params){
 	    }
 	}
 
-	/* read in energy matrix */
-	for(aaloop = 0; aaloop < sim_params->NAA * sim_params->NAA; aaloop++){
-	    if ((k = fscanf(sim_params->checkpoint_file, "%lf ",&(cpoints->erg[aaloop]))) != 1) {
-		stop("read_checkpoint_entry: Could not read energy matrix.\n");
+	/* read in energy matrix, compact (header flag) or full, and add up its running totals */
+	if (sim_params->checkpoint_ergpacked) {
+	    double packed[energy_matrix_packed_size(sim_params->NAA)];
+	    for(aaloop = 0; aaloop < energy_matrix_packed_size(sim_params->NAA); aaloop++){
+		if ((k = fscanf(sim_params->checkpoint_file, "%lf ",&(packed[aaloop]))) != 1) {
+		    stop("read_checkpoint_entry: Could not read energy matrix.\n");
+		}
+	    }
+	    energy_matrix_unpack(cpoints, packed);
+	}
+	else {
+	    for(aaloop = 0; aaloop < sim_params->NAA * sim_params->NAA; aaloop++){
+		if ((k = fscanf(sim_params->checkpoint_file, "%lf ",&(cpoints->erg[aaloop]))) != 1) {
+		    stop("read_checkpoint_entry: Could not read energy matrix.\n");
+		}
 	    }
+	    energy_matrix_sum(cpoints);
 	}
 
 }
@@ -365,13 +432,13 @@ int read_in_from_checkpoint(simulation_params *sim_params,
     /* peptide chain for MC moves */
     if (*chaint) freemem_chaint(*chaint);
     *chaint = (Chaint*)realloc(*chaint,sizeof(Chaint));
-    (*chaint)->aat = NULL; (*chaint)->ergt = NULL;  (*chaint)->xaat = NULL; (*chaint)->xaat_prev = NULL;
+    (*chaint)->aat = NULL; (*chaint)->ergt = NULL;  (*chaint)->xaat = NULL; (*chaint)->xaat_prev = NULL; (*chaint)->sct = NULL;
     /* bias map */
     *biasmap = (Biasmap*)realloc(*biasmap,sizeof(Biasmap));
     (*biasmap)->distb = NULL;
 
     //temporary chain for reading
-    temporary->aa = NULL; temporary->xaa = NULL; temporary->erg = NULL; temporary->xaa_prev = NULL;
+    temporary->aa = NULL; temporary->xaa = NULL; temporary->erg = NULL; temporary->xaa_prev = NULL; temporary->sc = NULL;
 
     // only read on the master processor
     if(rank == 0){
@@ -553,7 +620,7 @@ int store_chain(ChainHash **chainhash, Chain *temporary, Biasmap *biasmap, Chain
 	    *cpoints = (Chain*)realloc(*cpoints,*current_stored * sizeof(Chain));
 	    (*cpoints)[*current_stored-1].NAA = temporary->NAA;
 	    (*cpoints)[*current_stored-1].Nchains = temporary->Nchains;
-	    (*cpoints)[*current_stored-1].aa = NULL;
+	    (*cpoints)[*current_stored-1].aa = NULL; (*cpoints)[*current_stored-1].sc = NULL;
 	    (*cpoints)[*current_stored-1].xaa = NULL;
 	    (*cpoints)[*current_stored-1].erg = NULL;
 	    (*cpoints)[*current_stored-1].xaa_prev = NULL;
@@ -581,7 +648,7 @@ int store_chain(ChainHash **chainhash, Chain *temporary, Biasmap *biasmap, Chain
 		*cpoints = (Chain*)realloc(*cpoints,*current_stored * sizeof(Chain));
 		(*cpoints)[*current_stored-1].NAA = temporary->NAA;
 		(*cpoints)[*current_stored-1].Nchains = temporary->Nchains;
-		(*cpoints)[*current_stored-1].aa = NULL;
+		(*cpoints)[*current_stored-1].aa = NULL; (*cpoints)[*current_stored-1].sc = NULL;
 		(*cpoints)[*current_stored-1].xaa = NULL;
 		(*cpoints)[*current_stored-1].xaa_prev = NULL;
 		(*cpoints)[*current_stored-1].erg = NULL;
@@ -634,13 +701,13 @@ int read_in_from_pdb(simulation_params *sim_params,
     /* peptide chain for MC moves */
     if (*chaint) freemem_chaint(*chaint);
     *chaint = (Chaint*)realloc(*chaint,sizeof(Chaint));
-    (*chaint)->aat = NULL; (*chaint)->ergt = NULL;  (*chaint)->xaat = NULL; (*chaint)->xaat_prev = NULL;
+    (*chaint)->aat = NULL; (*chaint)->ergt = NULL;  (*chaint)->xaat = NULL; (*chaint)->xaat_prev = NULL; (*chaint)->sct = NULL;
     /* bias map */
     *biasmap = (Biasmap*)realloc(*biasmap,sizeof(Biasmap));
     (*biasmap)->distb = NULL;
 
     //temporary chain for reading
-    temporary->aa = NULL; temporary->xaa = NULL; temporary->erg = NULL; temporary->xaa_prev = NULL;
+    temporary->aa = NULL; temporary->xaa = NULL; temporary->erg = NULL; temporary->xaa_prev = NULL; temporary->sc = NULL;
     temporary->ll = 0;
 
     // only read on the master processor
@@ -860,8 +927,10 @@ void mpi_send_chain(Chain* nsconformation, int from, int to, double *logLstar, i
   char ids[NAA];
   int chainids[NAA];
   double xaa_prev[(Nchains+1)*9];
+  double packed[energy_matrix_packed_size(NAA)];
   if(from==0)MPI_Send(logLstar,1,MPI_DOUBLE,to,iter*10,MPI_COMM);
-  MPI_Send(nsconformation->erg,NAA*NAA,MPI_DOUBLE,to,iter*10+1,MPI_COMM);
+  energy_matrix_pack(nsconformation, packed);
+  MPI_Send(packed,energy_matrix_packed_size(NAA),MPI_DOUBLE,to,iter*10+1,MPI_COMM);
   MPI_Send(&(nsconformation->ll),1,MPI_DOUBLE,to,iter*10+2,MPI_COMM);
   for(j = 0; j < NAA; j++){
     etcs[j] = nsconformation->aa[j].etc;
@@ -913,9 +982,11 @@ void mpi_rec_chain(Chain *nsconformation, int from, int to, double *logLstar, in
   char ids[NAA];
   int chainids[NAA];
   int Nchains;
+  double packed[energy_matrix_packed_size(NAA)];
   MPI_Status info;
   if(from==0) MPI_Recv(logLstar,1,MPI_DOUBLE,from,iter*10,MPI_COMM,&info);
-  MPI_Recv(nsconformation->erg,NAA*NAA,MPI_DOUBLE,from,iter*10+1,MPI_COMM,&info);
+  MPI_Recv(packed,energy_matrix_packed_size(NAA),MPI_DOUBLE,from,iter*10+1,MPI_COMM,&info);
+  energy_matrix_unpack(nsconformation, packed);
   MPI_Recv(&(nsconformation->ll),1,MPI_DOUBLE,from,iter*10+2,MPI_COMM,&info);
   MPI_Recv(coords,NAA*35,MPI_DOUBLE,from,iter*10+3,MPI_COMM,&info);
   MPI_Recv(etcs,NAA,MPI_INT,from,iter*10+4,MPI_COMM,&info);
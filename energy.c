@@ -21,6 +21,8 @@
 #include"peptide.h"
 #include"vdw.h"
 #include"energy.h"
+#include"gridmap_io.h"
+#include"trg_io.h"
 
 
 
@@ -47,24 +49,6 @@
 /* CA-CA distance cutoff for Hbond interactions */
 const double hbond_cutoff = 49.;
 
-extern struct _ILE ILE;
-extern struct _LEU LEU;
-extern struct _PRO PRO;
-extern struct _VAL VAL;
-extern struct _PHE PHE;
-extern struct _TRP TRP;
-extern struct _TYR TYR;
-extern struct _ASP ASP;
-extern struct _GLU GLU;
-extern struct _ARG ARG;
-extern struct _HIS HIS;
-extern struct _LYS LYS;
-extern struct _SER SER;
-extern struct _THR THR;
-extern struct _CYS CYS;
-extern struct _MET MET;
-extern struct _ASN ASN;
-extern struct _GLN GLN;
 
 /***********************************************************/
 /****       ENERGY MATRIX AND BIASMAP  OPERATIONS       ****/
@@ -77,10 +61,11 @@ extern struct _GLN GLN;
    energies go, and into (0,0), the global energy */
 void energy_matrix_calculate(Chain *chain, Biasmap *biasmap, model_params *mod_params) {
 	int i, j;
+	double reach = energy2_reach(mod_params);
 
 
 
-	//fprintf(stderr,"first row %g %g", chain->Erg(0, 0), chain->Erg(1, 0));
+	//fprintf(stderr,"first row %g %g", ErgExternal(chain), ErgCyclic(chain));
 	/* (0,*) and (*,0) */
 
 	for (i = 1; i < chain->NAA; i++){
@@ -90,7 +75,7 @@ void energy_matrix_calculate(Chain *chain, Biasmap *biasmap, model_params *mod_p
 	//fprintf(stderr,"\n");
 
 	/* (0,0) */
-	chain->Erg(0, 0) = 0.0;
+	ErgExternal(chain) = 0.0;
 	if (mod_params->external_potential_type == 5){
 		double ADenergies[chain->NAA-1];
 
@@ -100,16 +85,16 @@ void energy_matrix_calculate(Chain *chain, Biasmap *biasmap, model_params *mod_p
 			chain->Erg(0, i) = ADenergies[i-1];
 			fprintf(stderr," aaa %d %g \n",i, chain->Erg(0,i));
 			//chain->Erg(0, i) = ADenergy(chain->aa + i, mod_params);
-			chain->Erg(0, 0) += chain->Erg(0, i);
+			ErgExternal(chain) += chain->Erg(0, i);
 		}
 		//free(ADenergies);
-		//chain->Erg(0, 0) = global_energy(0,0,chain, NULL,biasmap, mod_params);
+		//ErgExternal(chain) = global_energy(0,0,chain, NULL,biasmap, mod_params);
 
 	}
 	fprintf(stderr,"SS Energy ");
-	chain->Erg(chain->NAA - 1, 0) = global_energy(0, 0,chain, NULL,biasmap, mod_params);
+	ErgGlobal(chain) = global_energy(0, 0,chain, NULL,biasmap, mod_params);
 
-	if (mod_params->external_potential_type2 == 4)	chain->Erg(1, 0) = cyclic_energy((chain->aa) + 1, (chain->aa) + chain->NAA - 1, 0);
+	if (mod_params->external_potential_type2 == 4)	ErgCyclic(chain) = cyclic_energy((chain->aa) + 1, (chain->aa) + chain->NAA - 1, 0);
 	/* diagonal */
 	fprintf(stderr,"diag ");
 	//fprintf(stderr,"ENERGY1 START\n");
@@ -128,7 +113,7 @@ void energy_matrix_calculate(Chain *chain, Biasmap *biasmap, model_params *mod_p
 	fprintf(stderr,"offdiag ");
 	for (i = 1; i < chain->NAA; i++){
 		for (j = 1; j < i; j++){
-			chain->Erg(i, j) = chain->Erg(j, i) = energy2(biasmap,(chain->aa) + i, (chain->aa) + j, mod_params);
+			chain->Erg(i, j) = chain->Erg(j, i) = energy2_ranged(biasmap,(chain->aa) + i, (chain->aa) + j, reach, mod_params);
 	//	fprintf(stderr,"%g ",chain->Erg(i,j));
             
         }
@@ -136,52 +121,111 @@ void energy_matrix_calculate(Chain *chain, Biasmap *biasmap, model_params *mod_p
     }
 	if (mod_params->external_potential_type2 == 4)
 		chain->Erg(1, chain->NAA-1) = chain->Erg(chain->NAA-1, 1) = energy2cyclic(biasmap,(chain->aa) + 1, (chain->aa) + chain->NAA-1, mod_params);
+	energy_matrix_sum(chain);
 }
 
-/* Calculate the total energy by adding up the energy matrix. */
-double totenergy(Chain *chain)
+/* Set the external energies of all residues, row 0 of the energy matrix, to ADEnergies
+   (residue i at i-1) and the external energy to their sum */
+void energy_matrix_external(Chain *chain, double *ADEnergies)
+{
+	int j;
+
+	ErgExternal(chain) = 0.0;
+	for (j = 1; j < chain->NAA; j++) {
+		chain->Erg(0, j) = ADEnergies[j - 1];
+		ErgExternal(chain) += chain->Erg(0, j);
+	}
+}
+
+/* Add up the running totals of the energy matrix again: the diagonal into ergloc, the pairs
+   of the lower triangle into ergpair and row 0 into the external energy. Column 0 holds the
+   cyclic and global energies, which are not sums. Returns the largest change of a total,
+   the drift of the running totals since they were last added up. */
+double energy_matrix_sum(Chain *chain)
 {
 	int i, j;
-	double toten = 0.0;
+	double loc = 0.0, pair = 0.0, ext = 0.0, drift;
 
-	//fprintf(stderr, "tote... %g\n", chain->Erg(0,0));
-	for (i = 0; i < chain->NAA; i++)
-		for (j = 0; j <= i; j++) {
-			toten += chain->Erg(i, j);
-	//		fprintf(stderr, "%g ", chain->Erg(i,j));
-		}
-	//	fprintf(stderr,"\n");
+	for (i = 1; i < chain->NAA; i++) {
+		ext += chain->Erg(0, i);
+		loc += chain->Erg(i, i);
+		for (j = 1; j < i; j++)
+			pair += chain->Erg(i, j);
+	}
+	drift = fmax(fabs(loc - chain->ergloc), fmax(fabs(pair - chain->ergpair), fabs(ext - ErgExternal(chain))));
+	chain->ergloc = loc;
+	chain->ergpair = pair;
+	ErgExternal(chain) = ext;
+	return drift;
+}
+
+/* Calculate the total energy, the lower triangle of the energy matrix, from its running totals. */
+double totenergy(Chain *chain)
+{
+	double toten = chain->ergloc + chain->ergpair + ErgExternal(chain) + ErgGlobal(chain);
 
+	/* a single residue has its cyclic and global energies in one slot */
+	if (chain->NAA > 2)
+		toten += ErgCyclic(chain);
 	return toten;
 }
 
-/* Calculate the local energy by adding up the diagonal of the energy matrix. */
+/* Calculate the local energy, the diagonal of the energy matrix, from its running total. */
 double locenergy(Chain *chain)
 {
-	int i;
-	double toten = 0.;
-
-	for (i = 1; i < chain->NAA; i++)
-		toten += chain->Erg(i, i);
-
-	return toten;
+	return chain->ergloc;
 }
 
 /* Return the external energy. */
 double extenergy(Chain *chain)
 {
-	return chain->Erg(0, 0) + chain->Erg(1, 0);
+	return ErgExternal(chain) + ErgCyclic(chain);
 }
 
 /* Return the energy between first and last energy. */
 double firstlastenergy(Chain *chain)
 {
 	return chain->Erg(1, chain->NAA - 1);
-	//return chain->Erg(0, 0);
+	//return ErgExternal(chain);
 }
 
 
 /* Print the energy matrix of a chain */
+/* The size of the compact form of the energy matrix of a chain of NAA, as energy_matrix_print
+   prints it: row 0, the external energies, then the lower triangle with column 0. */
+int energy_matrix_packed_size(int NAA)
+{
+	return NAA + (NAA - 1) * (NAA + 2) / 2;
+}
+
+/* Write the energy matrix of a chain into packed in its compact form */
+void energy_matrix_pack(Chain *chain, double *packed)
+{
+	int i, j, k = 0;
+
+	for (i = 0; i < chain->NAA; i++)
+		packed[k++] = chain->Erg(0, i);
+	for (i = 1; i < chain->NAA; i++)
+		for (j = 0; j <= i; j++)
+			packed[k++] = chain->Erg(i, j);
+}
+
+/* Read the energy matrix of a chain from its compact form, the pairs above the diagonal
+   mirrored from below, and add up its running totals */
+void energy_matrix_unpack(Chain *chain, const double *packed)
+{
+	int i, j, k = 0;
+
+	for (i = 0; i < chain->NAA; i++)
+		chain->Erg(0, i) = packed[k++];
+	for (i = 1; i < chain->NAA; i++)
+		for (j = 0; j <= i; j++) {
+			chain->Erg(i, j) = packed[k++];
+			if (j > 0) chain->Erg(j, i) = chain->Erg(i, j);
+		}
+	energy_matrix_sum(chain);
+}
+
 void energy_matrix_print(Chain *chain, Biasmap *biasmap, model_params *mod_params) {
 	int i, j;
     for (i = 0; i < chain->NAA; i++)
@@ -340,20 +384,6 @@ void biasmap_finalise(Biasmap *biasmap){
 }
 
 
-/*make energy grid map smoother*/
-double lower_gridenergy(double E) {
-	//return E;
-	if (E > 2.718) {
-		//return log10f(E) + 9;
-		return log(E) + 1.718;
-	}
-	//if (E > 10) {
-	//	//return log10f(E) + 9;
-	//	return log(E-9) + 10;
-	//}
-	return E;
-}
-
 /*init the size and center and spacing of AD gridbox*/
 void gridbox_initialise() {
 	FILE *gridmap = NULL;
@@ -411,21 +441,259 @@ void gridmap_initialise(char *filename, int atype) {
 		stop("Missing gridmap_file.map file.");
 	}
 	char line[256];
-	int i = 0;
-	double *curr_gridmap_values = malloc(NX*NY*NZ * sizeof(double));
+	int i = 0, n;
+	double *curr_gridmap_values = malloc((size_t)GRIDPAD(NX)*GRIDPAD(NY)*GRIDPAD(NZ) * sizeof(double));
 	while (fgets(line, sizeof(line), gridmap_file)) {
 		if (i < 6) {
 			i++;
 			continue;
 		}
-		curr_gridmap_values[i - 6] = lower_gridenergy(atof(line));
+		n = i - 6;
+		if (n < NX*NY*NZ)
+			curr_gridmap_values[getindex(n % NX, n / NX % NY, n / (NX*NY))] = lower_gridenergy(atof(line));
 		i++;
 	}
 	fclose(gridmap_file);
+	gridfile_pad_map(curr_gridmap_values, NX, NY, NZ, atype < GRIDFILE_NTYPEMAPS);
 	gridmapvalues[atype] = curr_gridmap_values;
 
 }
 
+/* the binary grid file, if the maps were mapped from one */
+static Gridfile receptor_gridfile = { NULL, { NULL }, NULL, 0 };
+
+/* min/max bounds of the maps, see gridpyramid_initialise */
+static Gridpyramid_level gridpyramid[GRIDPYRAMID_LEVELS];
+
+/* free the maps of one of the gridmap arrays, a fallback map that shares
+   the array of the C map is freed once */
+#define GRIDMAP_FREE(maps) do { \
+	int _i, _k; \
+	for (_i = 0; _i < GRIDFILE_NMAPS; _i++) { \
+		for (_k = 0; _k < _i && (maps)[_k] != (maps)[_i]; _k++); \
+		if (_k == _i) free((maps)[_i]); \
+	} \
+	for (_i = 0; _i < GRIDFILE_NMAPS; _i++) (maps)[_i] = NULL; \
+} while (0)
+
+/* read the maps PREFIX.*.map of the mask required in parallel (see gridfile_load_maps),
+   the other maps are the C map */
+void gridmaps_initialise(char *prefix, unsigned int required) {
+	Gridfile_header box;
+	double begin = gridfile_wtime();
+
+	gridfile_load_maps(prefix, required, &box, gridmapvalues);
+	spacing = box.spacing;
+	NX = box.NX;
+	NY = box.NY;
+	NZ = box.NZ;
+	centerX = box.center[0];
+	centerY = box.center[1];
+	centerZ = box.center[2];
+	gridband = GRIDGUARD;
+	printf("grid box initialise succuss %i %i %i \n", NX, NY, NZ);
+	printf("grid maps read in %.3f s\n", gridfile_wtime() - begin);
+}
+
+/* initialise the box and the grid maps from a binary grid file written by map2grd,
+   required is the mask of the maps the peptide needs (same numbering as gridmapvalues).
+   returns 0 if the file does not exist, so that the .map files can be read instead */
+int gridfile_initialise(char *filename, unsigned int required) {
+	char error_string[DEFAULT_LONG_STRING_LENGTH];
+	int atype;
+
+	if (gridfile_open(&receptor_gridfile, filename) != 0) return 0;
+
+	const Gridfile_header *header = receptor_gridfile.header;
+	for (atype = 0; atype < GRIDFILE_NMAPS; atype++) {
+		if ((required & (1u << atype)) && !(header->present & (1u << atype))) {
+			sprintf(error_string, "Missing rigidReceptor.%s.map in grid file %s.", gridfile_map_names[atype], filename);
+			stop(error_string);
+		}
+		/* a map without its own .map file is a copy of the C map */
+		gridmapvalues[atype] = (header->present & (1u << atype)) ? receptor_gridfile.maps[atype] : receptor_gridfile.maps[0];
+	}
+	spacing = header->spacing;
+	NX = header->NX;
+	NY = header->NY;
+	NZ = header->NZ;
+	centerX = header->center[0];
+	centerY = header->center[1];
+	centerZ = header->center[2];
+	gridband = GRIDGUARD;
+	printf("grid file %s mapped %i %i %i \n", filename, NX, NY, NZ);
+	return 1;
+}
+
+/* initialise the box, the grid maps and the transpoints from the entries of a .trg target
+   archive, without extracting it. required is the mask of the maps the peptide needs, the
+   others are copies of the C map. if there is no translationPoints.npy the box center is used */
+void gridtarget_initialise(char *filename, unsigned int required) {
+	char error_string[DEFAULT_LONG_STRING_LENGTH];
+	char mapname[64];
+	Trg_archive trg;
+	Gridfile_header box;
+	const Trg_entry *entry;
+	size_t nvoxels = 0;
+	int atype, i;
+
+	trg_open(&trg, filename);
+	required |= 1u;
+	for (atype = 0; atype < GRIDFILE_NMAPS; atype++) {
+		sprintf(mapname, "%s.%s.map", GRIDFILE_DEFAULT_PREFIX, gridfile_map_names[atype]);
+		if (!(required & (1u << atype))) {
+			gridmapvalues[atype] = gridmapvalues[0];
+			continue;
+		}
+		if ((entry = trg_find(&trg, mapname)) == NULL) {
+			sprintf(error_string, "Missing %s in target archive %s.", mapname, filename);
+			stop(error_string);
+		}
+		char *text = trg_read(&trg, entry);
+		gridfile_parse_map(text, &box, NULL);
+		if (atype == 0) {
+			spacing = box.spacing;
+			NX = box.NX;
+			NY = box.NY;
+			NZ = box.NZ;
+			centerX = box.center[0];
+			centerY = box.center[1];
+			centerZ = box.center[2];
+			nvoxels = (size_t)NX * NY * NZ;
+			gridband = GRIDGUARD;
+		} else if (box.NX != NX || box.NY != NY || box.NZ != NZ) {
+			sprintf(error_string, "Grid dimensions of %s differ from the C map in target archive %s.", mapname, filename);
+			stop(error_string);
+		}
+		gridmapvalues[atype] = malloc((size_t)GRIDPAD(NX) * GRIDPAD(NY) * GRIDPAD(NZ) * sizeof(double));
+		if (!gridmapvalues[atype]) stop("Unable to allocate memory in gridtarget_initialise.");
+		if (gridfile_parse_map(text, &box, gridmapvalues[atype]) != nvoxels) {
+			sprintf(error_string, "%s in target archive %s has fewer than %lu values.", mapname, filename, (unsigned long)nvoxels);
+			stop(error_string);
+		}
+		gridfile_pad_map(gridmapvalues[atype], NX, NY, NZ, atype < GRIDFILE_NTYPEMAPS);
+		free(text);
+	}
+	printf("grid box initialise succuss %i %i %i from %s\n", NX, NY, NZ, filename);
+
+	double *points = NULL;
+	if ((entry = trg_find(&trg, "translationPoints.npy")) != NULL) {
+		char *data = trg_read(&trg, entry);
+		if ((points = trg_npy_points(data, entry->usize, &transPtsCount)) == NULL) {
+			sprintf(error_string, "translationPoints.npy in target archive %s is not an (n, 3) float array.", filename);
+			stop(error_string);
+		}
+		free(data);
+	}
+	trg_close(&trg);
+	if (points == NULL || transPtsCount == 0) {
+		printf("no transpoints found \n");
+		Xpts = malloc(1 * sizeof(double));
+		Ypts = malloc(1 * sizeof(double));
+		Zpts = malloc(1 * sizeof(double));
+		Xpts[0] = centerX;
+		Ypts[0] = centerY;
+		Zpts[0] = centerZ;
+		transPtsCount = 1;
+		free(points);
+		return;
+	}
+	Xpts = malloc(transPtsCount * sizeof(double));
+	Ypts = malloc(transPtsCount * sizeof(double));
+	Zpts = malloc(transPtsCount * sizeof(double));
+	for (i = 0; i < transPtsCount; i++) {
+		Xpts[i] = points[3 * i];
+		Ypts[i] = points[3 * i + 1];
+		Zpts[i] = points[3 * i + 2];
+	}
+	free(points);
+	printf("transpoints initialise success with %i transpoints \n", transPtsCount);
+}
+
+/* switch to the interleaved or tiled layout, the separate maps read from .map files are freed unless keep_maps */
+void gridvoxels_initialise(int layout, int keep_maps) {
+	free(gridvoxels);
+	gridvoxels = gridfile_interleave(gridmapvalues, GRIDPAD(NX), GRIDPAD(NY), GRIDPAD(NZ), layout == GRID_LAYOUT_TILED);
+	gridlayout = layout;
+	gridband = GRIDGUARD;
+	if (keep_maps || receptor_gridfile.base) return;
+	GRIDMAP_FREE(gridmapvalues);
+}
+
+/* store the separate maps as float or 16-bit quantised values, and print the memory used and the
+   largest error of a lookup in the box for each map. the double maps read from .map files are freed
+   unless keep_maps. the guard band of 16-bit maps saturates, gridenergy does not interpolate in it */
+void gridprecision_initialise(int precision, int keep_maps) {
+	static const char *names[3] = { "double", "float", "16-bit" };
+	size_t nvoxels = (size_t)GRIDPAD(NX) * GRIDPAD(NY) * GRIDPAD(NZ);
+	size_t bytes = nvoxels * sizeof(double);
+	int atype, shared, nmaps = 0;
+
+	GRIDMAP_FREE(gridmapfloats);
+	GRIDMAP_FREE(gridmapshorts);
+	gridprecision = precision;
+	gridband = precision == GRID_PRECISION_INT16 ? 0 : GRIDGUARD;
+	if (precision == GRID_PRECISION_FLOAT) bytes = nvoxels * sizeof(float);
+	if (precision == GRID_PRECISION_INT16) bytes = nvoxels * sizeof(short);
+	/* a fallback map that shares the C map is converted and stored once */
+	for (atype = 0; atype < sizeof(gridmapvalues) / sizeof(gridmapvalues)[0]; atype++) {
+		for (shared = 0; shared < atype && gridmapvalues[shared] != gridmapvalues[atype]; shared++);
+		if (shared == atype) nmaps++;
+	}
+	printf("grid maps stored as %s values, %.1f MB\n", names[precision], (double)bytes * nmaps / (1024. * 1024.));
+	if (precision == GRID_PRECISION_DOUBLE) return;
+
+	for (atype = 0; atype < sizeof(gridmapvalues) / sizeof(gridmapvalues)[0]; atype++) {
+		double maxerr = 0.0;
+		int x, y, z, n;
+		for (shared = 0; shared < atype && gridmapvalues[shared] != gridmapvalues[atype]; shared++);
+		if (shared < atype) {
+			gridmapfloats[atype] = gridmapfloats[shared];
+			gridmapshorts[atype] = gridmapshorts[shared];
+			gridmapscale[atype] = gridmapscale[shared];
+			gridmapoffset[atype] = gridmapoffset[shared];
+			continue;
+		}
+		if (precision == GRID_PRECISION_FLOAT)
+			gridmapfloats[atype] = gridfile_map_float(gridmapvalues[atype], nvoxels);
+		else
+			gridmapshorts[atype] = gridfile_map_quantise(gridmapvalues[atype], NX, NY, NZ, &gridmapscale[atype], &gridmapoffset[atype]);
+		for (z = 0; z < NZ; z++)
+		for (y = 0; y < NY; y++)
+		for (x = 0; x < NX; x++) {
+			n = getindex(x, y, z);
+			if (precision == GRID_PRECISION_FLOAT)
+				maxerr = fmax(maxerr, fabs(gridmapfloats[atype][n] - gridmapvalues[atype][n]));
+			else
+				maxerr = fmax(maxerr, fabs(gridmapoffset[atype] + gridmapscale[atype] * gridmapshorts[atype][n] - gridmapvalues[atype][n]));
+		}
+		printf("grid map %s: largest %s error %g\n", gridfile_map_names[atype], names[precision], maxerr);
+	}
+	if (keep_maps || receptor_gridfile.base) return;
+	GRIDMAP_FREE(gridmapvalues);
+}
+
+/* release the grid maps, either unmap the grid file or free the maps read from .map files */
+void gridmap_finalise() {
+	int atype;
+	free(gridvoxels);
+	gridvoxels = NULL;
+	gridlayout = GRID_LAYOUT_SEPARATE;
+	GRIDMAP_FREE(gridmapfloats);
+	GRIDMAP_FREE(gridmapshorts);
+	gridprecision = GRID_PRECISION_DOUBLE;
+	for (atype = 0; atype < GRIDPYRAMID_LEVELS; atype++) {
+		free(gridpyramid[atype].bounds);
+		gridpyramid[atype].bounds = NULL;
+	}
+	if (receptor_gridfile.base) {
+		gridfile_close(&receptor_gridfile);
+		for (atype = 0; atype < sizeof(gridmapvalues) / sizeof(gridmapvalues)[0]; atype++)
+			gridmapvalues[atype] = NULL;
+	} else
+		GRIDMAP_FREE(gridmapvalues);
+}
+
 /* initialise the tranpoints from the file, if no transpoints found, add the box center */
 void transpts_initialise() {
 	FILE *transpts_file = NULL;
@@ -1436,8 +1704,9 @@ double secondary_radius_of_gyration(int start, int end, Chain *chain, Chaint *ch
 
 }
 
+/* index of voxel (x,y,z) of the box in the padded maps, x, y, z may be in the guard band */
 int getindex(int x, int y, int z) {
-	return (z * NX * NY + y * NX + x);
+	return ((z + GRIDGUARD) * GRIDPAD(NY) + y + GRIDGUARD) * GRIDPAD(NX) + x + GRIDGUARD;
 }
 
 
@@ -1460,319 +1729,356 @@ void normalizedVector(float *a, float *b, float *v) {
 
 
 //score side chain and also set gamma position
-float scoreSideChain(int nbRot, int nbAtoms, double *charges, int *atypes,  double coords[nbRot][nbAtoms][3], AA *a,  int numRand)
+float scoreSideChain(const Rotlib *lib, AA *a,  int numRand)
 {
 	int i, j;
-	float n; /* used to normalized vectors */
-	float sideChainCenter[3], bestSideChainCenter[3];
 	float N[3] = { a->n[0], a->n[1], a->n[2] }; /* coordiantes from 1crn.pdb:TYR29:N */
 	float CA[3] = { a->ca[0], a->ca[1], a->ca[2] }; /* coordiantes from 1crn.pdb:TYR29:CA */
 	float CB[3] = { a->cb[0], a->cb[1], a->cb[2] }; /* coordiantes from 1crn.pdb:TYR29:CB */
-	float v1[3], v2[3], v3[3], mat[3][4]; /* used to compute xform matrix to align canonical rotamer to amino acid */
-	float tc[nbRot][nbAtoms][3]; /* list of transformed coordinates */
-					   /*
-					   printf("VAL, %d atoms %d rotamers\n", VAL.nbAtoms, VAL.nbRot);
-					   for (i=0; i<VAL.nbRot; i++) {
-					   printf("Rotamer %d\n", i);
-					   for (j=0; j<VAL.nbAtoms; j++) {
-					   printf("  %c %f %f %f\n",VAL.atypes[j], VAL.coords[i][j][0],
-					   VAL.coords[i][j][1], VAL.coords[i][j][2]);
-					   }
-					   }
-					   */
-					   /* compute matrix to align canonical TYR rotamer to 1crn:TYR29 backbone */
+	float mat[3][4]; /* xform matrix to align canonical rotamer to amino acid */
+	const int nbRot = lib->nbRot, nbAtoms = lib->nbAtoms;
+	/* the rotamers of the library in the frame of the residue */
+	const Rotlib_scratch *scratch = rotlib_scratch(ROTLIB_SCRATCH_SCAN);
+	double *rotlibX = scratch->x, *rotlibY = scratch->y, *rotlibZ = scratch->z, *rotlibEnergies = scratch->energies;
 	float score = 0.0;
 	float bestScore = 99999.0;
-	float randx, randy, randz;
 
-	int nbHeavyAtoms = 0;
-
-	for (int nn =0; nn < nbAtoms; nn++){
-		if (atypes[nn]!=3) nbHeavyAtoms++;
-	}
-	/*scan a little bit more space, number of random trials*/
+	/*scan a little bit more space, number of trials moving N*/
 	for (int pertInd=0; pertInd < numRand; pertInd++){
-		if (pertInd!=0){
-			randx = 0.5 * rand() / (double) RAND_MAX;
-			randy = 0.5 * rand() / (double) RAND_MAX;
-			randz = 0.5 * rand() / (double) RAND_MAX;
-			N[0] = a->n[0] + randx - 0.25;
-			N[1] = a->n[1] + randy - 0.25;
-			N[2] = a->n[2] + randz - 0.25;
-		}
+		rotlib_jitter(a, pertInd, N);
 
-		//N[3] = { a->n[0] + randx - 0.5, a->n[1] + randy - 0.5, a->n[2] + randz - 0.5 }
-		normalizedVector(N, CA, v1); /* X vector */
-								 /* printf("V1 %f %f %f %f\n", v1[0], v1[1], v1[2], v1[0]*v1[0]+ v1[1]*v1[1]+ v1[2]*v1[2]); */
-		normalizedVector(CA, CB, v3);
-		/* printf("V3 %f %f %f %f\n", v3[0], v3[1], v3[2], v3[0]*v3[0]+ v3[1]*v3[1]+ v3[2]*v3[2]); */
-		vectorProduct(v3, v1, v2); /* Y vector*/
-								   /* printf("V2 %f %f %f %f\n", v2[0], v2[1], v2[2], v2[0]*v2[0]+ v2[1]*v2[1]+ v2[2]*v2[2]); */
-		n = 1. / sqrt(v2[0] * v2[0] + v2[1] * v2[1] + v2[2] * v2[2]);
-		for (i = 0; i < 3; i++) v2[i] = v2[i] * n;
-		vectorProduct(v1, v2, v3); /* Z vector*/
-		n = 1. / sqrt(v3[0] * v3[0] + v3[1] * v3[1] + v3[2] * v3[2]);
-		for (i = 0; i < 3; i++) v3[i] = v3[i] * n;
-		/* printf("V3 %f %f %f %f\n", v3[0], v3[1], v3[2], v3[0]*v3[0]+ v3[1]*v3[1]+ v3[2]*v3[2]); */
-		/* xform matrix */
-		for (i = 0; i < 3; i++) {
-			mat[i][0] = v1[i];
-			mat[i][1] = v2[i];
-			mat[i][2] = v3[i];
-			mat[i][3] = CA[i];
-		}
-		/*
-		printf("%8.3f %8.3f %8.3f %8.3f\n",mat[0][0],mat[0][1],mat[0][2],mat[0][3]);
-		printf("%8.3f %8.3f %8.3f %8.3f\n",mat[1][0],mat[1][1],mat[1][2],mat[1][3]);
-		printf("%8.3f %8.3f %8.3f %8.3f\n",mat[2][0],mat[2][1],mat[2][2],mat[2][3]);
-		*/
-		/* apply transformation to canonical all rot side chains coordinates */
-		score = 0.0;
+		sidechain_frame(N, CA, CB, mat);
+		/* all atoms of all rotamers in the frame, and their grid energies in one batch */
+		rotlib_transform(lib, mat, rotlibX, rotlibY, rotlibZ);
+		gridenergy_batch(nbRot * nbAtoms, rotlibX, rotlibY, rotlibZ, lib->types, lib->batchCharges, rotlibEnergies);
 
 		for (i = 0; i < nbRot; i++) {
 			score = 0.0;
-			sideChainCenter[0] = 0.0;
-			sideChainCenter[1] = 0.0;
-			sideChainCenter[2] = 0.0;
-			for (j = 0; j < nbAtoms; j++) {
-				//fprintf(stderr, "test type %i score %g \n", atypes[i], score);
-				tc[i][j][0] = mat[0][0] * coords[i][j][0] + mat[0][1] * coords[i][j][1] + mat[0][2] * coords[i][j][2] + mat[0][3];
-				tc[i][j][1] = mat[1][0] * coords[i][j][0] + mat[1][1] * coords[i][j][1] + mat[1][2] * coords[i][j][2] + mat[1][3];
-				tc[i][j][2] = mat[2][0] * coords[i][j][0] + mat[2][1] * coords[i][j][1] + mat[2][2] * coords[i][j][2] + mat[2][3];
-				//fprintf(stderr, "test type %i\n", atypes[i]);
-				if (atypes[j]!=3) {
-					sideChainCenter[0] += tc[i][j][0];
-					sideChainCenter[1] += tc[i][j][1];
-					sideChainCenter[2] += tc[i][j][2];
-				}
-
-				score += gridenergy(tc[i][j][0], tc[i][j][1], tc[i][j][2], atypes[j], charges[j]);
-				//fprintf(stderr, "test nbROT %i type %i score %g \n", i, atypes[j], score);
-			}
+			for (j = 0; j < nbAtoms; j++)
+				score += rotlibEnergies[i * nbAtoms + j];
 			if (score < bestScore) {
 				bestScore = score;
 				a->SCRot = i;
-				bestSideChainCenter[0] = sideChainCenter[0]/nbHeavyAtoms;
-				bestSideChainCenter[1] = sideChainCenter[1]/nbHeavyAtoms;
-				bestSideChainCenter[2] = sideChainCenter[2]/nbHeavyAtoms;
-
+				a->SCTrial = pertInd;
 			}
 		}
 	}
-	
-	switch (a->id)
-	{
-		case 'I':
-			a->g[0] = (tc[a->SCRot][0][0]+tc[a->SCRot][1][0])/2;
-			a->g[1] = (tc[a->SCRot][0][1]+tc[a->SCRot][1][1])/2;
-			a->g[2] = (tc[a->SCRot][0][2]+tc[a->SCRot][1][2])/2;
-			a->g2[0] = tc[a->SCRot][2][0];
-			a->g2[1] = tc[a->SCRot][2][1];
-			a->g2[2] = tc[a->SCRot][2][2];
-			break;
-		case 'S':
-			a->g[0] = tc[a->SCRot][0][0];
-			a->g[1] = tc[a->SCRot][0][1];
-			a->g[2] = tc[a->SCRot][0][2];
-			break;
-		case 'P':
-			a->g[0] = tc[a->SCRot][0][0];
-			a->g[1] = tc[a->SCRot][0][1];
-			a->g[2] = tc[a->SCRot][0][2];
-			break;
-		default:
-                        a->g[0] = tc[a->SCRot][0][0];
-                        a->g[1] = tc[a->SCRot][0][1];
-                        a->g[2] = tc[a->SCRot][0][2];
-			//a->g[0] = bestSideChainCenter[0];
-			//a->g[1] = bestSideChainCenter[1];
-			//a->g[2] = bestSideChainCenter[2];
-			break;
-
-	}
-		
 
-	//fprintf(stderr, "score %g \n", bestScore);
-	//free(tc),free(v1),free(v2),free(v3),free(mat);
+	sidechain_centers(a->id, rotlibX + a->SCRot * nbAtoms, rotlibY + a->SCRot * nbAtoms, rotlibZ + a->SCRot * nbAtoms, a->g, a->g2);
 
 	return bestScore;
 
 }
 
-int checkClash(double x, double y, double z, double *setCoords, int ind){
-	double dist = 100;
+/* clash grid: the cell of a point */
+static int clashgrid_cell(double x)
+{
+	return (int) floor(x * (1.0 / CLASHGRID_CELL));
+}
 
-	//if (sizeof(setCoords)/sizeof(double)<ind-1) {
-	//	fprintf(stderr,"error %g %d \n",sizeof(setCoords)/sizeof(double),ind); 
-	//}
-	//fprintf(stderr,"error %g %d \n",sizeof(setCoords)/sizeof(double),ind); 
-	for (int i = 0; i < ind; i = i + 3){
-		//if (setCoords)
-		//fprintf(stderr,"error %g %g \n",setCoords[i], setCoords[i+1]); 
-		dist = (x - setCoords[i]) * (x - setCoords[i]) + (y - setCoords[i+1]) * (y - setCoords[i+1]) + (z - setCoords[i+2]) * (z - setCoords[i+2]);
-		if (dist < 4.84) {
-			return 1;
+static int clashgrid_bucket(int cx, int cy, int cz)
+{
+	return ((unsigned) cx * 73856093u ^ (unsigned) cy * 19349663u ^ (unsigned) cz * 83492791u) & (CLASHGRID_BUCKETS - 1);
+}
+
+void clashgrid_initialise(Clashgrid *grid, double *coords, int *next, int *bucket)
+{
+	grid->coords = coords;
+	grid->next = next;
+	grid->bucket = bucket;
+	grid->n = 0;
+	for (int b = 0; b < CLASHGRID_BUCKETS; b++) grid->head[b] = -1;
+}
+
+void clashgrid_add(Clashgrid *grid, const double p[3])
+{
+	int k = grid->n++;
+	int b = clashgrid_bucket(clashgrid_cell(p[0]), clashgrid_cell(p[1]), clashgrid_cell(p[2]));
+	grid->coords[3 * k] = p[0];
+	grid->coords[3 * k + 1] = p[1];
+	grid->coords[3 * k + 2] = p[2];
+	grid->bucket[k] = b;
+	grid->next[k] = grid->head[b];
+	grid->head[b] = k;
+}
+
+/* drops the atoms added after the first n, newest first */
+void clashgrid_truncate(Clashgrid *grid, int n)
+{
+	while (grid->n > n) {
+		int k = --grid->n;
+		grid->head[grid->bucket[k]] = grid->next[k];
+	}
+}
+
+int checkClash(double x, double y, double z, const Clashgrid *grid){
+	if (grid->n <= CLASHGRID_SCAN) {
+		for (int k = 0; k < grid->n; k++) {
+			const double *p = grid->coords + 3 * k;
+			if ((x - p[0]) * (x - p[0]) + (y - p[1]) * (y - p[1]) + (z - p[2]) * (z - p[2]) < CLASH_DISTANCE2)
+				return 1;
 		}
-		
+		return 0;
 	}
+
+	int x0 = clashgrid_cell(x - CLASHGRID_REACH), x1 = clashgrid_cell(x + CLASHGRID_REACH);
+	int y0 = clashgrid_cell(y - CLASHGRID_REACH), y1 = clashgrid_cell(y + CLASHGRID_REACH);
+	int z0 = clashgrid_cell(z - CLASHGRID_REACH), z1 = clashgrid_cell(z + CLASHGRID_REACH);
+
+	for (int cz = z0; cz <= z1; cz++)
+		for (int cy = y0; cy <= y1; cy++)
+			for (int cx = x0; cx <= x1; cx++)
+				for (int k = grid->head[clashgrid_bucket(cx, cy, cz)]; k >= 0; k = grid->next[k]) {
+					const double *p = grid->coords + 3 * k;
+					if ((x - p[0]) * (x - p[0]) + (y - p[1]) * (y - p[1]) + (z - p[2]) * (z - p[2]) < CLASH_DISTANCE2)
+						return 1;
+				}
 	return 0;
 }
 
+/* a cached side chain: the best rotamer found for one backbone frame of a residue */
+typedef struct _Rotcache_entry {
+	int key[9];		/* N, CA, CB in units of the quantum */
+	char id;		/* residue type, 0 if the entry is empty */
+	int SCRot, SCTrial;
+	int numRand;		/* trials of the scan */
+	int nbClash;		/* clashes of its heavy atoms when it was chosen */
+	double score;		/* its grid score, without the clash penalties */
+	double g[3], g2[3];
+	int nbHeavy;
+	double heavy[ROTCACHE_ATOMS][3];
+} Rotcache_entry;
+
+static Rotcache_entry *rotcache = NULL;
+static int rotcache_nres = 0;
+static double rotcache_quantum = 0.0;
+
+/* allocate an empty cache for residues 1..nres-1 and reset the counters, no cache if quantum is 0 */
+void rotcache_initialise(int nres, double quantum) {
+	rotcache_finalise();
+	rotcache_lookups = rotcache_hits = 0;
+	rotcache_scan_seconds = rotcache_hit_seconds = 0.0;
+	if (quantum <= 0.0 || nres < 1) return;
+	rotcache = calloc((size_t)nres * ROTCACHE_WAYS, sizeof(Rotcache_entry));
+	if (!rotcache) stop("Unable to allocate memory in rotcache_initialise.");
+	rotcache_nres = nres;
+	rotcache_quantum = quantum;
+}
+
+void rotcache_finalise() {
+	free(rotcache);
+	rotcache = NULL;
+	rotcache_nres = 0;
+}
 
-double scoreSideChainNoClash(int nbRot, int nbAtoms, double charges[nbAtoms], int atypes[nbAtoms],  double coords[nbRot][nbAtoms][3], AA *a, double* setCoords, int ind, int numRand)
+/* the entry of residue a for its current frame, whose key is returned in key */
+static Rotcache_entry *rotcache_slot(AA *a, int key[9], int numRand) {
+	const double *frame[3] = { a->n, a->ca, a->cb };
+	unsigned int hash = numRand;
+	int k;
+	for (k = 0; k < 9; k++) {
+		key[k] = (int)lround(frame[k / 3][k % 3] / rotcache_quantum);
+		hash = 31 * hash + (unsigned int)key[k];
+	}
+	return rotcache + (size_t)(a->num % rotcache_nres) * ROTCACHE_WAYS + hash % ROTCACHE_WAYS;
+}
+
+/* the transform of the canonical rotamers onto the backbone frame N, CA, CB of a residue */
+void sidechain_frame(float N[3], float CA[3], float CB[3], float mat[3][4])
 {
-	int i, j;
+	float v1[3], v2[3], v3[3];
 	double n; /* used to normalized vectors */
-	double sideChainCenter[3], bestSideChainCenter[3];
+	int i;
+
+	normalizedVector(N, CA, v1); /* X vector */
+	normalizedVector(CA, CB, v3);
+	vectorProduct(v3, v1, v2); /* Y vector*/
+	n = 1. / sqrt(v2[0] * v2[0] + v2[1] * v2[1] + v2[2] * v2[2]);
+	for (i = 0; i < 3; i++) v2[i] = v2[i] * n;
+	vectorProduct(v1, v2, v3); /* Z vector*/
+	n = 1. / sqrt(v3[0] * v3[0] + v3[1] * v3[1] + v3[2] * v3[2]);
+	for (i = 0; i < 3; i++) v3[i] = v3[i] * n;
+	/* xform matrix */
+	for (i = 0; i < 3; i++) {
+		mat[i][0] = v1[i];
+		mat[i][1] = v2[i];
+		mat[i][2] = v3[i];
+		mat[i][3] = CA[i];
+	}
+}
+
+/* the gamma atoms kept in AA (g, and g2 for ILE, THR and VAL) from the transformed atoms of a rotamer */
+void sidechain_centers(char id, const double *X, const double *Y, const double *Z, vector g, vector g2)
+{
+	switch (id)
+	{
+		case 'I':
+			g[0] = (X[0]+X[1])/2;
+			g[1] = (Y[0]+Y[1])/2;
+			g[2] = (Z[0]+Z[1])/2;
+			g2[0] = X[2];
+			g2[1] = Y[2];
+			g2[2] = Z[2];
+			break;
+		case 'T':
+		case 'V':
+			g[0] = X[1];
+			g[1] = Y[1];
+			g[2] = Z[1];
+			g2[0] = X[0];
+			g2[1] = Y[0];
+			g2[2] = Z[0];
+			break;
+		default:
+			g[0] = X[0];
+			g[1] = Y[0];
+			g[2] = Z[0];
+			break;
+	}
+}
+double scoreSideChainNoClash(const Rotlib *lib, AA *a, const Clashgrid *placed, int numRand)
+{
+	int i, j;
+	const int nbRot = lib->nbRot, nbAtoms = lib->nbAtoms;
+	const int *atypes = lib->atypes;
+	const double *charges = lib->charges;
+	const Rotlib_scratch *scratch = rotlib_scratch(ROTLIB_SCRATCH_SCAN);
+	double *rotlibX = scratch->x, *rotlibY = scratch->y, *rotlibZ = scratch->z;
 	float N[3] = { a->n[0], a->n[1], a->n[2] }; /* coordiantes from 1crn.pdb:TYR29:N */
 	float CA[3] = { a->ca[0], a->ca[1], a->ca[2] }; /* coordiantes from 1crn.pdb:TYR29:CA */
 	float CB[3] = { a->cb[0], a->cb[1], a->cb[2] }; /* coordiantes from 1crn.pdb:TYR29:CB */
-	float v1[3], v2[3], v3[3], mat[3][4]; /* used to compute xform matrix to align canonical rotamer to amino acid */
-	float tc[nbRot][nbAtoms][3]; /* list of transformed coordinates */
-					   /*
-					   printf("VAL, %d atoms %d rotamers\n", VAL.nbAtoms, VAL.nbRot);
-					   for (i=0; i<VAL.nbRot; i++) {
-					   printf("Rotamer %d\n", i);
-					   for (j=0; j<VAL.nbAtoms; j++) {
-					   printf("  %c %f %f %f\n",VAL.atypes[j], VAL.coords[i][j][0],
-					   VAL.coords[i][j][1], VAL.coords[i][j][2]);
-					   }
-					   }
-					   */
-					   /* compute matrix to align canonical TYR rotamer to 1crn:TYR29 backbone */
+	float mat[3][4]; /* xform matrix to align canonical rotamer to amino acid */
 	double score = 0.0;
 	double bestScore = 99999.0;
-	double randx, randy, randz;
     int clash = 0;
-	int nbHeavyAtoms = 0;
 
-	for (int nn =0; nn < nbAtoms; nn++){
-		if (atypes[nn]!=3) nbHeavyAtoms++;
+	/* a frame seen before by a scan of as many trials, whose rotamer still has the same clashes,
+	   takes the cached side chain */
+	Rotcache_entry *cached = NULL;
+	int key[9];
+	double begin = 0.0;
+	if (rotcache && nbAtoms <= ROTCACHE_ATOMS) {
+		begin = gridfile_wtime();
+		rotcache_lookups++;
+		cached = rotcache_slot(a, key, numRand);
+		if (cached->id == a->id && cached->numRand == numRand && memcmp(cached->key, key, sizeof(key)) == 0) {
+			for (j = 0; j < cached->nbHeavy; j++)
+				clash += checkClash(cached->heavy[j][0], cached->heavy[j][1], cached->heavy[j][2], placed);
+			if (clash == cached->nbClash) {
+				a->SCRot = cached->SCRot;
+				a->SCTrial = cached->SCTrial;
+				for (i = 0; i < 3; i++) {
+					a->g[i] = cached->g[i];
+					a->g2[i] = cached->g2[i];
+				}
+				rotcache_hits++;
+				rotcache_hit_seconds += gridfile_wtime() - begin;
+				return cached->score + 6.5 * clash;
+			}
+			clash = 0;
+		}
 	}
-	/*scan a little bit more space, number of random trials*/
+
+	/* branch and bound over the rotamers: the last winner first, the atoms of a rotamer from the
+	   one that reaches farthest from CA, whose energy varies most. a rotamer is dropped as soon as its
+	   partial score plus the pyramid bounds of its remaining atoms cannot beat the best one, the clash
+	   penalties are positive. a rotamer scored in full sums its atoms in library order and ties go to
+	   the lower index of the earliest trial, so the choice is that of the exhaustive scan */
+	const int type = a->id - 'A';
+	int order[nbAtoms], rotOrder[nbRot], clashes[nbAtoms], bounded = 1, bestTrial = 0, k, m;
+	const double *radius = lib->radius;
+	double atomBound[nbAtoms], energy[nbAtoms], boundSum = 0.0;
+	for (j = 0; j < nbAtoms; j++) {
+		double lo[3], hi[3];
+		/* the frame is a rotation about CA, the atom stays within radius[j] of it */
+		for (i = 0; i < 3; i++) {
+			lo[i] = CA[i] - radius[j] - 0.01;
+			hi[i] = CA[i] + radius[j] + 0.01;
+		}
+		atomBound[j] = gridpyramid_bound(atypes[j], charges[j], lo, hi);
+		if (atomBound[j] == -DBL_MAX) bounded = 0;
+		atomBound[j] -= 1e-6;
+		boundSum += atomBound[j];
+		for (m = j; m > 0 && radius[order[m - 1]] < radius[j]; m--) order[m] = order[m - 1];
+		order[m] = j;
+	}
+	rotOrder[0] = a->SCRot >= 0 && a->SCRot < nbRot ? a->SCRot : 0;
+	for (i = 0, k = 1; i < nbRot; i++)
+		if (i != rotOrder[0]) rotOrder[k++] = i;
+	/*scan a little bit more space, number of trials moving N*/
 	for (int pertInd=0; pertInd < numRand; pertInd++){
-		if (pertInd!=0){
-			randx = 0.5 * rand() / (double) RAND_MAX;
-			randy = 0.5 * rand() / (double) RAND_MAX;
-			randz = 0.5 * rand() / (double) RAND_MAX;
-			N[0] = a->n[0] + randx - 0.25;
-			N[1] = a->n[1] + randy - 0.25;
-			N[2] = a->n[2] + randz - 0.25;
-		}
+		rotlib_jitter(a, pertInd, N);
 
 		//N[3] = { a->n[0] + randx - 0.5, a->n[1] + randy - 0.5, a->n[2] + randz - 0.5 }
-		normalizedVector(N, CA, v1); /* X vector */
-								 /* printf("V1 %f %f %f %f\n", v1[0], v1[1], v1[2], v1[0]*v1[0]+ v1[1]*v1[1]+ v1[2]*v1[2]); */
-		normalizedVector(CA, CB, v3);
-		/* printf("V3 %f %f %f %f\n", v3[0], v3[1], v3[2], v3[0]*v3[0]+ v3[1]*v3[1]+ v3[2]*v3[2]); */
-		vectorProduct(v3, v1, v2); /* Y vector*/
-								   /* printf("V2 %f %f %f %f\n", v2[0], v2[1], v2[2], v2[0]*v2[0]+ v2[1]*v2[1]+ v2[2]*v2[2]); */
-		n = 1. / sqrt(v2[0] * v2[0] + v2[1] * v2[1] + v2[2] * v2[2]);
-		for (i = 0; i < 3; i++) v2[i] = v2[i] * n;
-		vectorProduct(v1, v2, v3); /* Z vector*/
-		n = 1. / sqrt(v3[0] * v3[0] + v3[1] * v3[1] + v3[2] * v3[2]);
-		for (i = 0; i < 3; i++) v3[i] = v3[i] * n;
-		/* printf("V3 %f %f %f %f\n", v3[0], v3[1], v3[2], v3[0]*v3[0]+ v3[1]*v3[1]+ v3[2]*v3[2]); */
-		/* xform matrix */
-		for (i = 0; i < 3; i++) {
-			mat[i][0] = v1[i];
-			mat[i][1] = v2[i];
-			mat[i][2] = v3[i];
-			mat[i][3] = CA[i];
-		}
-		/*
-		printf("%8.3f %8.3f %8.3f %8.3f\n",mat[0][0],mat[0][1],mat[0][2],mat[0][3]);
-		printf("%8.3f %8.3f %8.3f %8.3f\n",mat[1][0],mat[1][1],mat[1][2],mat[1][3]);
-		printf("%8.3f %8.3f %8.3f %8.3f\n",mat[2][0],mat[2][1],mat[2][2],mat[2][3]);
-		*/
+		sidechain_frame(N, CA, CB, mat);
 		/* apply transformation to canonical all rot side chains coordinates */
-
-
-		for (i = 0; i < nbRot; i++) {
+		rotlib_transform(lib, mat, rotlibX, rotlibY, rotlibZ);
+
+		for (k = 0; k < nbRot; k++) {
+			double partial = 0.0, rest = boundSum;
+			i = rotOrder[k];
+			for (m = 0; m < nbAtoms; m++) {
+				j = order[m];
+				const int at = i * nbAtoms + j;
+				energy[j] = gridenergy(rotlibX[at], rotlibY[at], rotlibZ[at], atypes[j], charges[j]);
+				clashes[j] = atypes[j] != 3 && checkClash(rotlibX[at], rotlibY[at], rotlibZ[at], placed);
+				partial += energy[j] + 6.5 * clashes[j];
+				rest -= atomBound[j];
+				if (bounded && partial + rest > bestScore + 1e-6) break;
+			}
+			if (type >= 0 && type < 26) rotsearch_lookups[type] += m < nbAtoms ? m + 1 : m;
+			if (m < nbAtoms) continue;
 			score = 0.0;
-			clash = 0;
-			sideChainCenter[0] = 0.0;
-			sideChainCenter[1] = 0.0;
-			sideChainCenter[2] = 0.0;
 			for (j = 0; j < nbAtoms; j++) {
-				//fprintf(stderr, "test type %i score %g \n", atypes[i], score);
-				tc[i][j][0] = mat[0][0] * coords[i][j][0] + mat[0][1] * coords[i][j][1] + mat[0][2] * coords[i][j][2] + mat[0][3];
-				tc[i][j][1] = mat[1][0] * coords[i][j][0] + mat[1][1] * coords[i][j][1] + mat[1][2] * coords[i][j][2] + mat[1][3];
-				tc[i][j][2] = mat[2][0] * coords[i][j][0] + mat[2][1] * coords[i][j][1] + mat[2][2] * coords[i][j][2] + mat[2][3];
-				//fprintf(stderr, "test type %i\n", atypes[i]);
-				if (atypes[j]!=3) {
-					sideChainCenter[0] += tc[i][j][0];
-					sideChainCenter[1] += tc[i][j][1];
-					sideChainCenter[2] += tc[i][j][2];
-					clash = checkClash(tc[i][j][0], tc[i][j][1], tc[i][j][2], setCoords, ind);
-					if (clash) score += 6.5;
-				}
-
-				score += gridenergy(tc[i][j][0], tc[i][j][1], tc[i][j][2], atypes[j], charges[j]);
-				
+				if (clashes[j]) score += 6.5;
+				score += energy[j];
 			}
 			//fprintf(stderr, "num %d id %c test nbROT %i type %i score %g \n",a->num,a->id, i, atypes[j], score);
-			//if (clash) break;
-			if (score < bestScore) {
+			if (score < bestScore || (score == bestScore && bestTrial == pertInd && i < a->SCRot)) {
 				bestScore = score;
 				a->SCRot = i;
-				bestSideChainCenter[0] = sideChainCenter[0]/nbHeavyAtoms;
-				bestSideChainCenter[1] = sideChainCenter[1]/nbHeavyAtoms;
-				bestSideChainCenter[2] = sideChainCenter[2]/nbHeavyAtoms;
+				bestTrial = pertInd;
 			}
 		}
+		if (type >= 0 && type < 26) rotsearch_scans[type] += nbRot * nbAtoms;
 	}
 
 	if (bestScore>90000) return 10.0;
 
-	switch (a->id)
-	{
-		case 'I':
-			a->g[0] = (tc[a->SCRot][0][0]+tc[a->SCRot][1][0])/2;
-			a->g[1] = (tc[a->SCRot][0][1]+tc[a->SCRot][1][1])/2;
-			a->g[2] = (tc[a->SCRot][0][2]+tc[a->SCRot][1][2])/2;
-			a->g2[0] = tc[a->SCRot][2][0];
-			a->g2[1] = tc[a->SCRot][2][1];
-			a->g2[2] = tc[a->SCRot][2][2];
-			break;
-		case 'S':
-			a->g[0] = tc[a->SCRot][0][0];
-			a->g[1] = tc[a->SCRot][0][1];
-			a->g[2] = tc[a->SCRot][0][2];
-			break;
-		case 'P':
-			a->g[0] = tc[a->SCRot][0][0];
-			a->g[1] = tc[a->SCRot][0][1];
-			a->g[2] = tc[a->SCRot][0][2];
-			break;
-		case 'T':
-			a->g[0] = tc[a->SCRot][1][0];
-			a->g[1] = tc[a->SCRot][1][1];
-			a->g[2] = tc[a->SCRot][1][2];
-			a->g2[0] = tc[a->SCRot][0][0];
-			a->g2[1] = tc[a->SCRot][0][1];
-			a->g2[2] = tc[a->SCRot][0][2];
-			break;
-		case 'V':
-			a->g[0] = tc[a->SCRot][1][0];
-			a->g[1] = tc[a->SCRot][1][1];
-			a->g[2] = tc[a->SCRot][1][2];
-			a->g2[0] = tc[a->SCRot][0][0];
-			a->g2[1] = tc[a->SCRot][0][1];
-			a->g2[2] = tc[a->SCRot][0][2];
-			break;
-		default:
-                        a->g[0] = tc[a->SCRot][0][0];
-                        a->g[1] = tc[a->SCRot][0][1];
-                        a->g[2] = tc[a->SCRot][0][2];
-			//a->g[0] = bestSideChainCenter[0];
-			//a->g[1] = bestSideChainCenter[1];
-			//a->g[2] = bestSideChainCenter[2];
-			break;
-
+	/* the side chain of the trial that won */
+	a->SCTrial = bestTrial;
+	if (bestTrial != numRand - 1) {
+		rotlib_jitter(a, bestTrial, N);
+		sidechain_frame(N, CA, CB, mat);
+		rotlib_transform(lib, mat, rotlibX, rotlibY, rotlibZ);
 	}
+	const int best = a->SCRot * nbAtoms;
+	sidechain_centers(a->id, rotlibX + best, rotlibY + best, rotlibZ + best, a->g, a->g2);
 		
 
+	if (cached) {
+		memcpy(cached->key, key, sizeof(key));
+		cached->id = a->id;
+		cached->numRand = numRand;
+		cached->SCRot = a->SCRot;
+		cached->SCTrial = a->SCTrial;
+		cached->nbHeavy = cached->nbClash = 0;
+		for (j = 0; j < nbAtoms; j++) {
+			if (atypes[j] == 3) continue;
+			cached->heavy[cached->nbHeavy][0] = rotlibX[best + j];
+			cached->heavy[cached->nbHeavy][1] = rotlibY[best + j];
+			cached->heavy[cached->nbHeavy][2] = rotlibZ[best + j];
+			cached->nbClash += checkClash(rotlibX[best + j], rotlibY[best + j], rotlibZ[best + j], placed);
+			cached->nbHeavy++;
+		}
+		cached->score = bestScore - 6.5 * cached->nbClash;
+		for (i = 0; i < 3; i++) {
+			cached->g[i] = a->g[i];
+			cached->g2[i] = a->g2[i];
+		}
+		rotcache_scan_seconds += gridfile_wtime() - begin;
+	}
+
 	//fprintf(stderr, "score %g \n", bestScore);
 	//free(tc),free(v1),free(v2),free(v3),free(mat);
 
@@ -1780,13 +2086,97 @@ double scoreSideChainNoClash(int nbRot, int nbAtoms, double charges[nbAtoms], in
 
 }
 
-double gridenergy(double X, double Y, double Z, int i, double charge) {
-	//fprintf(stderr, "X %g Y %g Z %g charge \n", X, Y, Z, i);
-	double erg = 0.0;
-	
+/* the 8 records of the trilinear stencil at voxel (x,y,z) of the padded grid with row-major index,
+   in the order of the lowLowLow ... highHighHigh weights of gridenergy */
+static inline void gridvoxel_stencil(int x, int y, int z, int index, const float *corner[8]) {
+	const float *base;
+	size_t dx, dy, dz;
+	if (gridlayout == GRID_LAYOUT_TILED) {
+		/* the +1 neighbour is in the same brick unless the voxel is on the brick face */
+		base = gridvoxels + gridfile_tiled_index(x, y, z, GRIDPAD(NX), GRIDPAD(NY)) * GRIDVOXEL_STRIDE;
+		dx = (x & GRIDTILE_MASK) == GRIDTILE_MASK ? GRIDTILE_VOXELS - GRIDTILE_MASK : 1;
+		dy = (y & GRIDTILE_MASK) == GRIDTILE_MASK ?
+			(size_t)GRIDTILE_BRICKS(GRIDPAD(NX)) * GRIDTILE_VOXELS - GRIDTILE_MASK * GRIDTILE_EDGE : GRIDTILE_EDGE;
+		dz = (z & GRIDTILE_MASK) == GRIDTILE_MASK ?
+			(size_t)GRIDTILE_BRICKS(GRIDPAD(NX)) * GRIDTILE_BRICKS(GRIDPAD(NY)) * GRIDTILE_VOXELS - GRIDTILE_MASK * GRIDTILE_EDGE * GRIDTILE_EDGE : GRIDTILE_EDGE * GRIDTILE_EDGE;
+	} else {
+		base = gridvoxels + (size_t)index * GRIDVOXEL_STRIDE;
+		dx = 1;
+		dy = GRIDPAD(NX);
+		dz = (size_t)GRIDPAD(NX) * GRIDPAD(NY);
+	}
+	dx *= GRIDVOXEL_STRIDE;
+	dy *= GRIDVOXEL_STRIDE;
+	dz *= GRIDVOXEL_STRIDE;
+	corner[0] = base;
+	corner[1] = base + dz;
+	corner[2] = base + dy;
+	corner[3] = base + dy + dz;
+	corner[4] = base + dx;
+	corner[5] = base + dx + dz;
+	corner[6] = base + dx + dy;
+	corner[7] = base + dx + dy + dz;
+}
+
+/* value of map i at voxel (x,y,z) of the box or its guard band, whichever layout the maps are stored in */
+static double gridvalue(int x, int y, int z, int i) {
+	if (gridlayout == GRID_LAYOUT_INTERLEAVED)
+		return gridvoxels[(size_t)getindex(x, y, z) * GRIDVOXEL_STRIDE + i];
+	if (gridlayout == GRID_LAYOUT_TILED)
+		return gridvoxels[gridfile_tiled_index(x + GRIDGUARD, y + GRIDGUARD, z + GRIDGUARD, GRIDPAD(NX), GRIDPAD(NY)) * GRIDVOXEL_STRIDE + i];
+	if (gridprecision == GRID_PRECISION_FLOAT)
+		return gridmapfloats[i][getindex(x, y, z)];
+	if (gridprecision == GRID_PRECISION_INT16)
+		return gridmapoffset[i] + gridmapscale[i] * gridmapshorts[i][getindex(x, y, z)];
+	return gridmapvalues[i][getindex(x, y, z)];
+}
+
+/* trilinear interpolation of separate map i stored as float or 16-bit values.
+   the weights add up to 1, so the 16-bit values are dequantised once, after the sum */
+static inline double gridmap_interpolate(int i, const int index[8], const double frac[8]) {
+	double sum = 0.0;
+	int k;
+	if (gridprecision == GRID_PRECISION_FLOAT) {
+		const float *values = gridmapfloats[i];
+		for (k = 0; k < 8; k++) sum += frac[k] * values[index[k]];
+		return sum;
+	}
+	const short *values = gridmapshorts[i];
+	for (k = 0; k < 8; k++) sum += frac[k] * values[index[k]];
+	return gridmapoffset[i] + gridmapscale[i] * sum;
+}
+
+/* grid coordinates of (X,Y,Z) in the padded maps. returns 1 if the trilinear stencil lies within
+   the gridband voxels of the guard band, tested for all axes at once */
+static inline int gridcoords(double X, double Y, double Z, double g[3]) {
+	const double lo = GRIDGUARD - gridband;
+	g[0] = (X - centerX) / spacing + ((NX - 1) / 2 + GRIDGUARD);
+	g[1] = (Y - centerY) / spacing + ((NY - 1) / 2 + GRIDGUARD);
+	g[2] = (Z - centerZ) / spacing + ((NZ - 1) / 2 + GRIDGUARD);
+	return (g[0] >= lo) & (g[1] >= lo) & (g[2] >= lo) &
+		(g[0] < GRIDGUARD + gridband + NX - 1) & (g[1] < GRIDGUARD + gridband + NY - 1) & (g[2] < GRIDGUARD + gridband + NZ - 1);
+}
+
+/* gridenergy beyond the band: the out-of-box penalty the guard band is filled with */
+static double gridenergy_outside(double X, double Y, double Z) {
 	double exactGridX = (X - centerX) / spacing + (NX - 1) / 2;
 	double exactGridY = (Y - centerY) / spacing + (NY - 1) / 2;
 	double exactGridZ = (Z - centerZ) / spacing + (NZ - 1) / 2;
+	double erg = gridfile_penalty(exactGridX, NX) + gridfile_penalty(exactGridY, NY) + gridfile_penalty(exactGridZ, NZ);
+#ifdef DEBUG
+	if (erg > 1000000000)
+		fprintf(stderr, "X %g Y %g Z %g out of box penalty %g \n", exactGridX, exactGridY, exactGridZ, erg);
+#endif
+	return erg;
+}
+
+double gridenergy(double X, double Y, double Z, int i, double charge) {
+	//fprintf(stderr, "X %g Y %g Z %g charge \n", X, Y, Z, i);
+	double erg = 0.0;
+	double exactGrid[3];
+
+	if (!gridcoords(X, Y, Z, exactGrid)) return gridenergy_outside(X, Y, Z);
+	double exactGridX = exactGrid[0], exactGridY = exactGrid[1], exactGridZ = exactGrid[2];
 	double perAtomtype = 0.0, deSolv = 0.0, eStatic = 0.0;
 	//fprintf(stderr, "type %i charge %g \n", i, charge);
 	double *mapvalue = gridmapvalues[i];;
@@ -1816,48 +2206,42 @@ double gridenergy(double X, double Y, double Z, int i, double charge) {
 		highHighLowFrac = highFracX * highFracY * lowFracZ,
 		highHighHighFrac = highFracX * highFracY * highFracZ;
 
-	int lowLowLowIndex = getindex(exactGridX, exactGridY, exactGridZ);
-	if (lowLowLowIndex < 0 || lowLowLowIndex > NX*NY*NZ) return 0;
-	int	lowLowHighIndex = lowLowLowIndex + NX * NY,
-		lowHighLowIndex = lowLowLowIndex + NX,
-		lowHighHighIndex = lowLowHighIndex + NX,
+	int lowLowLowIndex = (lowGridZ * GRIDPAD(NY) + lowGridY) * GRIDPAD(NX) + lowGridX;
+	int	lowLowHighIndex = lowLowLowIndex + GRIDPAD(NX) * GRIDPAD(NY),
+		lowHighLowIndex = lowLowLowIndex + GRIDPAD(NX),
+		lowHighHighIndex = lowLowHighIndex + GRIDPAD(NX),
 		highLowLowIndex = lowLowLowIndex + 1,
 		highLowHighIndex = lowLowHighIndex + 1,
 		highHighLowIndex = lowHighLowIndex + 1,
 		highHighHighIndex = lowHighHighIndex + 1;
 
-	int outofBox = 0;
-	double outofBoxPen = 0.0;
-	if (exactGridX < 0 || exactGridX > NX - 1) {
-		outofBoxPen = ((exactGridX - NX / 2)*(exactGridX - NX / 2)) / 20.;
-		outofBox = 1;
-		if (outofBoxPen > 1000000000) {
-			fprintf(stderr, "xX %g Y %g Z %g Erg %g \n", exactGridX, exactGridY, exactGridZ, outofBoxPen);
-			return erg + 10;
-		}
-		erg += outofBoxPen;
-	}
-	if (exactGridY < 0 || exactGridY > NY - 1) {
-		outofBoxPen = ((exactGridY - NY / 2)*(exactGridY - NY / 2)) / 20.;
-		outofBox = 1;
-		if (outofBoxPen > 1000000000) {
-			fprintf(stderr, "X %g yY %g Z %g Erg %g \n", exactGridX, exactGridY, exactGridZ, outofBoxPen);
-			return erg + 10;
-		}
-		erg += outofBoxPen;
-	}
-	if (exactGridZ < 0 || exactGridZ > NZ - 1) {
-		outofBoxPen = ((exactGridZ - NZ / 2)*(exactGridZ - NZ / 2)) / 20.;
-		outofBox = 1;
-		if (outofBoxPen > 1000000000) {
-			fprintf(stderr, "X %g Y %g zZ %g Erg %g \n", exactGridX, exactGridY, exactGridZ, outofBoxPen);
-			return erg + 10;
-		}
-		erg += outofBoxPen;
-	}
-	//if (outofBox) 
-		//fprintf(stderr, "X %g Y %g Z %g Erg %g \n", exactGridX, exactGridY, exactGridZ, outofBoxPen);
-	if (!outofBox)	{
+	if (gridlayout != GRID_LAYOUT_SEPARATE) {
+		const float *corner[8];
+		gridvoxel_stencil(lowGridX, lowGridY, lowGridZ, lowLowLowIndex, corner);
+		const double frac[8] = { lowLowLowFrac, lowLowHighFrac, lowHighLowFrac, lowHighHighFrac,
+			highLowLowFrac, highLowHighFrac, highHighLowFrac, highHighHighFrac };
+		for (int k = 0; k < 8; k++) {
+			perAtomtype += frac[k] * corner[k][i];
+			eStatic += frac[k] * corner[k][7];
+			deSolv += frac[k] * corner[k][8];
+		}
+		eStatic *= charge;
+		deSolv *= abscharge;
+
+		erg = perAtomtype + deSolv + eStatic;
+	}
+	else if (gridprecision != GRID_PRECISION_DOUBLE) {
+		const int index[8] = { lowLowLowIndex, lowLowHighIndex, lowHighLowIndex, lowHighHighIndex,
+			highLowLowIndex, highLowHighIndex, highHighLowIndex, highHighHighIndex };
+		const double frac[8] = { lowLowLowFrac, lowLowHighFrac, lowHighLowFrac, lowHighHighFrac,
+			highLowLowFrac, highLowHighFrac, highHighLowFrac, highHighHighFrac };
+		perAtomtype = gridmap_interpolate(i, index, frac);
+		eStatic = charge * gridmap_interpolate(7, index, frac);
+		deSolv = abscharge * gridmap_interpolate(8, index, frac);
+
+		erg = perAtomtype + deSolv + eStatic;
+	}
+	else {
 		perAtomtype = lowLowLowFrac * mapvalue[lowLowLowIndex] +
 			lowLowHighFrac * mapvalue[lowLowHighIndex] +
 			lowHighLowFrac * mapvalue[lowHighLowIndex] +
@@ -1886,44 +2270,386 @@ double gridenergy(double X, double Y, double Z, int i, double charge) {
 		erg = perAtomtype + deSolv + eStatic;
 	}
 
-	//fprintf(stderr, "index %i exenergy %g atom %g estatic %g des %g \n", highHighHighIndex, erg, perAtomtype, deSolv, eStatic);
+#ifdef DEBUG
+	/* diagnostics of implausible map values, build with -DDEBUG */
 	if (erg>1000000|| erg<-1000000){
-		//0 / 0;
+		int x = lowGridX - GRIDGUARD, y = lowGridY - GRIDGUARD, z = lowGridZ - GRIDGUARD;
 		fprintf(stderr, "index %i exenergy %g atom %g estatic %g des %g \n", i, erg, perAtomtype, deSolv, eStatic);
 		if (perAtomtype != 0) {
 			fprintf(stderr, "exenergy %g atom %g estatic %g des %g %g %g %g %g \n",
-				mapvalue[lowLowLowIndex], mapvalue[lowLowHighIndex],
-				mapvalue[lowHighLowIndex], mapvalue[lowHighHighIndex],
-				mapvalue[highLowLowIndex], mapvalue[highLowHighIndex],
-				mapvalue[highHighLowIndex], mapvalue[highHighHighIndex]);
-			fprintf(stderr, "X %g Y %g Z %g \n", exactGridX, exactGridY, exactGridZ);
+				gridvalue(x, y, z, i), gridvalue(x, y, z + 1, i),
+				gridvalue(x, y + 1, z, i), gridvalue(x, y + 1, z + 1, i),
+				gridvalue(x + 1, y, z, i), gridvalue(x + 1, y, z + 1, i),
+				gridvalue(x + 1, y + 1, z, i), gridvalue(x + 1, y + 1, z + 1, i));
+			fprintf(stderr, "X %g Y %g Z %g \n", exactGridX - GRIDGUARD, exactGridY - GRIDGUARD, exactGridZ - GRIDGUARD);
 			fprintf(stderr, "X %g Y %g Z %g \n", X, Y, Z);
 			stop("baddd");
 		}
 
-		fprintf(stderr, "X %g Y %g Z %g \n", exactGridX, exactGridY, exactGridZ);
+		fprintf(stderr, "X %g Y %g Z %g \n", exactGridX - GRIDGUARD, exactGridY - GRIDGUARD, exactGridZ - GRIDGUARD);
 		fprintf(stderr, "X %g Y %g Z %g \n", X, Y, Z);
-		//stop("baddd");
-		//0/0;
 	}
-	//fprintf(stderr, "index %i exenergy %g atom %g estatic %g des %g \n", highHighHighIndex, erg, perAtomtype, deSolv, eStatic);
+#endif
 	return erg;
 }
 
-static int indMoved(int ind, int start, int end){
-	if (start>=end){
-		if (ind>end && ind<start)
-			return 0;
-		else
-			return 1;
-	} else {
-		if (ind>=start && ind<=end)
-			return 1;
+/* gridenergy and its analytic gradient d/dX, d/dY, d/dZ in grad:
+   the derivative of the trilinear interpolation within the band, of the penalty beyond */
+double gridenergy_gradient(double X, double Y, double Z, int i, double charge, double grad[3]) {
+	double erg = gridenergy(X, Y, Z, i, charge);
+	const int N[3] = { NX, NY, NZ };
+	double exactGrid[3];
+	double abscharge = (charge >= 0. ? charge : -charge);
+	int d, k;
+
+	grad[0] = grad[1] = grad[2] = 0.0;
+	if (!gridcoords(X, Y, Z, exactGrid)) {
+		for (d = 0; d < 3; d++) {
+			double g = exactGrid[d] - GRIDGUARD;
+			if (g < 0 || g > N[d] - 1) grad[d] = (g - N[d] / 2) / 10. / spacing;
+		}
+		return erg;
+	}
+
+	int low[3];
+	double highFrac[3], lowFrac[3];
+	for (d = 0; d < 3; d++) {
+		low[d] = (int)exactGrid[d];
+		highFrac[d] = exactGrid[d] - low[d];
+		lowFrac[d] = 1. - highFrac[d];
+		low[d] -= GRIDGUARD;
+	}
+	/* corner k is +1 along x, y, z for bits 4, 2, 1, as lowLowLow ... highHighHigh in gridenergy */
+	for (k = 0; k < 8; k++) {
+		int dx = (k >> 2) & 1, dy = (k >> 1) & 1, dz = k & 1;
+		double value = gridvalue(low[0] + dx, low[1] + dy, low[2] + dz, i) +
+			charge * gridvalue(low[0] + dx, low[1] + dy, low[2] + dz, 7) +
+			abscharge * gridvalue(low[0] + dx, low[1] + dy, low[2] + dz, 8);
+		double wx = dx ? highFrac[0] : lowFrac[0], wy = dy ? highFrac[1] : lowFrac[1], wz = dz ? highFrac[2] : lowFrac[2];
+		grad[0] += (dx ? value : -value) * wy * wz;
+		grad[1] += (dy ? value : -value) * wx * wz;
+		grad[2] += (dz ? value : -value) * wx * wy;
+	}
+	for (d = 0; d < 3; d++) grad[d] /= spacing;
+	return erg;
+}
+
+/* build the min/max pyramid of the maps as they are stored (layout and precision).
+   call after the layout and precision are set */
+void gridpyramid_initialise() {
+	const int N[3] = { NX, NY, NZ };
+	int level, d, i, x, y, z;
+
+	for (level = 0; level < GRIDPYRAMID_LEVELS; level++) {
+		Gridpyramid_level *p = gridpyramid + level;
+		p->edge = GRIDPYRAMID_EDGE << level;
+		for (d = 0; d < 3; d++) {
+			p->nb[d] = (N[d] - 1 + p->edge - 1) / p->edge;
+			if (p->nb[d] < 1) p->nb[d] = 1;
+		}
+		free(p->bounds);
+		p->bounds = malloc((size_t)p->nb[0] * p->nb[1] * p->nb[2] * 2 * GRIDFILE_NMAPS * sizeof(double));
+		if (!p->bounds) stop("Unable to allocate memory in gridpyramid_initialise.");
+
+		for (z = 0; z < p->nb[2]; z++)
+		for (y = 0; y < p->nb[1]; y++)
+		for (x = 0; x < p->nb[0]; x++) {
+			double *b = p->bounds + (((size_t)z * p->nb[1] + y) * p->nb[0] + x) * 2 * GRIDFILE_NMAPS;
+			for (i = 0; i < GRIDFILE_NMAPS; i++) {
+				b[i] = DBL_MAX;
+				b[GRIDFILE_NMAPS + i] = -DBL_MAX;
+			}
+			if (level == 0) {
+				/* the voxels of the block and of its +1 faces */
+				for (int vz = z * p->edge; vz <= (z + 1) * p->edge && vz < NZ; vz++)
+				for (int vy = y * p->edge; vy <= (y + 1) * p->edge && vy < NY; vy++)
+				for (int vx = x * p->edge; vx <= (x + 1) * p->edge && vx < NX; vx++)
+					for (i = 0; i < GRIDFILE_NMAPS; i++) {
+						double v = gridvalue(vx, vy, vz, i);
+						if (v < b[i]) b[i] = v;
+						if (v > b[GRIDFILE_NMAPS + i]) b[GRIDFILE_NMAPS + i] = v;
+					}
+			} else {
+				/* the 2x2x2 finer blocks */
+				const Gridpyramid_level *f = gridpyramid + level - 1;
+				for (int cz = 2 * z; cz <= 2 * z + 1 && cz < f->nb[2]; cz++)
+				for (int cy = 2 * y; cy <= 2 * y + 1 && cy < f->nb[1]; cy++)
+				for (int cx = 2 * x; cx <= 2 * x + 1 && cx < f->nb[0]; cx++) {
+					const double *c = f->bounds + (((size_t)cz * f->nb[1] + cy) * f->nb[0] + cx) * 2 * GRIDFILE_NMAPS;
+					for (i = 0; i < GRIDFILE_NMAPS; i++) {
+						if (c[i] < b[i]) b[i] = c[i];
+						if (c[GRIDFILE_NMAPS + i] > b[GRIDFILE_NMAPS + i]) b[GRIDFILE_NMAPS + i] = c[GRIDFILE_NMAPS + i];
+					}
+				}
+			}
+		}
+	}
+}
+
+/* lower bound of gridenergy(X, Y, Z, i, charge) over the box lo..hi (in A),
+   from the coarsest pyramid level whose blocks are at least as wide as the box */
+double gridpyramid_bound(int i, double charge, const double lo[3], const double hi[3]) {
+	const double center[3] = { centerX, centerY, centerZ };
+	const int N[3] = { NX, NY, NZ };
+	double glo[3], ghi[3], span = 0.0, bound = DBL_MAX;
+	int blo[3], bhi[3], d, level;
+
+	if (gridpyramid[0].bounds == NULL) return -DBL_MAX;
+	for (d = 0; d < 3; d++) {
+		glo[d] = (lo[d] - center[d]) / spacing + (N[d] - 1) / 2;
+		ghi[d] = (hi[d] - center[d]) / spacing + (N[d] - 1) / 2;
+		/* outside the box gridenergy interpolates between the face of the box and the
+		   penalties of the guard band, or is the penalty, so at least min(face bound, 0) */
+		if (glo[d] < 0) {
+			bound = 0.0;
+			glo[d] = 0;
+		}
+		if (ghi[d] > N[d] - 1) {
+			bound = 0.0;
+			ghi[d] = N[d] - 1;
+		}
+		if (glo[d] > N[d] - 1) glo[d] = N[d] - 1;
+		if (ghi[d] < 0) ghi[d] = 0;
+		if (ghi[d] - glo[d] > span) span = ghi[d] - glo[d];
+	}
+	for (level = 0; level < GRIDPYRAMID_LEVELS - 1 && gridpyramid[level].edge < span; level++);
+	const Gridpyramid_level *p = gridpyramid + level;
+	for (d = 0; d < 3; d++) {
+		blo[d] = (int)(glo[d] / p->edge);
+		bhi[d] = (int)(ghi[d] / p->edge);
+		if (blo[d] > p->nb[d] - 1) blo[d] = p->nb[d] - 1;
+		if (bhi[d] > p->nb[d] - 1) bhi[d] = p->nb[d] - 1;
+	}
+	double abscharge = (charge >= 0. ? charge : -charge);
+	for (int z = blo[2]; z <= bhi[2]; z++)
+	for (int y = blo[1]; y <= bhi[1]; y++)
+	for (int x = blo[0]; x <= bhi[0]; x++) {
+		const double *b = p->bounds + (((size_t)z * p->nb[1] + y) * p->nb[0] + x) * 2 * GRIDFILE_NMAPS;
+		double erg = b[i] + (charge >= 0. ? charge * b[7] : charge * b[GRIDFILE_NMAPS + 7]) + abscharge * b[8];
+		if (erg < bound) bound = erg;
+	}
+	return bound;
+}
+
+/* whether residue ind is in the segment start..end of a move on a chain of n residues,
+   end past n wrapping around the ring (see metropolis.c) */
+static int indMoved(int ind, int start, int end, int n){
+	if (end > n)
+		return ind >= start || ind <= (end-1)%n+1;
+	return ind >= start && ind <= end;
+}
+
+
+/* append a backbone atom to the gridenergy_batch arrays */
+static void bbatom(double *X, double *Y, double *Z, int *types, double *charges, int *n, vector xyz, int type, double charge) {
+	X[*n] = xyz[0];
+	Y[*n] = xyz[1];
+	Z[*n] = xyz[2];
+	types[*n] = type;
+	charges[*n] = charge;
+	(*n)++;
+}
+
+/* the H, C, CA, CB, N, O atoms of residues start..end with their grid map types and charges,
+   first[i - start] is the first atom of residue i. returns the number of atoms, at most 6 per residue */
+int ADbackbone_atoms(int start, int end, Chain *chain, Chaint *chaint, double *X, double *Y, double *Z, int *types, double *charges, int *first)
+{
+	AA *a;
+	int i, nbBB = 0;
+	for (i = start; i <= end; i++) {
+		double CCharge = 0.241, CaCharge = 0.186, NCharge = -0.346, OCharge = -0.271, CbCharge = 0.050, HCharge = 0.163;
+		if (chaint!=NULL)
+			a = chaint->aat + (1 + (i-1)%(chain->NAA-1));
 		else
-			return 0;
+			a = chain->aa + (1 + (i-1)%(chain->NAA-1));
+
+		/* element types are 0:C, 1:N, 2:O, 3:H, 4:S, 5:CA, 6:NA           */
+		if (a->id == 'G') {
+			CaCharge = 0.218;
+		}
+		else if (a->id == 'S') {
+			CaCharge = 0.219;
+			CbCharge = 0.199;
+		}
+		else if (a->id == 'P') {
+			CaCharge = 0.165;
+			CbCharge = 0.034;
+			NCharge = -0.29;
+		}
+		else if (a->id == 'C') {
+			CbCharge = 0.120;
+		}
+		else if (a->id == 'T' || a->id == 'D' || a->id == 'N') {
+			CbCharge = 0.146;
+		}
+
+		if (a->num == 1) {
+			NCharge = -0.06;
+			HCharge = 0.275;
+			CCharge = 0.21;
+			//CaCharge = 0.28;
+		}
+
+		if (a->num == chain->NAA - 1) {
+			//NCharge = -0.06;
+			OCharge = -0.65;
+			//CCharge = 0.484;
+			CCharge = 0.21;
+		}
+
+		if (first) first[i - start] = nbBB;
+		if (a->id != 'P') bbatom(X, Y, Z, types, charges, &nbBB, a->h, 3, HCharge);
+		bbatom(X, Y, Z, types, charges, &nbBB, a->c, 0, CCharge);
+		bbatom(X, Y, Z, types, charges, &nbBB, a->ca, 0, CaCharge);
+		if (a->id != 'G') bbatom(X, Y, Z, types, charges, &nbBB, a->cb, 0, CbCharge);
+		bbatom(X, Y, Z, types, charges, &nbBB, a->n, 1, NCharge);
+		bbatom(X, Y, Z, types, charges, &nbBB, a->o, 2, OCharge);
+	}
+	return nbBB;
+}
+
+static double sidechain_bound(const Rotlib *lib, AA *a, int numRand);
+
+static double score_best(const Rotlib *lib, AA *a, const Clashgrid *placed, int numRand)
+{
+	return scoreSideChain(lib, a, 1);
+}
+
+static double score_gamma(const Rotlib *lib, AA *a, const Clashgrid *placed, int numRand)
+{
+	return gridenergy(a->g[0], a->g[1], a->g[2], 4, -0.095);
+}
+
+static double bound_best(const Rotlib *lib, AA *a, int numRand)
+{
+	return sidechain_bound(lib, a, 1);
+}
+
+static double bound_gamma(const Rotlib *lib, AA *a, int numRand)
+{
+	return gridenergy(a->g[0], a->g[1], a->g[2], 4, -0.095);
+}
+
+/* the atoms of the side chain of residue a as placed: the rotamer SCRot of trial SCTrial in its frame,
+   or its gamma atom. returns their number, -1 without a valid rotamer */
+static int sidechain_atoms(const Rotlib *lib, AA *a, double *X, double *Y, double *Z, int *types, double *charges)
+{
+	if (lib->mode == ROTLIB_GAMMA) {
+		X[0] = a->g[0];
+		Y[0] = a->g[1];
+		Z[0] = a->g[2];
+		types[0] = 4;
+		charges[0] = -0.095;
+		return 1;
+	}
+	if (a->SCRot < 0 || a->SCRot >= lib->nbRot) return -1;
+	float N[3], CA[3] = { a->ca[0], a->ca[1], a->ca[2] }, CB[3] = { a->cb[0], a->cb[1], a->cb[2] };
+	float mat[3][4];
+	rotlib_jitter(a, a->SCTrial, N);
+	sidechain_frame(N, CA, CB, mat);
+	for (int j = 0; j < lib->nbAtoms; j++) {
+		const int k = a->SCRot * lib->nbAtoms + j;
+		const float x = lib->x[k], y = lib->y[k], z = lib->z[k];
+		float t;
+		t = mat[0][0] * x + mat[0][1] * y + mat[0][2] * z + mat[0][3];
+		X[j] = t;
+		t = mat[1][0] * x + mat[1][1] * y + mat[1][2] * z + mat[1][3];
+		Y[j] = t;
+		t = mat[2][0] * x + mat[2][1] * y + mat[2][2] * z + mat[2][3];
+		Z[j] = t;
+		types[j] = lib->atypes[j];
+		charges[j] = lib->charges[j];
+	}
+	return lib->nbAtoms;
+}
+
+/* keep the side chains of residues start..end as placed in store, per residue (SideChains=1) */
+static void sidechain_keep(Sidechain *store, int start, int end, Chain *chain, Chaint *chaint, model_params *mod_params)
+{
+	const int nbAtoms = rotlib_atoms();
+	double X[nbAtoms], Y[nbAtoms], Z[nbAtoms], charges[nbAtoms];
+	int types[nbAtoms];
+
+	if (store == NULL) return;
+	for (int i = start; i <= end; i++) {
+		const int res = 1 + (i-1)%(chain->NAA-1);
+		AA *a = (chaint != NULL ? chaint->aat : chain->aa) + res;
+		Sidechain *sc = store + res;
+		const Rotlib *lib = rotlib(a->id);
+		sc->nbAtoms = 0;
+		if (!lib || lib->mode == ROTLIB_GAMMA || (int) mod_params->external_r0[0] != 1) continue;
+		int n = sidechain_atoms(lib, a, X, Y, Z, types, charges);
+		if (n < 0) continue;
+		const double *frame[3] = { a->n, a->ca, a->cb };
+		for (int k = 0; k < 9; k++) sc->frame[k] = frame[k / 3][k % 3];
+		sc->SCRot = a->SCRot;
+		sc->SCTrial = a->SCTrial;
+		for (int k = 0; k < n; k++) {
+			sc->atypes[k] = types[k];
+			sc->xyz[k][0] = X[k];
+			sc->xyz[k][1] = Y[k];
+			sc->xyz[k][2] = Z[k];
+		}
+		sc->nbAtoms = n;
 	}
 }
 
+/* the side chain score of ADenergyNoClash and its lower bound, by Rotlib mode */
+static const struct {
+	double (*score)(const Rotlib *lib, AA *a, const Clashgrid *placed, int numRand);
+	double (*bound)(const Rotlib *lib, AA *a, int numRand);
+} sidechain_dispatch[ROTLIB_MODES] = {
+	{ scoreSideChainNoClash, sidechain_bound },	/* ROTLIB_NOCLASH */
+	{ score_best, bound_best },			/* ROTLIB_BEST */
+	{ score_gamma, bound_gamma },			/* ROTLIB_GAMMA */
+};
+
+/* ADenergyNoClash with the side chains of the moved residues packed together (Pack=1) instead of
+   placed one after the other in both directions. the unmoved residues, the moved backbones and the
+   residues without rotamers are fixed */
+static void ADenergyNoClash_packed(double *ADEnergies, int start, int end, Chain *chain, Chaint *chaint, Clashgrid *placed, const double *bbEnergies, const int *bbFirst, int numRand)
+{
+	int nbRes = end - start + 1, nbPacked = 0, packedInd[nbRes];
+	AA *packed[nbRes];
+	double packedEnergies[nbRes];
+
+	for (int i = start; i <= end; i++) {
+		AA *a = (chaint != NULL ? chaint->aat : chain->aa) + (1 + (i-1)%(chain->NAA-1));
+		const double *bb = bbEnergies + bbFirst[i - start];
+		double erg = 0.0;
+		if (a->id != 'P') erg += *bb++;
+		erg += *bb++;
+		erg += *bb++;
+		if (a->id != 'G') erg += *bb++;
+		erg += *bb++;
+		erg += *bb++;
+		if (erg > 10000000 || erg < -10000000)
+			stop("Grid energy exceeds limits, something wrong!");
+
+		const Rotlib *lib = rotlib(a->id);
+		if (sidechain_library(a->id)) {
+			packed[nbPacked] = a;
+			packedInd[nbPacked++] = i - start;
+		}
+		else if (lib)
+			erg += sidechain_dispatch[lib->mode].score(lib, a, placed, 1);
+		ADEnergies[i - start] = erg;
+
+		if (nbPacked > 0 && packed[nbPacked - 1] == a) continue;
+		if (a->id != 'G')
+			clashgrid_add(placed, a->cb);
+		if (a->etc & G__)
+			clashgrid_add(placed, a->g);
+		if (a->etc & G2_)
+			clashgrid_add(placed, a->g2);
+	}
+	sidechain_pack(nbPacked, packed, placed, numRand, packedEnergies);
+	for (int k = 0; k < nbPacked; k++)
+		ADEnergies[packedInd[k]] += packedEnergies[k];
+	// AD energy is in kcal/mol, scale down kcal/mol to RT!
+	for (int i = 0; i < nbRes; i++)
+		ADEnergies[i] /= 0.59219;
+}
 
 void ADenergyNoClash(double* ADEnergies, int start, int end, Chain *chain, Chaint *chaint, model_params *mod_params, int mod)
 {
@@ -1932,73 +2658,52 @@ void ADenergyNoClash(double* ADEnergies, int start, int end, Chain *chain, Chain
 	//if ((mod_params->external_potential_type != 1 && mod_params->external_potential_type != 3) || !(a->etc & CONSTRAINED)) return 0.0;
 	/* C-O-M or n, ca, c */
 	//gridmap_initialise();
-	double coordsSet[30 * chain->NAA];
+	/* the placed atoms the side chains are checked for clashes against: at most 10 per residue */
+	double placedCoords[30 * chain->NAA];
+	int placedNext[10 * chain->NAA], placedBucket[10 * chain->NAA];
+	Clashgrid placed;
+	clashgrid_initialise(&placed, placedCoords, placedNext, placedBucket);
 	//double *currgridmapvalues = malloc(NX*NY*NZ * sizeof(double));
 
 	//double *coordsSet = malloc(21 * chain->NAA * sizeof(double));
 
-	int ind = 0;
 	int numRand = 1;
 	int numDir = 1;
 	if (mod == 1) {
-		numRand = 3;
+		numRand = 1 + mod_params->rotamer_jitter;
 		numDir = 2;
 	}
 
 	AA* a;
 	int i = 0; int j = 0; int m = 0;
-	for (i = 0; i <= 30 * chain->NAA -1; i++){
-		coordsSet[i] = 9999.;
-	}
-
 	int linked = 0;
 	if (end > chain->NAA-1) linked = 1;
 
 
 	for (i = 1; i <= chain->NAA-1; i++){
-		if (chaint!=NULL && indMoved(i, start, (end-1)%(chain->NAA-1)+1 )) {
+		if (chaint!=NULL && indMoved(i, start, end, chain->NAA-1)) {
 			a = chaint->aat + i;
 		}
 		else {
 			a = chain->aa + i;
 		}
-		if (!indMoved(i, start, (end-1)%(chain->NAA-1)+1 )) {
-			if (a->id != 'G'){
-				coordsSet[ind]=a->cb[0]; ind++;
-				coordsSet[ind]=a->cb[1]; ind++;
-				coordsSet[ind]=a->cb[2]; ind++;
-			}
-			if (a->etc & G__){
-				coordsSet[ind]=a->g[0]; ind++;
-				coordsSet[ind]=a->g[1]; ind++;
-				coordsSet[ind]=a->g[2]; ind++;
-			}
-			if (a->etc & G2_){
-				coordsSet[ind]=a->g2[0]; ind++;
-				coordsSet[ind]=a->g2[1]; ind++;
-				coordsSet[ind]=a->g2[2]; ind++;
-			}
+		if (!indMoved(i, start, end, chain->NAA-1)) {
+			if (a->id != 'G')
+				clashgrid_add(&placed, a->cb);
+			if (a->etc & G__)
+				clashgrid_add(&placed, a->g);
+			if (a->etc & G2_)
+				clashgrid_add(&placed, a->g2);
 		}
-		coordsSet[ind]=a->ca[0]; ind++;
-		coordsSet[ind]=a->ca[1]; ind++;
-		coordsSet[ind]=a->ca[2]; ind++;
-		coordsSet[ind]=a->c[0]; ind++;
-		coordsSet[ind]=a->c[1]; ind++;
-		coordsSet[ind]=a->c[2]; ind++;
-		coordsSet[ind]=a->n[0]; ind++;
-		coordsSet[ind]=a->n[1]; ind++;
-		coordsSet[ind]=a->n[2]; ind++;
-		coordsSet[ind]=a->o[0]; ind++;
-		coordsSet[ind]=a->o[1]; ind++;
-		coordsSet[ind]=a->o[2]; ind++;
-	}
-	//fprintf(stderr, "count %d %d %d\n", ind,start,end);
-	int notmovedind = ind;
+		clashgrid_add(&placed, a->ca);
+		clashgrid_add(&placed, a->c);
+		clashgrid_add(&placed, a->n);
+		clashgrid_add(&placed, a->o);
+	}
+	int notmoved = placed.n;
 	double sideChainEnergy = 0.0;
 	double erg = 0.0;
 	double exC = 0.0, exCa = 0.0, exN = 0.0, exO = 0.0, exCb = 0.0, exH = 0.0;
-	double CCharge = 0.241, CaCharge = 0.186, NCharge = -0.346, OCharge = -0.271, CbCharge = 0.050, HCharge = 0.163;
-	//for (int i =0; i< ind; i++) fprintf(stderr, "count C %g \n", coordsSet[i]);
 	//double *energiesforward = malloc((end-start+1) * sizeof(double));
 	//double *energiesbackward = malloc((end-start+1) * sizeof(double));
 	double energiesforward[end-start+1];
@@ -2008,19 +2713,31 @@ void ADenergyNoClash(double* ADEnergies, int start, int end, Chain *chain, Chain
 		energiesbackward[m-start] = 99999.0;
 		//fprintf(stderr, "bb Energy %g %g\n", energiesforward[m-start],energiesbackward[m-start]);
 	}
+	/* a single direction (mod 0) is drawn at random: taking it from the segment would place all the
+	   side chains of a one residue move, and of any segment of even start + end, the same way */
 	int direction = 1;
 	if (mod == 0) direction = rand()%100<50 ? 1 : 0;
 
 
 
+	/* the backbone grid energies do not depend on the packing order:
+	   evaluate them once for both directions, in one batch over H, C, CA, CB, N, O of all residues */
+	int nbRes = end - start + 1;
+	double bbX[6 * nbRes], bbY[6 * nbRes], bbZ[6 * nbRes], bbCharges[6 * nbRes], bbEnergies[6 * nbRes];
+	int bbTypes[6 * nbRes], bbFirst[nbRes];
+	int nbBB = ADbackbone_atoms(start, end, chain, chaint, bbX, bbY, bbZ, bbTypes, bbCharges, bbFirst);
+	gridenergy_batch(nbBB, bbX, bbY, bbZ, bbTypes, bbCharges, bbEnergies);
+
+	if (mod_params->sidechain_pack && (int) mod_params->external_r0[0] == 1) {
+		ADenergyNoClash_packed(ADEnergies, start, end, chain, chaint, &placed, bbEnergies, bbFirst, numRand);
+		sidechain_keep(chaint != NULL ? chaint->sct : chain->sc, start, end, chain, chaint, mod_params);
+		return;
+	}
+
 	for (m=0; m<numDir; m++) {
-		for (int ii = notmovedind; ii <= 30 * chain->NAA -1; ii++){
-			coordsSet[ii] = 9999.;
-		}
-		
-		ind = notmovedind;
+		/* each direction places the moved side chains again */
+		clashgrid_truncate(&placed, notmoved);
 		for (j = start; j <= end; j++) {
-			CCharge = 0.241, CaCharge = 0.186, NCharge = -0.346, OCharge = -0.271, CbCharge = 0.050, HCharge = 0.163;
 			if ((mod == 1 && m == 0) || direction == 0) 
 				i = j;
 			else
@@ -2035,62 +2752,20 @@ void ADenergyNoClash(double* ADEnergies, int start, int end, Chain *chain, Chain
 			//else
 			//	a = chain->aa + i;
 
-			/* element types are 0:C, 1:N, 2:O, 3:H, 4:S, 5:CA, 6:NA           */
-			
-			//fprintf(stderr, "energies C %g CA %g N %g O %g \n", a->c[0], a->c[1], a->c[2], exO);
-
-			if (a->id == 'G') {
-				CaCharge = 0.218;
-			}
-			else if (a->id == 'S') {
-				CaCharge = 0.219;
-				CbCharge = 0.199;
-			}
-			else if (a->id == 'P') {
-				CaCharge = 0.165;
-				CbCharge = 0.034;
-				NCharge = -0.29;
-			}
-			else if (a->id == 'C') {
-				CbCharge = 0.120;
-			}
-			else if (a->id == 'T' || a->id == 'D' || a->id == 'N') {
-				CbCharge = 0.146;
-			}
-
-			if (a->num == 1) {
-				NCharge = -0.06;
-				HCharge = 0.275;
-				CCharge = 0.21;
-				//CaCharge = 0.28;
-			}
-
-			if (a->num == chain->NAA - 1) {
-				//NCharge = -0.06;
-				OCharge = -0.65;
-				//CCharge = 0.484;
-				CCharge = 0.21;
-			}
-
 			sideChainEnergy = 0.0;
 			erg = 0.0;
 			//exC = 0.0, exCa = 0.0, exN = 0.0, exO = 0.0, exCb = 0.0, exH = 0.0;
+			const double *bb = bbEnergies + bbFirst[i - start];
 			if (a->id != 'P') {
-				exH = gridenergy(a->h[0], a->h[1], a->h[2], 3, HCharge);
+				exH = *bb++;
 			}
-			exC = gridenergy(a->c[0], a->c[1], a->c[2], 0, CCharge);
-			//fprintf(stderr, "energies C %g CA %g N %g O %g \n", exC, exCa, exN, exO);
-			exCa = gridenergy(a->ca[0], a->ca[1], a->ca[2], 0, CaCharge);
-			//fprintf(stderr, "energies C %g CA %g N %g O %g \n", exC, exCa, exN, exO);
-			//exH = gridenergy(a->h[0], a->h[1], a->h[2], 3, HCharge);
+			exC = *bb++;
+			exCa = *bb++;
 			if (a->id != 'G') {
-				exCb = gridenergy(a->cb[0], a->cb[1], a->cb[2], 0, CbCharge);
+				exCb = *bb++;
 			}
-			//fprintf(stderr, "energies C %g CA %g N %g O %g \n", exC, exCa, exN, exO);
-			exN = gridenergy(a->n[0], a->n[1], a->n[2], 1, NCharge);
-			//fprintf(stderr, "energies C %g CA %g N %g O %g \n", exC, exCa, exN, exO);
-			exO = gridenergy(a->o[0], a->o[1], a->o[2], 2, OCharge);
-			//fprintf(stderr, "energies C %g CA %g N %g O %g \n", exC, exCa, exN, exO);
+			exN = *bb++;
+			exO = *bb++;
 			erg = (exC + exCa + exH + exN + exO + exCb);
 			
 			if (erg > 10000000 || erg < -10000000) {
@@ -2101,70 +2776,9 @@ void ADenergyNoClash(double* ADEnergies, int start, int end, Chain *chain, Chain
 				
 			/*Here is a hack, external_r0[0] term 1.x indicate to reconstruct full-atom sidechain score grid energy */
 			if ((int) mod_params->external_r0[0] == 1) {
-				switch (a->id)
-				{
-				case 'I':
-					//sideChainEnergy = gridenergy(a->g2[0], a->g2[1], a->g2[2], 0, 0.012) + gridenergy(a->g[0], a->g[1], a->g[2], 0, 0.012);
-					sideChainEnergy = scoreSideChainNoClash(ILE.nbRot, ILE.nbAtoms, ILE.charges, ILE.atypes, ILE.coords, a, coordsSet, ind, numRand);
-					break;
-				case 'L':
-					sideChainEnergy = scoreSideChainNoClash(LEU.nbRot, LEU.nbAtoms, LEU.charges, LEU.atypes, LEU.coords, a, coordsSet, ind, numRand);
-					break;
-				case 'P':
-					sideChainEnergy = scoreSideChain(PRO.nbRot, PRO.nbAtoms, PRO.charges, PRO.atypes, PRO.coords, a, 1);
-					break;
-				case 'V':
-					sideChainEnergy = scoreSideChainNoClash(VAL.nbRot, VAL.nbAtoms, VAL.charges, VAL.atypes, VAL.coords, a, coordsSet, ind, numRand);
-					//sideChainEnergy = gridenergy(a->g2[0], a->g2[1], a->g2[2], 0, 0.012) + gridenergy(a->g[0], a->g[1], a->g[2], 0, 0.012);
-					break;
-				case 'F':
-					sideChainEnergy = scoreSideChainNoClash(PHE.nbRot, PHE.nbAtoms, PHE.charges, PHE.atypes, PHE.coords, a, coordsSet, ind, numRand);
-					break;
-				case 'W':
-					sideChainEnergy = scoreSideChainNoClash(TRP.nbRot, TRP.nbAtoms, TRP.charges, TRP.atypes, TRP.coords, a, coordsSet, ind, numRand);
-					break;
-				case 'Y':
-					sideChainEnergy = scoreSideChainNoClash(TYR.nbRot, TYR.nbAtoms, TYR.charges, TYR.atypes, TYR.coords, a, coordsSet, ind, numRand);
-					break;
-				case 'D':
-					sideChainEnergy = scoreSideChainNoClash(ASP.nbRot, ASP.nbAtoms, ASP.charges, ASP.atypes, ASP.coords, a, coordsSet, ind, numRand);
-					break;
-				case 'E':
-					sideChainEnergy = scoreSideChainNoClash(GLU.nbRot, GLU.nbAtoms, GLU.charges, GLU.atypes, GLU.coords, a, coordsSet, ind, numRand);
-					break;
-				case 'R':
-					sideChainEnergy = scoreSideChainNoClash(ARG.nbRot, ARG.nbAtoms, ARG.charges, ARG.atypes, ARG.coords, a, coordsSet, ind, numRand);
-					break;
-				case 'H':
-					sideChainEnergy = scoreSideChainNoClash(HIS.nbRot, HIS.nbAtoms, HIS.charges, HIS.atypes, HIS.coords, a, coordsSet, ind, numRand);
-					break;
-				case 'K':
-					sideChainEnergy = scoreSideChainNoClash(LYS.nbRot, LYS.nbAtoms, LYS.charges, LYS.atypes, LYS.coords, a, coordsSet, ind, numRand);
-					break;
-				case 'S':
-					sideChainEnergy = scoreSideChainNoClash(SER.nbRot, SER.nbAtoms, SER.charges, SER.atypes, SER.coords, a, coordsSet, ind, numRand);
-					//sideChainEnergy = gridenergy(a->g[0], a->g[1], a->g[2], 2, -0.398);
-					break;
-				case 'T':
-					sideChainEnergy = scoreSideChainNoClash(THR.nbRot, THR.nbAtoms, THR.charges, THR.atypes, THR.coords, a, coordsSet, ind, numRand);
-					//sideChainEnergy = gridenergy(a->g2[0], a->g2[1], a->g2[2], 2, -0.393) +  gridenergy(a->g[0], a->g[1], a->g[2], 0, 0.042);
-					break;
-				case 'C':
-					//sideChainEnergy = scoreSideChainNoClash(CYS.nbRot, CYS.nbAtoms, CYS.charges, CYS.atypes, CYS.coords, a, coordsSet, ind, numRand);
-					sideChainEnergy = gridenergy(a->g[0], a->g[1], a->g[2], 4, -0.095);
-					break;
-				case 'M':
-					sideChainEnergy = scoreSideChainNoClash(MET.nbRot, MET.nbAtoms, MET.charges, MET.atypes, MET.coords, a, coordsSet, ind, numRand);
-					break;
-				case 'N':
-					sideChainEnergy = scoreSideChainNoClash(ASN.nbRot, ASN.nbAtoms, ASN.charges, ASN.atypes, ASN.coords, a, coordsSet, ind, numRand);
-					break;
-				case 'Q':
-					sideChainEnergy = scoreSideChainNoClash(GLN.nbRot, GLN.nbAtoms, GLN.charges, GLN.atypes, GLN.coords, a, coordsSet, ind, numRand);
-					break;
-				default:
-					break;
-				}
+				const Rotlib *lib = rotlib(a->id);
+				if (lib)
+					sideChainEnergy = sidechain_dispatch[lib->mode].score(lib, a, &placed, numRand);
 			}
 			erg += sideChainEnergy;
 			// AD energy is in kcal/mol, scale down kcal/mol to RT!
@@ -2178,22 +2792,12 @@ void ADenergyNoClash(double* ADEnergies, int start, int end, Chain *chain, Chain
 			else
 				energiesbackward[i-start] = erg;
 			
-			if (a->id != 'G'){
-				coordsSet[ind]=a->cb[0]; ind++;
-				coordsSet[ind]=a->cb[1]; ind++;
-				coordsSet[ind]=a->cb[2]; ind++;
-			}
-			
-			if (a->etc & G__){
-				coordsSet[ind]=a->g[0]; ind++;
-				coordsSet[ind]=a->g[1]; ind++;
-				coordsSet[ind]=a->g[2]; ind++;
-			}
-			if (a->etc & G2_){
-				coordsSet[ind]=a->g2[0]; ind++;
-				coordsSet[ind]=a->g2[1]; ind++;
-				coordsSet[ind]=a->g2[2]; ind++;
-			}
+			if (a->id != 'G')
+				clashgrid_add(&placed, a->cb);
+			if (a->etc & G__)
+				clashgrid_add(&placed, a->g);
+			if (a->etc & G2_)
+				clashgrid_add(&placed, a->g2);
 
 			//if (mod == 1){
 			//	fprintf(stderr, "Energy  i %d j %d type %c %g start %d end %d mod %d ind %d\n", i, j, a->id, erg,start,end,mod,ind);
@@ -2252,9 +2856,230 @@ void ADenergyNoClash(double* ADEnergies, int start, int end, Chain *chain, Chain
 
 	//return energiesforward;
 	//free(coordsSet);
+	sidechain_keep(chaint != NULL ? chaint->sct : chain->sc, start, end, chain, chaint, mod_params);
 }
 
 
+/* lower bound of the side chain score of residue a over its rotamers. the random
+   moves of N (up to 0.25 A per axis, numRand > 1) turn the rotamer frame: v1 by at most e1,
+   v2 by at most e2 and v3 by e1 + e2, so each atom stays in a box around its unperturbed position.
+   the clash penalties are positive */
+static double sidechain_bound(const Rotlib *lib, AA *a, int numRand)
+{
+	float N[3] = { a->n[0], a->n[1], a->n[2] };
+	float CA[3] = { a->ca[0], a->ca[1], a->ca[2] };
+	float CB[3] = { a->cb[0], a->cb[1], a->cb[2] };
+	float v1[3], v2[3], v3[3], w[3];
+	double e1 = 0.0, e2 = 0.0, n, bestBound = DBL_MAX;
+	int i, j, d;
+
+	/* the frame of scoreSideChainNoClash for the unperturbed N */
+	normalizedVector(N, CA, v1);
+	normalizedVector(CA, CB, v3);
+	vectorProduct(v3, v1, v2);
+	for (i = 0; i < 3; i++) w[i] = v2[i];
+	n = 1. / sqrt(v2[0] * v2[0] + v2[1] * v2[1] + v2[2] * v2[2]);
+	for (i = 0; i < 3; i++) v2[i] = v2[i] * n;
+	vectorProduct(v1, v2, v3);
+	n = 1. / sqrt(v3[0] * v3[0] + v3[1] * v3[1] + v3[2] * v3[2]);
+	for (i = 0; i < 3; i++) v3[i] = v3[i] * n;
+
+	if (numRand > 1) {
+		double shift = 0.25 * sqrt(3.0) / sqrt((CA[0] - N[0]) * (CA[0] - N[0]) + (CA[1] - N[1]) * (CA[1] - N[1]) + (CA[2] - N[2]) * (CA[2] - N[2]));
+		double sinphi = sqrt(w[0] * w[0] + w[1] * w[1] + w[2] * w[2]);
+		if (shift >= 1.0 || 2.0 * sin(0.5 * asin(shift)) >= sinphi) e1 = e2 = 2.0;
+		else {
+			e1 = 2.0 * sin(0.5 * asin(shift));
+			e2 = 2.0 * sin(0.5 * asin(e1 / sinphi));
+		}
+	}
+	for (i = 0; i < lib->nbRot; i++) {
+		double bound = 0.0;
+		for (j = 0; j < lib->nbAtoms; j++) {
+			const int k = i * lib->nbAtoms + j;
+			const double c[3] = { lib->x[k], lib->y[k], lib->z[k] };
+			double lo[3], hi[3];
+			double r = sqrt(c[0] * c[0] + c[1] * c[1] + c[2] * c[2]);
+			double delta = fmin(fabs(c[0]) * e1 + fabs(c[1]) * e2 + fabs(c[2]) * (e1 + e2), 2.0 * r) + 0.01;
+			for (d = 0; d < 3; d++) {
+				double x = v1[d] * c[0] + v2[d] * c[1] + v3[d] * c[2] + CA[d];
+				lo[d] = x - delta;
+				hi[d] = x + delta;
+			}
+			/* no cut on the partial sum, the bounds of the atoms left may be negative */
+			bound += gridpyramid_bound(lib->atypes[j], lib->charges[j], lo, hi);
+		}
+		if (bound < bestBound) bestBound = bound;
+	}
+	/* the scans return 10 for a side chain whose every rotamer scores above 90000 */
+	return fmin(bestBound, 10.0);
+}
+
+/* lower bound of the energies ADenergyNoClash(..., mod) would return for residues start..end,
+   summed over the residues. the backbone energies are exact, the side chains are
+   bounded from the grid pyramid without the rotamer search. the scans of ADenergyNoClash
+   carry the CB energy of the residue scanned before into a GLY, and its H energy into a PRO,
+   and return 99999 a residue for a direction whose energies are higher */
+double ADenergyNoClash_bound(int start, int end, Chain *chain, Chaint *chaint, model_params *mod_params, int mod)
+{
+	int numRand = mod == 1 ? 1 + mod_params->rotamer_jitter : 1;
+	int nbRes = end - start + 1;
+	double bbX[6 * nbRes], bbY[6 * nbRes], bbZ[6 * nbRes], bbCharges[6 * nbRes], bbEnergies[6 * nbRes];
+	int bbTypes[6 * nbRes], bbFirst[nbRes];
+	double bound = 0.0, carriedCb = 0.0, carriedH = 0.0;
+	int nbG = 0, nbP = 0;
+	AA *a;
+	int i;
+
+	if (gridpyramid[0].bounds == NULL) return -DBL_MAX;
+	int nbBB = ADbackbone_atoms(start, end, chain, chaint, bbX, bbY, bbZ, bbTypes, bbCharges, bbFirst);
+	gridenergy_batch(nbBB, bbX, bbY, bbZ, bbTypes, bbCharges, bbEnergies);
+	for (i = 0; i < nbBB; i++) bound += bbEnergies[i];
+	for (i = start; i <= end; i++) {
+		a = (chaint != NULL ? chaint->aat : chain->aa) + (1 + (i-1)%(chain->NAA-1));
+		/* H, C, CA, CB, N, O as in ADbackbone_atoms */
+		if (a->id == 'G') nbG++;
+		else carriedCb = fmin(carriedCb, bbEnergies[bbFirst[i - start] + (a->id != 'P') + 2]);
+		if (a->id == 'P') nbP++;
+		else carriedH = fmin(carriedH, bbEnergies[bbFirst[i - start]]);
+	}
+	bound += nbG * carriedCb + nbP * carriedH;
+
+	if ((int) mod_params->external_r0[0] == 1) {
+		for (i = start; i <= end; i++) {
+			if (chaint!=NULL)
+				a = chaint->aat + (1 + (i-1)%(chain->NAA-1));
+			else
+				a = chain->aa + (1 + (i-1)%(chain->NAA-1));
+			const Rotlib *lib = rotlib(a->id);
+			if (lib) bound += sidechain_dispatch[lib->mode].bound(lib, a, numRand);
+		}
+	}
+	/* AD energy is in kcal/mol, in RT as in ADenergyNoClash, less a margin for the rounding of the interpolation */
+	return fmin(bound / 0.59219 - 1e-6 * (1.0 + fabs(bound)), 99999.0 * nbRes);
+}
+
+/* the rigid motion taking the frame N, CA, CB of residue a to that of b, x -> b->ca + R (x - a->ca) */
+static void residue_motion(const AA *a, const AA *b, double R[3][3])
+{
+	vector e[2][3];
+	const AA *r[2] = { a, b };
+	int i, j, m;
+
+	for (m = 0; m < 2; m++) {
+		vector ca, cb;
+		castvec(ca, (double *) r[m]->ca);
+		castvec(cb, (double *) r[m]->cb);
+		subtract(e[m][0], ca, (double *) r[m]->n);
+		normalize(e[m][0]);
+		subtract(cb, cb, ca);
+		crossprod(e[m][1], e[m][0], cb);
+		normalize(e[m][1]);
+		crossprod(e[m][2], e[m][0], e[m][1]);
+	}
+	for (i = 0; i < 3; i++)
+		for (j = 0; j < 3; j++)
+			R[i][j] = e[1][0][i] * e[0][0][j] + e[1][1][i] * e[0][1][j] + e[1][2][i] * e[0][2][j];
+}
+
+/* the energies of ADenergyNoClash for chaint, all of chain moved as a rigid body, when no atom moved
+   by more than mod_params->rigid_move: the side chains keep their rotamers and, as nothing moved
+   relative to anything else, their clashes, so each residue's energy in chain changes by the grid
+   energies of its atoms at their new places less those at their old ones. With SideChains=1 the
+   side chains kept are moved with their residues, a rigid copy also under a rotation, which a
+   rebuild from the rotamer would not be (its jitter is in the lab frame). returns 0, leaving
+   ADEnergies as it was, when the move is too long or a side chain has no rotamer to keep */
+int ADenergyRigid(double *ADEnergies, Chain *chain, Chaint *chaint, model_params *mod_params)
+{
+	const int nbRes = chain->NAA - 1, perRes = 6 + rotlib_atoms();
+	const double limit = mod_params->rigid_move;
+	double X[2 * perRes * nbRes], Y[2 * perRes * nbRes], Z[2 * perRes * nbRes];
+	double charges[2 * perRes * nbRes], energies[2 * perRes * nbRes];
+	int types[2 * perRes * nbRes], first[2][nbRes + 1], side[nbRes + 1];
+	const int kept = chain->sc != NULL && chaint->sct != NULL;
+	int i, j, k, m, n = 0;
+
+	if (limit <= 0.0) return 0;
+	/* the atoms of each residue before the move, then after it, in the same order */
+	for (m = 0; m < 2; m++) {
+		for (i = 1; i <= nbRes; i++) {
+			AA *a = m == 0 ? chain->aa + i : chaint->aat + i;
+			first[m][i - 1] = n;
+			n += ADbackbone_atoms(i, i, chain, m == 0 ? NULL : chaint, X + n, Y + n, Z + n, types + n, charges + n, NULL);
+			if (m == 0) side[i] = n;
+			const Rotlib *lib = rotlib(a->id);
+			if (lib && (int) mod_params->external_r0[0] == 1) {
+				const Sidechain *sc = chain->sc != NULL ? chain->sc + i : NULL;
+				if (m == 1 && kept && lib->mode != ROTLIB_GAMMA) {
+					/* the side chain before the move, moved with the residue */
+					double R[3][3];
+					residue_motion(chain->aa + i, a, R);
+					k = first[0][i] - side[i];
+					for (j = 0; j < k; j++) {
+						const int l = side[i] + j;
+						const double x = X[l] - chain->aa[i].ca[0], y = Y[l] - chain->aa[i].ca[1], z = Z[l] - chain->aa[i].ca[2];
+						X[n + j] = a->ca[0] + R[0][0] * x + R[0][1] * y + R[0][2] * z;
+						Y[n + j] = a->ca[1] + R[1][0] * x + R[1][1] * y + R[1][2] * z;
+						Z[n + j] = a->ca[2] + R[2][0] * x + R[2][1] * y + R[2][2] * z;
+						types[n + j] = types[l];
+						charges[n + j] = charges[l];
+					}
+				} else if (m == 0 && lib->mode != ROTLIB_GAMMA && sc && sidechain_valid(sc, a) && sc->nbAtoms == lib->nbAtoms) {
+					/* the side chain kept in chain, as placed */
+					for (k = 0; k < sc->nbAtoms; k++) {
+						X[n + k] = sc->xyz[k][0];
+						Y[n + k] = sc->xyz[k][1];
+						Z[n + k] = sc->xyz[k][2];
+						types[n + k] = sc->atypes[k];
+						charges[n + k] = lib->charges[k];
+					}
+					k = sc->nbAtoms;
+				} else k = sidechain_atoms(lib, a, X + n, Y + n, Z + n, types + n, charges + n);
+				if (k < 0) return 0;
+				n += k;
+			}
+		}
+		first[m][nbRes] = n;
+	}
+	for (k = 0; k < first[1][0]; k++) {
+		const int l = first[1][0] + k;
+		const double dx = X[l] - X[k], dy = Y[l] - Y[k], dz = Z[l] - Z[k];
+		if (dx * dx + dy * dy + dz * dz > limit * limit) return 0;
+	}
+
+	gridenergy_batch(n, X, Y, Z, types, charges, energies);
+	rigid_moves++;
+	if (kept) {
+		for (i = 1; i <= nbRes; i++) {
+			AA *a = chaint->aat + i;
+			Sidechain *sc = chaint->sct + i;
+			const Rotlib *lib = rotlib(a->id);
+			const int from = first[1][i - 1] + side[i] - first[0][i - 1];
+			sc->nbAtoms = 0;
+			if (!lib || lib->mode == ROTLIB_GAMMA || (int) mod_params->external_r0[0] != 1) continue;
+			const double *frame[3] = { a->n, a->ca, a->cb };
+			for (k = 0; k < 9; k++) sc->frame[k] = frame[k / 3][k % 3];
+			sc->SCRot = a->SCRot;
+			sc->SCTrial = a->SCTrial;
+			for (k = 0; k < first[1][i] - from; k++) {
+				sc->atypes[k] = types[from + k];
+				sc->xyz[k][0] = X[from + k];
+				sc->xyz[k][1] = Y[from + k];
+				sc->xyz[k][2] = Z[from + k];
+			}
+			sc->nbAtoms = first[1][i] - from;
+		}
+	} else sidechain_keep(chaint->sct, 1, nbRes, chain, chaint, mod_params);
+	for (i = 1; i <= nbRes; i++) {
+		double delta = 0.0;
+		for (k = first[1][i - 1]; k < first[1][i]; k++) delta += energies[k];
+		for (k = first[0][i - 1]; k < first[0][i]; k++) delta -= energies[k];
+		// AD energy is in kcal/mol, scale down kcal/mol to RT!
+		ADEnergies[i - 1] = chain->Erg(0, i) + delta / 0.59219;
+	}
+	return 1;
+}
+
 /* external potential depending on atomic position */
 double external(AA *a, model_params *mod_params, vector molcom)
 {
@@ -2536,6 +3361,67 @@ double energy2(Biasmap *biasmap, AA *a,  AA *b, model_params *mod_params)
 }
 
 
+/* the farthest the hydrophobic and side chain hbond terms of energy2 reach: two residues have none
+   if no atom of one (N, C, CB, G, G2) is within this distance of an atom of the other */
+double energy2_reach(model_params *mod_params)
+{
+	int i;
+	double contact = 0.0, donor = 0.0, acceptor = 0.0, reach;
+	sidechain_properties_ *p = mod_params->sidechain_properties;
+
+	for (i = 0; i < 31; i++) {
+		contact = fmax(contact, fmax(p[i].hydrophobic_contact_radius_CB, fmax(p[i].hydrophobic_contact_radius_G1, p[i].hydrophobic_contact_radius_G2)));
+		donor = fmax(donor, p[i].hydrogen_bond_donor_radius);
+		acceptor = fmax(acceptor, p[i].hydrogen_bond_acceptor_radius);
+	}
+	reach = 2 * contact + mod_params->hydrophobic_cutoff_range;
+	reach = fmax(reach, donor + acceptor + mod_params->sidechain_hbond_decay_width);
+	reach = fmax(reach, donor + BACKBONE_ACCEPTOR_RADIUS + mod_params->sidechain_hbond_decay_width);
+	reach = fmax(reach, acceptor + BACKBONE_DONOR_RADIUS + mod_params->sidechain_hbond_decay_width);
+	return reach + 0.01;
+}
+
+/* farthest atom of a read by the contact terms of energy2 from its CA */
+static double energy2_radius(AA *a)
+{
+	double r2 = fmax(distance(a->n, a->ca), distance(a->c, a->ca));
+
+	if (a->etc & CB_) r2 = fmax(r2, distance(a->cb, a->ca));
+	if (a->etc & G__) r2 = fmax(r2, distance(a->g, a->ca));
+	if (a->etc & G2_) r2 = fmax(r2, distance(a->g2, a->ca));
+	return sqrt(r2);
+}
+
+/* 1 if a and b, not neighbours in the chain, are too far apart for all but the bias and electrostatic
+   terms of energy2: their CAs beyond vdw_extended_cutoff, and their atoms beyond reach (energy2_reach).
+   0 without gamma atoms, whose contacts are not bounded by reach */
+int energy2_apart(AA *a, AA *b, double reach, model_params *mod_params)
+{
+	double d2, d;
+
+	if (mod_params->use_gamma_atoms == NO_GAMMA) return 0;
+	if (a->chainid == b->chainid && abs(b->num - a->num) == 1) return 0;
+	d2 = distance(a->ca, b->ca);
+	if (d2 < mod_params->vdw_extended_cutoff) return 0;
+	d = sqrt(d2) - reach;
+	return d > energy2_radius(a) + energy2_radius(b);
+}
+
+/* energy2, with the bias and electrostatic terms alone for residues apart (energy2_apart):
+   the same bit for bit, as the terms left out are exactly 0 */
+double energy2_ranged(Biasmap *biasmap, AA *a,  AA *b, double reach, model_params *mod_params)
+{
+	double retval = 0.0;
+
+	if (!energy2_apart(a, b, reach, mod_params))
+		return energy2(biasmap, a, b, mod_params);
+	if (biasmap->distb && Distb(a->num, b->num) != 0.0)
+		retval += bias(biasmap, a, b, mod_params);
+	retval += electrostatic(biasmap,a,b, mod_params);
+	return retval;
+}
+
+
 // Gary Hack cyclic peptides type 0: C-N bond, type 1: -S-S- bond to be added if needed
 double cyclic_energy(AA *a, AA *b, int type) {
 	double ans = 0.;
@@ -20,6 +20,13 @@ double totenergy(Chain *chain);
 double locenergy(Chain *chain);
 double extenergy(Chain *chain);
 double firstlastenergy(Chain *chain);
+void energy_matrix_external(Chain *chain, double *ADEnergies);
+double energy_matrix_sum(Chain *chain);
+double ergsum_drift;	/* the largest drift of the running totals of an energy matrix found by energy_matrix_sum */
+/* the energy matrix in its compact form, for the checkpoints and MPI */
+int energy_matrix_packed_size(int NAA);
+void energy_matrix_pack(Chain *chain, double *packed);
+void energy_matrix_unpack(Chain *chain, const double *packed);
 
 void energy_matrix_print(Chain *,Biasmap *, model_params *mod_params);
 void biasmap_initialise(Chain *,Biasmap *, model_params *mod_params);
@@ -37,6 +44,13 @@ void transpts_initialise();
 void ramaprob_initialise();
 
 double *gridmapvalues[9];
+int gridlayout;		/* GRID_LAYOUT_SEPARATE, GRID_LAYOUT_INTERLEAVED or GRID_LAYOUT_TILED */
+float *gridvoxels;	/* interleaved records of all 9 maps, NULL if gridlayout is GRID_LAYOUT_SEPARATE */
+int gridprecision;	/* GRID_PRECISION_DOUBLE, GRID_PRECISION_FLOAT or GRID_PRECISION_INT16, separate layout only */
+float *gridmapfloats[9];	/* the separate maps if gridprecision is GRID_PRECISION_FLOAT */
+short *gridmapshorts[9];	/* the separate maps if gridprecision is GRID_PRECISION_INT16, */
+double gridmapscale[9], gridmapoffset[9];	/* value = gridmapoffset + gridmapscale * short */
+int gridband;		/* voxels of the guard band gridenergy interpolates in, GRIDGUARD, or 0 for 16-bit maps */
 int transPtsCount;
 double *Xpts;
 double *Ypts;
@@ -44,15 +58,129 @@ double *Zpts;
 double *ramaprob, *alaprob, *glyprob;
 
 void gridmap_initialise(char *, int);
+int gridfile_initialise(char *, unsigned int);
+void gridtarget_initialise(char *, unsigned int);
+void gridmaps_initialise(char *, unsigned int);
+void gridmap_finalise();
+void gridvoxels_initialise(int layout, int keep_maps);
+void gridprecision_initialise(int precision, int keep_maps);
 
 double gridenergy(double X, double Y, double Z, int i, double charge);
-
-void vectorProduct(float *a, float *b, float *c);
+double gridenergy_gradient(double X, double Y, double Z, int i, double charge, double grad[3]);
+void gridpyramid_initialise();
+double gridpyramid_bound(int i, double charge, const double lo[3], const double hi[3]);
+long gridpyramid_tests, gridpyramid_rejects;	/* translation moves bounded, and rejected from the bound alone */
+
+/* batched gridenergy over structure-of-arrays atoms (gridkernel.c).
+   the AVX2 kernel returns the same energies as gridenergy, bit for bit */
+#define GRID_KERNEL_SCALAR 0
+#define GRID_KERNEL_AVX2   1
+void gridenergy_batch(int n, const double *X, const double *Y, const double *Z, const int *types, const double *charges, double *energies);
+int gridenergy_batch_select(int kernel);
+
+/* the rotamer libraries as float structure-of-arrays (rotlib.c), built at start-up from canonicalAA.c
+   and the binary library file of Rotlib=: atom j of rotamer i at i * nbAtoms + j, zero padded to
+   ROTLIB_LANES atoms and aligned to them. a library may have any number of rotamers and atoms */
+#define ROTLIB_LANES 8
+/* how a residue type is scored, the index of its entry in the side chain dispatch table of energy.c */
+#define ROTLIB_NOCLASH 0	/* best rotamer with the clash penalties of the atoms placed so far, packed with Pack=1 */
+#define ROTLIB_BEST 1		/* best rotamer on the grid alone (PRO) */
+#define ROTLIB_GAMMA 2		/* the gamma atom of the model as a sulphur, no rotamers (CYS unless RotCys=1) */
+#define ROTLIB_MODES 3
+typedef struct _Rotlib {
+	char id;
+	int mode;
+	int nbRot, nbAtoms;
+	int n;			/* nbRot * nbAtoms padded to ROTLIB_LANES */
+	int *atypes;		/* per atom of a rotamer */
+	double *charges;
+	double *prior;		/* per rotamer, the higher the likelier, for the RotBudget= cut */
+	float *x, *y, *z;	/* n coordinates in the frame of the residue */
+	int *types;		/* n, atypes and charges of every atom for gridenergy_batch */
+	double *batchCharges;
+	double *radius;		/* per atom of a rotamer, farthest from CA over the rotamers */
+} Rotlib;
+void rotlib_initialise(const char *filename, int budget, int cys);
+void rotlib_finalise();
+void rotlib_write(const char *filename);
+const Rotlib *rotlib(char id);
+int rotlib_atoms();
+/* the coordinates and grid energies of all n atoms of a library, allocated by rotlib_initialise for
+   the largest one in use: one set for the side chain scans of energy.c, one for the packer */
+#define ROTLIB_SCRATCH_SCAN 0
+#define ROTLIB_SCRATCH_PACK 1
+#define ROTLIB_SCRATCHES 2
+typedef struct _Rotlib_scratch {
+	double *x, *y, *z, *energies;
+} Rotlib_scratch;
+const Rotlib_scratch *rotlib_scratch(int user);
+/* the moves of N of the side chain scans with random moves (RotJitter=): trial t > 0 moves N by point t
+   of a Halton sequence over +-0.25 A per axis, the same at every call, so the scans are functions of
+   the coordinates alone */
+#define ROTLIB_JITTERS 64
+void rotlib_jitter(const AA *a, int trial, float N[3]);
+/* all n atoms of lib in the frame mat (gridkernel.c), in float as the rotamer scans always did */
+void rotlib_transform(const Rotlib *lib, float mat[3][4], double *X, double *Y, double *Z);
+
+/* the binary rotamer library file written by rotlib2bin */
+#define ROTLIB_MAGIC "ADCPROT"
+#define ROTLIB_VERSION 1
+typedef struct _Rotlib_header {
+	char magic[8];
+	int version;
+	int nbLibs;		/* Rotlib_records that follow */
+} Rotlib_header;
+typedef struct _Rotlib_record {
+	char id;		/* one letter code, A to Z */
+	char mode;		/* ROTLIB_NOCLASH, ROTLIB_BEST or ROTLIB_GAMMA */
+	int nbRot, nbAtoms;
+} Rotlib_record;
+
+void vectorProduct(float *a, float *b, float *c);
 void normalizedVector(float *a, float *b, float *v);
 
-int checkClash(double x, double y, double z, double *setCoords, int ind);
-float scoreSideChain(int nbRot, int nbAtoms, double *acharges, int *aTypes,  double coords[nbRot][nbAtoms][3], AA *a,  int numRand);
-double scoreSideChainNoClash(int nbRot, int nbAtoms, double charges[nbAtoms], int atypes[nbAtoms],  double coords[nbRot][nbAtoms][3], AA *a, double* setCoords, int ind, int numRand);
+/* the atoms placed so far in ADenergyNoClash, hashed by cells of twice the clash distance (2.2 A)
+   with some slack, so the atoms within the clash distance of a point are in at most 2x2x2 cells.
+   each bucket is a list through next, newest atom first, so the last atoms added can be dropped */
+#define CLASH_DISTANCE2 4.84
+#define CLASHGRID_REACH 2.25
+#define CLASHGRID_CELL (2 * CLASHGRID_REACH)
+#define CLASHGRID_BUCKETS 1024
+#define CLASHGRID_SCAN 48	/* up to this many atoms a plain scan is faster than the cells */
+typedef struct _Clashgrid {
+	double *coords;		/* x, y, z per atom */
+	int *next;		/* per atom, the next atom of its bucket, -1 at the end */
+	int *bucket;		/* per atom, its bucket */
+	int n;			/* atoms placed */
+	int head[CLASHGRID_BUCKETS];	/* newest atom of each bucket, -1 if empty */
+} Clashgrid;
+void clashgrid_initialise(Clashgrid *grid, double *coords, int *next, int *bucket);
+void clashgrid_add(Clashgrid *grid, const double p[3]);
+void clashgrid_truncate(Clashgrid *grid, int n);
+int checkClash(double x, double y, double z, const Clashgrid *placed);
+void sidechain_frame(float N[3], float CA[3], float CB[3], float mat[3][4]);
+void sidechain_centers(char id, const double *X, const double *Y, const double *Z, vector g, vector g2);
+float scoreSideChain(const Rotlib *lib, AA *a,  int numRand);
+double scoreSideChainNoClash(const Rotlib *lib, AA *a, const Clashgrid *placed, int numRand);
+
+/* side chain cache of scoreSideChainNoClash: per residue, the best rotamer of the last
+   ROTCACHE_WAYS backbone frames seen, keyed by N, CA and CB rounded to the quantum (RotCache=) */
+#define ROTCACHE_WAYS 8
+#define ROTCACHE_ATOMS 11	/* side chains with more heavy atoms are not cached */
+void rotcache_initialise(int nres, double quantum);
+void rotcache_finalise();
+long rotcache_lookups, rotcache_hits;	/* side chains looked up, and taken from the cache */
+double rotcache_scan_seconds, rotcache_hit_seconds;	/* time spent in the rotamer scans of misses and in hits */
+long rotsearch_lookups[26], rotsearch_scans[26];	/* per residue type id - 'A': grid lookups of the bounded rotamer
+							   search, and those of an exhaustive scan */
+
+/* global side chain packer (packer.c, Pack=1): the rotamers of the moved residues are chosen together
+   by dead-end elimination and a depth-first search of at most PACK_NODES nodes, heuristic beyond */
+#define PACK_NODES 20000
+const Rotlib *sidechain_library(char id);
+void sidechain_pack(int nbRes, AA **res, const Clashgrid *fixed, int numRand, double *energies);
+long pack_calls, pack_exact;	/* packings, and those whose search finished */
+long pack_states_total, pack_states_kept;	/* rotamer states, and those left by the dead-end elimination */
 
 double ramabias(AA *, AA *, AA *);
 
@@ -64,9 +192,17 @@ double energy1(AA *, model_params *mod_params);
 /* the energy of interactions between between two amino acids */
 double energy2(Biasmap *,AA *,  AA *, model_params *mod_params);
 double energy2cyclic(Biasmap *,AA *,  AA *, model_params *mod_params);
+/* energy2 skipping the contact terms of residues too far apart for them, reach from energy2_reach */
+double energy2_ranged(Biasmap *,AA *,  AA *, double reach, model_params *mod_params);
+double energy2_reach(model_params *mod_params);
+int energy2_apart(AA *a, AA *b, double reach, model_params *mod_params);
 /* the energy terms from terms that don't involve 1 or 2 residues */
 double cyclic_energy(AA *, AA *, int);
 void ADenergyNoClash(double*, int, int, Chain *, Chaint *, model_params *, int);
+double ADenergyNoClash_bound(int start, int end, Chain *chain, Chaint *chaint, model_params *mod_params, int mod);
+int ADenergyRigid(double *ADEnergies, Chain *chain, Chaint *chaint, model_params *mod_params);
+long rigid_moves;	/* rigid body moves scored by ADenergyRigid, without the rotamer search */
+int ADbackbone_atoms(int start, int end, Chain *chain, Chaint *chaint, double *X, double *Y, double *Z, int *types, double *charges, int *first);
 
 double global_energy(int, int, Chain*, Chaint*,Biasmap *, model_params *mod_params);
 double all_vdw(Biasmap *biasmap, Chain *chain, model_params *mod_params);
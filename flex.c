@@ -583,9 +583,9 @@ int read_in_after_flex(Chain *chain,Biasmap *biasmap,Chain *input_chains,simulat
 
   int ans = 0;
   Chain *ichain = (Chain *)malloc(sizeof(Chain)); ichain->NAA = 0;
-  ichain->NAA =0; ichain->aa = NULL; ichain->xaa = NULL; ichain->erg = NULL; ichain->xaa_prev = NULL;
+  ichain->NAA =0; ichain->aa = NULL; ichain->xaa = NULL; ichain->erg = NULL; ichain->xaa_prev = NULL; ichain->sc = NULL;
   Chaint *ichaint= (Chaint*)malloc(sizeof(Chaint));
-  ichaint->aat = NULL; ichaint->ergt = NULL;  ichaint->xaat = NULL; ichaint->xaat_prev = NULL;
+  ichaint->aat = NULL; ichaint->ergt = NULL;  ichaint->xaat = NULL; ichaint->xaat_prev = NULL; ichaint->sct = NULL;
 
   FILE *fptr2;
   char rmsd_filename[DEFAULT_LONG_STRING_LENGTH];
@@ -771,7 +771,7 @@ void initialize_flex(Chain *chain, Chain **input_chains,Biasmap *biasmap, simula
 
   for(i = 0; i < sim_params->flex_params.size_of_filename_to_read_in; i++){
 
-      (*input_chains)[i].aa = NULL;
+      (*input_chains)[i].aa = NULL; (*input_chains)[i].sc = NULL;
       (*input_chains)[i].NAA = chain->NAA;
       (*input_chains)[i].xaa = NULL;
       (*input_chains)[i].xaa_prev = NULL;
@@ -890,9 +890,9 @@ void ns_for_flex_processor(MPI_Comm FLEX_WORLD, int rank, Biasmap *biasmap, simu
   MPI_Status status;
   int i;
   Chain *chain = (Chain *)malloc(sizeof(Chain)); chain->NAA = 0;
-  chain->NAA =0; chain->aa = NULL; chain->xaa = NULL; chain->erg = NULL; chain->xaa_prev = NULL;
+  chain->NAA =0; chain->aa = NULL; chain->xaa = NULL; chain->erg = NULL; chain->xaa_prev = NULL; chain->sc = NULL;
   Chaint *chaint= (Chaint*)malloc(sizeof(Chaint));
-  chaint->aat = NULL; chaint->ergt = NULL;  chaint->xaat = NULL; chaint->xaat_prev = NULL;
+  chaint->aat = NULL; chaint->ergt = NULL;  chaint->xaat = NULL; chaint->xaat_prev = NULL; chaint->sct = NULL;
 
   sim_params->outfile_name = (char*)malloc(sizeof(char)*DEFAULT_SHORT_STRING_LENGTH);
   strcpy(sim_params->outfile_name,"flex.log");
@@ -0,0 +1,260 @@
+/*
+**  This program times gridenergy() lookups, one by one and batched with
+**  gridenergy_batch(), on the receptor maps of the current directory for
+**  each grid storage layout and precision.
+**  Run one layout under perf to count cache misses per call, e.g.
+**  perf stat -e cache-misses,dTLB-load-misses ./gridbench -l 1
+**
+**  Copyright (c) Yuqi Zhang, Michel Sanner, CCSB Scripps
+*/
+
+#define VER "gridbench 1.0, Copyright (c) Yuqi Zhang, Michel Sanner, CCSB Scripps\n"
+#define USE "Usage: %s [options]\n\
+Options:\n\
+ -n 100000    number of lookup points\n\
+ -r 50        number of passes over the points\n\
+ -s 1         random seed\n\
+ -c 0         0: points scattered over the box, 1: peptide-sized clusters\n\
+ -l -1        grid layout to time (0: separate, 1: interleaved, 2: tiled), default is all\n\
+ -q -1        precision of the separate maps (0: double, 1: float, 2: 16-bit), default is all\n\
+ -k -1        batch kernel (0: scalar, 1: AVX2), default is the best available\n"
+
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<math.h>
+#include<time.h>
+
+#include"canonicalAA.h"
+#include"error.h"
+#include"params.h"
+#include"aadict.h"
+#include"vector.h"
+#include"rotation.h"
+#include"peptide.h"
+#include"vdw.h"
+#include"energy.h"
+#include"gridmap_io.h"
+
+int npoints = 100000;
+int repeats = 50;
+unsigned int seed = 1;
+int clustered = 0;
+int only_layout = -1;
+int only_precision = -1;
+int kernel = -1;
+
+void read_options(int argc, char *argv[])
+{
+	int i, opt;
+
+	for (i = 1; i < argc; i++) {
+		opt = argv[i][0] == '-' ? argv[i][1] : 0;
+		if (++i >= argc)
+			opt = 0;
+
+		switch (opt) {
+		case 'n':
+			npoints = atoi(argv[i]);
+			break;
+		case 'r':
+			repeats = atoi(argv[i]);
+			break;
+		case 's':
+			seed = (unsigned int)atoi(argv[i]);
+			break;
+		case 'c':
+			clustered = atoi(argv[i]);
+			break;
+		case 'l':
+			only_layout = atoi(argv[i]);
+			break;
+		case 'q':
+			only_precision = atoi(argv[i]);
+			break;
+		case 'k':
+			kernel = atoi(argv[i]);
+			break;
+		default:
+			fprintf(stderr, VER USE, argv[0]);
+			exit(EXIT_FAILURE);
+		}
+	}
+	if (npoints <= 0 || repeats <= 0) {
+		fprintf(stderr, VER USE, argv[0]);
+		exit(EXIT_FAILURE);
+	}
+}
+
+/* the binary grid file if there is one, the .map files otherwise */
+void load_grid(void)
+{
+	char mapname[256];
+	unsigned int required = 0x18f;
+	FILE *map;
+	int i;
+
+	if (gridfile_initialise(GRIDFILE_DEFAULT_NAME, 0x18f)) return;
+
+	for (i = 4; i <= 6; i++) {
+		sprintf(mapname, "%s.%s.map", GRIDFILE_DEFAULT_PREFIX, gridfile_map_names[i]);
+		if ((map = fopen(mapname, "r")) != NULL) {
+			required |= 1u << i;
+			fclose(map);
+		}
+	}
+	gridmaps_initialise(GRIDFILE_DEFAULT_PREFIX, required);
+}
+
+double uniform(double lo, double hi)
+{
+	return lo + (hi - lo) * rand() / (double)RAND_MAX;
+}
+
+/* fill the lookup points with backbone-like atom types and charges */
+void make_points(double *xyz, int *types, double *charges)
+{
+	static const int bb_types[6] = { 0, 0, 0, 1, 2, 3 };
+	static const double bb_charges[6] = { 0.241, 0.186, 0.05, -0.346, -0.271, 0.163 };
+	double half[3] = { ((NX - 1) / 2 - 1) * spacing, ((NY - 1) / 2 - 1) * spacing, ((NZ - 1) / 2 - 1) * spacing };
+	double center[3] = { centerX, centerY, centerZ };
+	double cluster[3];
+	int n, k;
+
+	srand(seed);
+	for (n = 0; n < npoints; n++) {
+		if (!clustered || n % 64 == 0)
+			for (k = 0; k < 3; k++)
+				cluster[k] = uniform(center[k] - half[k], center[k] + half[k]);
+		for (k = 0; k < 3; k++) {
+			xyz[3 * n + k] = cluster[k];
+			if (clustered)
+				xyz[3 * n + k] = fmax(center[k] - half[k], fmin(center[k] + half[k], cluster[k] + uniform(-6.0, 6.0)));
+		}
+		types[n] = bb_types[n % 6];
+		charges[n] = bb_charges[n % 6];
+	}
+}
+
+double run(const double *xyz, const int *types, const double *charges, double *out)
+{
+	clock_t begin = clock();
+	int r, n;
+	for (r = 0; r < repeats; r++)
+		for (n = 0; n < npoints; n++)
+			out[n] = gridenergy(xyz[3 * n], xyz[3 * n + 1], xyz[3 * n + 2], types[n], charges[n]);
+	return (double)(clock() - begin) / CLOCKS_PER_SEC;
+}
+
+double run_batch(const double *xyz, const int *types, const double *charges, double *out)
+{
+	double *X = malloc(3 * npoints * sizeof(double));
+	if (!X) stop("Unable to allocate memory in gridbench.");
+	double *Y = X + npoints, *Z = Y + npoints;
+	for (int n = 0; n < npoints; n++) {
+		X[n] = xyz[3 * n];
+		Y[n] = xyz[3 * n + 1];
+		Z[n] = xyz[3 * n + 2];
+	}
+	clock_t begin = clock();
+	for (int r = 0; r < repeats; r++)
+		gridenergy_batch(npoints, X, Y, Z, types, charges, out);
+	double t = (double)(clock() - begin) / CLOCKS_PER_SEC;
+	free(X);
+	return t;
+}
+
+/* largest |a-b|/(1+|b|) */
+double maxdiff(const double *a, const double *b)
+{
+	double d = 0.0;
+	for (int n = 0; n < npoints; n++) d = fmax(d, fabs(a[n] - b[n]) / (1.0 + fabs(b[n])));
+	return d;
+}
+
+/* largest |a-b| */
+double maxabsdiff(const double *a, const double *b)
+{
+	double d = 0.0;
+	for (int n = 0; n < npoints; n++) d = fmax(d, fabs(a[n] - b[n]));
+	return d;
+}
+
+/* largest error bound of a 16-bit lookup, half a quantisation step of each map it reads */
+double int16_bound(const int *types, const double *charges)
+{
+	double d = 0.0;
+	for (int n = 0; n < npoints; n++)
+		d = fmax(d, 0.5 * (gridmapscale[types[n]] + fabs(charges[n]) * (gridmapscale[7] + gridmapscale[8])));
+	return d;
+}
+
+/* bytes of grid storage in the current layout and precision */
+double grid_megabytes(void)
+{
+	const size_t nvoxels = (size_t)GRIDPAD(NX) * GRIDPAD(NY) * GRIDPAD(NZ);
+	size_t bytes;
+	if (gridlayout == GRID_LAYOUT_TILED)
+		bytes = (size_t)GRIDTILE_BRICKS(GRIDPAD(NX)) * GRIDTILE_BRICKS(GRIDPAD(NY)) * GRIDTILE_BRICKS(GRIDPAD(NZ)) * GRIDTILE_VOXELS * GRIDVOXEL_STRIDE * sizeof(float);
+	else if (gridlayout == GRID_LAYOUT_INTERLEAVED)
+		bytes = nvoxels * GRIDVOXEL_STRIDE * sizeof(float);
+	else if (gridprecision == GRID_PRECISION_INT16)
+		bytes = nvoxels * GRIDFILE_NMAPS * sizeof(short);
+	else if (gridprecision == GRID_PRECISION_FLOAT)
+		bytes = nvoxels * GRIDFILE_NMAPS * sizeof(float);
+	else
+		bytes = nvoxels * GRIDFILE_NMAPS * sizeof(double);
+	return bytes / (1024. * 1024.);
+}
+
+int main(int argc, char *argv[])
+{
+	read_options(argc, argv);
+	load_grid();
+
+	double *xyz = malloc(3 * npoints * sizeof(double));
+	int *types = malloc(npoints * sizeof(int));
+	double *charges = malloc(npoints * sizeof(double));
+	double *reference = malloc(npoints * sizeof(double));
+	double *energies = malloc(npoints * sizeof(double));
+	double *batched = malloc(npoints * sizeof(double));
+	if (!xyz || !types || !charges || !reference || !energies || !batched) stop("Unable to allocate memory in gridbench.");
+	make_points(xyz, types, charges);
+
+	kernel = gridenergy_batch_select(kernel);
+	printf("grid %d x %d x %d, %d %s points, %d passes, %s batch kernel\n", NX, NY, NZ, npoints,
+		clustered ? "clustered" : "scattered", repeats, kernel == GRID_KERNEL_AVX2 ? "AVX2" : "scalar");
+	/* the double separate maps are the reference of the other modes */
+	for (int n = 0; n < npoints; n++)
+		reference[n] = gridenergy(xyz[3 * n], xyz[3 * n + 1], xyz[3 * n + 2], types[n], charges[n]);
+
+	static const char *names[5] = { "double", "float", "16-bit", "interleaved", "tiled" };
+	for (int mode = 0; mode < 5; mode++) {
+		int layout = mode < 3 ? GRID_LAYOUT_SEPARATE : mode - 2;
+		int precision = mode < 3 ? mode : GRID_PRECISION_FLOAT;
+		if (only_layout >= 0 && only_layout != layout) continue;
+		if (only_precision >= 0 && layout == GRID_LAYOUT_SEPARATE && only_precision != precision) continue;
+		if (layout == GRID_LAYOUT_SEPARATE) gridprecision_initialise(precision, 1);
+		else {
+			if (gridprecision != GRID_PRECISION_DOUBLE) gridprecision_initialise(GRID_PRECISION_DOUBLE, 1);
+			gridvoxels_initialise(layout, 1);
+		}
+		double t = run(xyz, types, charges, energies);
+		double tb = run_batch(xyz, types, charges, batched);
+		printf("%-11s %7.1f MB %8.2f ns/call, batched %8.2f ns/atom, batch rel. error %g, error vs double %g",
+			names[mode], grid_megabytes(), 1e9 * t / ((double)repeats * npoints), 1e9 * tb / ((double)repeats * npoints),
+			maxdiff(batched, energies), maxabsdiff(energies, reference));
+		if (gridprecision == GRID_PRECISION_INT16)
+			printf(" (bound %g)", int16_bound(types, charges));
+		printf("\n");
+	}
+
+	gridmap_finalise();
+	free(xyz);
+	free(types);
+	free(charges);
+	free(reference);
+	free(energies);
+	free(batched);
+	return EXIT_SUCCESS;
+}
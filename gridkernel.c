@@ -0,0 +1,251 @@
+/*
+** Batched grid energy: gridenergy() for many atoms given as
+** structure-of-arrays, with an AVX2 kernel selected at run time
+** and the scalar gridenergy() as fallback, and the frame transform
+** of the rotamer libraries for it.
+**
+** Copyright (c) Yuqi Zhang, Michel Sanner, CCSB Scripps
+*/
+
+#include<stdlib.h>
+#include<stdio.h>
+#include<math.h>
+
+#include"canonicalAA.h"
+#include"error.h"
+#include"params.h"
+#include"vector.h"
+#include"rotation.h"
+#include"aadict.h"
+#include"peptide.h"
+#include"vdw.h"
+#include"energy.h"
+#include"gridmap_io.h"
+
+#if defined(__GNUC__) && defined(__x86_64__) && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9) || defined(__clang__))
+#define GRID_KERNEL_HAVE_AVX2 1
+#include<immintrin.h>
+#endif
+
+typedef void (*gridenergy_batch_fn)(int, const double *, const double *, const double *, const int *, const double *, double *);
+
+typedef void (*rotlib_transform_fn)(const Rotlib *, float [3][4], double *, double *, double *);
+
+static gridenergy_batch_fn gridenergy_batch_kernel = NULL;
+static rotlib_transform_fn rotlib_transform_kernel = NULL;
+
+/* the products and sums in float and in this order, as the AVX2 kernel */
+static void rotlib_transform_scalar(const Rotlib *lib, float mat[3][4], double *X, double *Y, double *Z) {
+	for (int k = 0; k < lib->n; k++) {
+		const float x = lib->x[k], y = lib->y[k], z = lib->z[k];
+		float t;
+		t = mat[0][0] * x + mat[0][1] * y + mat[0][2] * z + mat[0][3];
+		X[k] = t;
+		t = mat[1][0] * x + mat[1][1] * y + mat[1][2] * z + mat[1][3];
+		Y[k] = t;
+		t = mat[2][0] * x + mat[2][1] * y + mat[2][2] * z + mat[2][3];
+		Z[k] = t;
+	}
+}
+
+static void gridenergy_batch_scalar(int n, const double *X, const double *Y, const double *Z,
+		const int *types, const double *charges, double *energies) {
+	for (int k = 0; k < n; k++)
+		energies[k] = gridenergy(X[k], Y[k], Z[k], types[k], charges[k]);
+}
+
+#ifdef GRID_KERNEL_HAVE_AVX2
+
+/* a * b + c rounded twice, in the order of the scalar code, not fused:
+   the kernel returns the energies of gridenergy bit for bit */
+#define GRID_MULADD(a, b, c) _mm256_add_pd(_mm256_mul_pd(a, b), c)
+
+/* 4 atoms per iteration on the padded maps. a group with any atom beyond the guard band is
+   redone by gridenergy, so the penalties there are the scalar ones. built with -DDEBUG, so is
+   a group with an energy beyond the diagnostic limit of gridenergy */
+__attribute__((target("avx2")))
+static void gridenergy_batch_avx2(int n, const double *X, const double *Y, const double *Z,
+		const int *types, const double *charges, double *energies) {
+	const __m256d center[3] = { _mm256_set1_pd(centerX), _mm256_set1_pd(centerY), _mm256_set1_pd(centerZ) };
+	const __m256d half[3] = { _mm256_set1_pd((NX - 1) / 2 + GRIDGUARD), _mm256_set1_pd((NY - 1) / 2 + GRIDGUARD), _mm256_set1_pd((NZ - 1) / 2 + GRIDGUARD) };
+	const __m256d bottom = _mm256_set1_pd(GRIDGUARD - gridband);
+	const __m256d top[3] = { _mm256_set1_pd(GRIDGUARD + gridband + NX - 1), _mm256_set1_pd(GRIDGUARD + gridband + NY - 1),
+		_mm256_set1_pd(GRIDGUARD + gridband + NZ - 1) };
+	const __m256d step = _mm256_set1_pd(spacing);
+	const __m256d zero = _mm256_setzero_pd();
+	const __m256d one = _mm256_set1_pd(1.0);
+	const __m256d signbit = _mm256_set1_pd(-0.0);
+	const int tiled = (gridlayout == GRID_LAYOUT_TILED);
+	const int separate = (gridlayout == GRID_LAYOUT_SEPARATE);
+	const int PX = GRIDPAD(NX), PY = GRIDPAD(NY);
+	const int bricksX = GRIDTILE_BRICKS(PX), bricksY = GRIDTILE_BRICKS(PY);
+	int k = 0;
+
+	for (; k + 4 <= n; k += 4) {
+		const double *xyz[3] = { X + k, Y + k, Z + k };
+		__m256d g[3], lowFrac[3], highFrac[3];
+		__m128i low[3];
+		__m256d inside = _mm256_castsi256_pd(_mm256_set1_epi64x(-1));
+		int d;
+
+		for (d = 0; d < 3; d++) {
+			g[d] = _mm256_add_pd(_mm256_div_pd(_mm256_sub_pd(_mm256_loadu_pd(xyz[d]), center[d]), step), half[d]);
+			inside = _mm256_and_pd(inside, _mm256_and_pd(_mm256_cmp_pd(g[d], bottom, _CMP_GE_OQ), _mm256_cmp_pd(g[d], top[d], _CMP_LT_OQ)));
+		}
+		if (_mm256_movemask_pd(inside) != 0xf) {
+			gridenergy_batch_scalar(4, X + k, Y + k, Z + k, types + k, charges + k, energies + k);
+			continue;
+		}
+		for (d = 0; d < 3; d++) {
+			low[d] = _mm256_cvttpd_epi32(g[d]);
+			highFrac[d] = _mm256_sub_pd(g[d], _mm256_cvtepi32_pd(low[d]));
+			lowFrac[d] = _mm256_sub_pd(one, highFrac[d]);
+		}
+
+		/* base record and the +1 steps along x, y and z */
+		__m128i base, dx, dy, dz;
+		if (tiled) {
+			const __m128i mask = _mm_set1_epi32(GRIDTILE_MASK);
+			__m128i brick = _mm_add_epi32(_mm_mullo_epi32(_mm_add_epi32(
+				_mm_mullo_epi32(_mm_srli_epi32(low[2], GRIDTILE_SHIFT), _mm_set1_epi32(bricksY)),
+				_mm_srli_epi32(low[1], GRIDTILE_SHIFT)), _mm_set1_epi32(bricksX)),
+				_mm_srli_epi32(low[0], GRIDTILE_SHIFT));
+			__m128i local = _mm_add_epi32(_mm_slli_epi32(_mm_add_epi32(
+				_mm_slli_epi32(_mm_and_si128(low[2], mask), GRIDTILE_SHIFT), _mm_and_si128(low[1], mask)), GRIDTILE_SHIFT),
+				_mm_and_si128(low[0], mask));
+			base = _mm_add_epi32(_mm_mullo_epi32(brick, _mm_set1_epi32(GRIDTILE_VOXELS)), local);
+			dx = _mm_blendv_epi8(_mm_set1_epi32(1), _mm_set1_epi32(GRIDTILE_VOXELS - GRIDTILE_MASK),
+				_mm_cmpeq_epi32(_mm_and_si128(low[0], mask), mask));
+			dy = _mm_blendv_epi8(_mm_set1_epi32(GRIDTILE_EDGE), _mm_set1_epi32(bricksX * GRIDTILE_VOXELS - GRIDTILE_MASK * GRIDTILE_EDGE),
+				_mm_cmpeq_epi32(_mm_and_si128(low[1], mask), mask));
+			dz = _mm_blendv_epi8(_mm_set1_epi32(GRIDTILE_EDGE * GRIDTILE_EDGE),
+				_mm_set1_epi32(bricksX * bricksY * GRIDTILE_VOXELS - GRIDTILE_MASK * GRIDTILE_EDGE * GRIDTILE_EDGE),
+				_mm_cmpeq_epi32(_mm_and_si128(low[2], mask), mask));
+		} else {
+			base = _mm_add_epi32(_mm_mullo_epi32(_mm_add_epi32(_mm_mullo_epi32(low[2], _mm_set1_epi32(PY)), low[1]), _mm_set1_epi32(PX)), low[0]);
+			dx = _mm_set1_epi32(1);
+			dy = _mm_set1_epi32(PX);
+			dz = _mm_set1_epi32(PX * PY);
+		}
+		const __m128i corner[8] = { base, _mm_add_epi32(base, dz), _mm_add_epi32(base, dy), _mm_add_epi32(base, _mm_add_epi32(dy, dz)),
+			_mm_add_epi32(base, dx), _mm_add_epi32(base, _mm_add_epi32(dx, dz)), _mm_add_epi32(base, _mm_add_epi32(dx, dy)),
+			_mm_add_epi32(base, _mm_add_epi32(dx, _mm_add_epi32(dy, dz))) };
+		/* same products, in the same order, as the lowLowLowFrac ... weights of gridenergy */
+		const __m256d frac[8] = {
+			_mm256_mul_pd(_mm256_mul_pd(lowFrac[0], lowFrac[1]), lowFrac[2]),
+			_mm256_mul_pd(_mm256_mul_pd(lowFrac[0], lowFrac[1]), highFrac[2]),
+			_mm256_mul_pd(_mm256_mul_pd(lowFrac[0], highFrac[1]), lowFrac[2]),
+			_mm256_mul_pd(_mm256_mul_pd(lowFrac[0], highFrac[1]), highFrac[2]),
+			_mm256_mul_pd(_mm256_mul_pd(highFrac[0], lowFrac[1]), lowFrac[2]),
+			_mm256_mul_pd(_mm256_mul_pd(highFrac[0], lowFrac[1]), highFrac[2]),
+			_mm256_mul_pd(_mm256_mul_pd(highFrac[0], highFrac[1]), lowFrac[2]),
+			_mm256_mul_pd(_mm256_mul_pd(highFrac[0], highFrac[1]), highFrac[2]) };
+
+		const __m128i type = _mm_loadu_si128((const __m128i *)(types + k));
+		__m256d perAtomtype = zero, eStatic = zero, deSolv = zero;
+		if (separate && gridprecision == GRID_PRECISION_FLOAT) {
+			const __m256i mapbase = _mm256_i32gather_epi64((const long long *)gridmapfloats, type, sizeof(float *));
+			for (int c = 0; c < 8; c++) {
+				__m256i index = _mm256_cvtepi32_epi64(corner[c]);
+				__m256i address = _mm256_add_epi64(mapbase, _mm256_slli_epi64(index, 2));
+				perAtomtype = GRID_MULADD(frac[c], _mm256_cvtps_pd(_mm256_i64gather_ps((const float *)0, address, 1)), perAtomtype);
+				eStatic = GRID_MULADD(frac[c], _mm256_cvtps_pd(_mm256_i64gather_ps(gridmapfloats[7], index, sizeof(float))), eStatic);
+				deSolv = GRID_MULADD(frac[c], _mm256_cvtps_pd(_mm256_i64gather_ps(gridmapfloats[8], index, sizeof(float))), deSolv);
+			}
+		} else if (separate && gridprecision == GRID_PRECISION_INT16) {
+			/* 32-bit gathers at the 16-bit values, sign-extended from the low half */
+			const __m256i mapbase = _mm256_i32gather_epi64((const long long *)gridmapshorts, type, sizeof(short *));
+			const __m256i ebase = _mm256_set1_epi64x((long long)gridmapshorts[7]);
+			const __m256i dbase = _mm256_set1_epi64x((long long)gridmapshorts[8]);
+			for (int c = 0; c < 8; c++) {
+				__m256i offset = _mm256_slli_epi64(_mm256_cvtepi32_epi64(corner[c]), 1);
+				__m128i q = _mm256_i64gather_epi32((const int *)0, _mm256_add_epi64(mapbase, offset), 1);
+				perAtomtype = GRID_MULADD(frac[c], _mm256_cvtepi32_pd(_mm_srai_epi32(_mm_slli_epi32(q, 16), 16)), perAtomtype);
+				q = _mm256_i64gather_epi32((const int *)0, _mm256_add_epi64(ebase, offset), 1);
+				eStatic = GRID_MULADD(frac[c], _mm256_cvtepi32_pd(_mm_srai_epi32(_mm_slli_epi32(q, 16), 16)), eStatic);
+				q = _mm256_i64gather_epi32((const int *)0, _mm256_add_epi64(dbase, offset), 1);
+				deSolv = GRID_MULADD(frac[c], _mm256_cvtepi32_pd(_mm_srai_epi32(_mm_slli_epi32(q, 16), 16)), deSolv);
+			}
+			perAtomtype = GRID_MULADD(_mm256_i32gather_pd(gridmapscale, type, sizeof(double)), perAtomtype,
+				_mm256_i32gather_pd(gridmapoffset, type, sizeof(double)));
+			eStatic = GRID_MULADD(_mm256_set1_pd(gridmapscale[7]), eStatic, _mm256_set1_pd(gridmapoffset[7]));
+			deSolv = GRID_MULADD(_mm256_set1_pd(gridmapscale[8]), deSolv, _mm256_set1_pd(gridmapoffset[8]));
+		} else if (separate) {
+			const __m256i mapbase = _mm256_i32gather_epi64((const long long *)gridmapvalues, type, sizeof(double *));
+			for (int c = 0; c < 8; c++) {
+				__m256i index = _mm256_cvtepi32_epi64(corner[c]);
+				__m256i address = _mm256_add_epi64(mapbase, _mm256_slli_epi64(index, 3));
+				perAtomtype = GRID_MULADD(frac[c], _mm256_i64gather_pd((const double *)0, address, 1), perAtomtype);
+				eStatic = GRID_MULADD(frac[c], _mm256_i64gather_pd(gridmapvalues[7], index, sizeof(double)), eStatic);
+				deSolv = GRID_MULADD(frac[c], _mm256_i64gather_pd(gridmapvalues[8], index, sizeof(double)), deSolv);
+			}
+		} else {
+			const __m256i type64 = _mm256_cvtepi32_epi64(type);
+			for (int c = 0; c < 8; c++) {
+				__m256i record = _mm256_slli_epi64(_mm256_cvtepi32_epi64(corner[c]), 4);
+				perAtomtype = GRID_MULADD(frac[c], _mm256_cvtps_pd(_mm256_i64gather_ps(gridvoxels, _mm256_add_epi64(record, type64), sizeof(float))), perAtomtype);
+				eStatic = GRID_MULADD(frac[c], _mm256_cvtps_pd(_mm256_i64gather_ps(gridvoxels + 7, record, sizeof(float))), eStatic);
+				deSolv = GRID_MULADD(frac[c], _mm256_cvtps_pd(_mm256_i64gather_ps(gridvoxels + 8, record, sizeof(float))), deSolv);
+			}
+		}
+		const __m256d charge = _mm256_loadu_pd(charges + k);
+		const __m256d abscharge = _mm256_andnot_pd(signbit, charge);
+		__m256d erg = _mm256_add_pd(GRID_MULADD(abscharge, deSolv, perAtomtype), _mm256_mul_pd(charge, eStatic));
+		_mm256_storeu_pd(energies + k, erg);
+#ifdef DEBUG
+		if (_mm256_movemask_pd(_mm256_cmp_pd(_mm256_andnot_pd(signbit, erg), _mm256_set1_pd(1000000.), _CMP_GT_OQ)))
+			gridenergy_batch_scalar(4, X + k, Y + k, Z + k, types + k, charges + k, energies + k);
+#endif
+	}
+	gridenergy_batch_scalar(n - k, X + k, Y + k, Z + k, types + k, charges + k, energies + k);
+}
+
+/* 8 atoms per iteration, lib->n is a multiple of ROTLIB_LANES and the library aligned to it */
+__attribute__((target("avx2")))
+static void rotlib_transform_avx2(const Rotlib *lib, float mat[3][4], double *X, double *Y, double *Z) {
+	double *out[3] = { X, Y, Z };
+	for (int k = 0; k < lib->n; k += ROTLIB_LANES) {
+		const __m256 x = _mm256_load_ps(lib->x + k), y = _mm256_load_ps(lib->y + k), z = _mm256_load_ps(lib->z + k);
+		for (int d = 0; d < 3; d++) {
+			__m256 t = _mm256_mul_ps(_mm256_set1_ps(mat[d][0]), x);
+			t = _mm256_add_ps(t, _mm256_mul_ps(_mm256_set1_ps(mat[d][1]), y));
+			t = _mm256_add_ps(t, _mm256_mul_ps(_mm256_set1_ps(mat[d][2]), z));
+			t = _mm256_add_ps(t, _mm256_set1_ps(mat[d][3]));
+			_mm256_storeu_pd(out[d] + k, _mm256_cvtps_pd(_mm256_castps256_ps128(t)));
+			_mm256_storeu_pd(out[d] + k + 4, _mm256_cvtps_pd(_mm256_extractf128_ps(t, 1)));
+		}
+	}
+}
+
+#endif
+
+/* select the batch kernel: GRID_KERNEL_SCALAR, GRID_KERNEL_AVX2, or -1 for the best the CPU supports.
+   returns the kernel in use */
+int gridenergy_batch_select(int kernel) {
+#ifdef GRID_KERNEL_HAVE_AVX2
+	__builtin_cpu_init();
+	int have_avx2 = __builtin_cpu_supports("avx2");
+	if (kernel != GRID_KERNEL_SCALAR && have_avx2) {
+		gridenergy_batch_kernel = gridenergy_batch_avx2;
+		rotlib_transform_kernel = rotlib_transform_avx2;
+		return GRID_KERNEL_AVX2;
+	}
+#endif
+	if (kernel == GRID_KERNEL_AVX2) fprintf(stderr, "WARNING: no AVX2, using the scalar grid energy kernel\n");
+	gridenergy_batch_kernel = gridenergy_batch_scalar;
+	rotlib_transform_kernel = rotlib_transform_scalar;
+	return GRID_KERNEL_SCALAR;
+}
+
+/* energies[k] = gridenergy(X[k], Y[k], Z[k], types[k], charges[k]) for k < n */
+void gridenergy_batch(int n, const double *X, const double *Y, const double *Z,
+		const int *types, const double *charges, double *energies) {
+	if (gridenergy_batch_kernel == NULL) gridenergy_batch_select(-1);
+	gridenergy_batch_kernel(n, X, Y, Z, types, charges, energies);
+}
+
+/* X, Y, Z of the lib->n atoms of lib in the frame mat */
+void rotlib_transform(const Rotlib *lib, float mat[3][4], double *X, double *Y, double *Z) {
+	if (rotlib_transform_kernel == NULL) gridenergy_batch_select(-1);
+	rotlib_transform_kernel(lib, mat, X, Y, Z);
+}
@@ -0,0 +1,436 @@
+/*
+** Binary receptor grid container: all AutoGrid maps of a target in one
+** file that is memory-mapped read-only, so concurrent runs share it.
+**
+** Copyright (c) Yuqi Zhang, Michel Sanner, CCSB Scripps
+*/
+
+#define _POSIX_C_SOURCE 200112L
+
+#include<stdlib.h>
+#include<stdio.h>
+#include<string.h>
+#include<math.h>
+#include<float.h>
+#include<errno.h>
+#include<fcntl.h>
+#include<unistd.h>
+#include<sys/types.h>
+#include<sys/stat.h>
+#include<sys/mman.h>
+#include<time.h>
+
+#include"error.h"
+#include"gridmap_io.h"
+
+const char *gridfile_map_names[GRIDFILE_NMAPS] = { "C", "N", "OA", "HD", "SA", "A", "NA", "e", "d" };
+
+/*make energy grid map smoother*/
+double lower_gridenergy(double E) {
+	//return E;
+	if (E > 2.718) {
+		//return log10f(E) + 9;
+		return log(E) + 1.718;
+	}
+	//if (E > 10) {
+	//	//return log10f(E) + 9;
+	//	return log(E-9) + 10;
+	//}
+	return E;
+}
+
+/* map atomtype i onto the map used when its own .map file is missing, -1 if required */
+static int gridfile_fallback(int i) {
+	if (i == 4 || i == 5 || i == 6) return 0;
+	return -1;
+}
+
+/* open and map a binary grid file
+   returns -1 if the file does not exist, stops on a corrupted file */
+int gridfile_open(Gridfile *grid, const char *filename) {
+	char error_string[1024];
+	struct stat st;
+	int fd, i;
+
+	grid->base = NULL;
+	grid->header = NULL;
+	grid->size = 0;
+	for (i = 0; i < GRIDFILE_NMAPS; i++) grid->maps[i] = NULL;
+
+	fd = open(filename, O_RDONLY);
+	if (fd < 0) {
+		if (errno == ENOENT) return -1;
+		sprintf(error_string, "Unable to open grid file %.900s.", filename);
+		stop(error_string);
+	}
+	if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(Gridfile_header)) {
+		close(fd);
+		sprintf(error_string, "Grid file %.900s is truncated.", filename);
+		stop(error_string);
+	}
+
+	void *base = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (base == MAP_FAILED) {
+		sprintf(error_string, "Unable to mmap grid file %.900s.", filename);
+		stop(error_string);
+	}
+
+	const Gridfile_header *header = (const Gridfile_header *)base;
+	if (strncmp(header->magic, GRIDFILE_MAGIC, sizeof(header->magic)) == 0 &&
+	    (header->version != GRIDFILE_VERSION || header->guard != GRIDGUARD)) {
+		munmap(base, (size_t)st.st_size);
+		sprintf(error_string, "Grid file %.900s was written by an older map2grd, convert the maps again.", filename);
+		stop(error_string);
+	}
+	size_t nvoxels = (size_t)GRIDPAD(header->NX) * GRIDPAD(header->NY) * GRIDPAD(header->NZ);
+	if (strncmp(header->magic, GRIDFILE_MAGIC, sizeof(header->magic)) != 0 || header->nmaps != GRIDFILE_NMAPS ||
+	    header->NX < 2 || header->NY < 2 || header->NZ < 2 ||
+	    (size_t)st.st_size != sizeof(Gridfile_header) + GRIDFILE_NMAPS * nvoxels * sizeof(double)) {
+		munmap(base, (size_t)st.st_size);
+		sprintf(error_string, "Grid file %.900s is not a valid version %d grid file.", filename, GRIDFILE_VERSION);
+		stop(error_string);
+	}
+
+	grid->base = base;
+	grid->size = (size_t)st.st_size;
+	grid->header = header;
+	for (i = 0; i < GRIDFILE_NMAPS; i++)
+		grid->maps[i] = (double *)((char *)base + sizeof(Gridfile_header)) + i * nvoxels;
+
+	return 0;
+}
+
+void gridfile_close(Gridfile *grid) {
+	if (grid->base) munmap(grid->base, grid->size);
+	grid->base = NULL;
+	grid->header = NULL;
+	grid->size = 0;
+}
+
+/* record index of voxel (x,y,z) in the tiled layout */
+size_t gridfile_tiled_index(int x, int y, int z, int NX, int NY) {
+	size_t brick = ((size_t)(z >> GRIDTILE_SHIFT) * GRIDTILE_BRICKS(NY) + (y >> GRIDTILE_SHIFT)) * GRIDTILE_BRICKS(NX) + (x >> GRIDTILE_SHIFT);
+	return brick * GRIDTILE_VOXELS + (((z & GRIDTILE_MASK) * GRIDTILE_EDGE + (y & GRIDTILE_MASK)) * GRIDTILE_EDGE + (x & GRIDTILE_MASK));
+}
+
+/* pack the maps into one cache-line aligned float record per voxel,
+   so that a trilinear lookup of a map, elec and desolv touches 8 lines instead of 24.
+   if tiled, the records are arranged in bricks so the 8 lines mostly share one page */
+float *gridfile_interleave(double *maps[GRIDFILE_NMAPS], int NX, int NY, int NZ, int tiled) {
+	void *records = NULL;
+	size_t nrecords, n;
+	int i, x, y, z;
+
+	if (tiled)
+		nrecords = (size_t)GRIDTILE_BRICKS(NX) * GRIDTILE_BRICKS(NY) * GRIDTILE_BRICKS(NZ) * GRIDTILE_VOXELS;
+	else
+		nrecords = (size_t)NX * NY * NZ;
+	if (posix_memalign(&records, GRIDVOXEL_STRIDE * sizeof(float), nrecords * GRIDVOXEL_STRIDE * sizeof(float)) != 0)
+		stop("Unable to allocate memory in gridfile_interleave.");
+	/* padding records of the bricks stay zero */
+	memset(records, 0, nrecords * GRIDVOXEL_STRIDE * sizeof(float));
+
+	n = 0;
+	for (z = 0; z < NZ; z++)
+		for (y = 0; y < NY; y++)
+			for (x = 0; x < NX; x++, n++) {
+				float *voxel = (float *)records + (tiled ? gridfile_tiled_index(x, y, z, NX, NY) : n) * GRIDVOXEL_STRIDE;
+				for (i = 0; i < GRIDFILE_NMAPS; i++) voxel[i] = (float)maps[i][n];
+			}
+	return (float *)records;
+}
+
+/* round a map to float */
+float *gridfile_map_float(const double *map, size_t nvoxels) {
+	float *values = malloc(nvoxels * sizeof(float));
+	size_t n;
+	if (!values) stop("Unable to allocate memory in gridfile_map_float.");
+	for (n = 0; n < nvoxels; n++) values[n] = (float)map[n];
+	return values;
+}
+
+/* quantise a padded map of a box of NX*NY*NZ voxels to 16 bits, map[n] ~ offset + scale * values[n].
+   the range is that of the box, the rounding error of a voxel in the box, and so of a trilinear
+   lookup, is at most scale/2. the penalties of the guard band saturate.
+   one element more is allocated so that 32-bit gathers of the last voxel stay inside */
+short *gridfile_map_quantise(const double *map, int NX, int NY, int NZ, double *scale, double *offset) {
+	size_t nvoxels = (size_t)GRIDPAD(NX) * GRIDPAD(NY) * GRIDPAD(NZ);
+	short *values = malloc((nvoxels + 1) * sizeof(short));
+	double lo = DBL_MAX, hi = -DBL_MAX;
+	size_t n;
+	int x, y, z;
+	if (!values) stop("Unable to allocate memory in gridfile_map_quantise.");
+	for (z = 0; z < NZ; z++)
+		for (y = 0; y < NY; y++)
+			for (x = 0; x < NX; x++) {
+				n = ((size_t)(z + GRIDGUARD) * GRIDPAD(NY) + y + GRIDGUARD) * GRIDPAD(NX) + x + GRIDGUARD;
+				if (map[n] < lo) lo = map[n];
+				if (map[n] > hi) hi = map[n];
+			}
+	*offset = 0.5 * (lo + hi);
+	*scale = hi > lo ? (hi - lo) / (2.0 * GRIDFILE_INT16_MAX) : 1.0;
+	for (n = 0; n < nvoxels; n++) {
+		long q = lround((map[n] - *offset) / *scale);
+		if (q > GRIDFILE_INT16_MAX) q = GRIDFILE_INT16_MAX;
+		if (q < -GRIDFILE_INT16_MAX) q = -GRIDFILE_INT16_MAX;
+		values[n] = (short)q;
+	}
+	values[nvoxels] = 0;
+	return values;
+}
+
+/* powers of ten that are exact in a double */
+static const double gridfile_pow10[23] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10,
+	1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+
+/* parse the decimal number after the blanks at p into value, return its end or p if there is none.
+   a number of at most 15 significant digits and a scale within 1e-22..1e22, as written by AutoGrid,
+   is converted with one exact multiplication or division, so it rounds like strtod; anything else
+   is left to strtod */
+static const char *gridfile_parse_double(const char *p, double *value) {
+	unsigned long long mantissa = 0;
+	int digits = 0, scale = 0, exponent = 0, negative = 0, seen = 0;
+	const char *start, *mark;
+	char *end;
+
+	while (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n') p++;
+	start = p;
+	if (*p == '-' || *p == '+') negative = *p++ == '-';
+	for (; *p >= '0' && *p <= '9'; p++, seen = 1) {
+		mantissa = 10 * mantissa + (*p - '0');
+		if (mantissa) digits++;
+	}
+	if (*p == '.')
+		for (p++; *p >= '0' && *p <= '9'; p++, seen = 1) {
+			mantissa = 10 * mantissa + (*p - '0');
+			if (mantissa) digits++;
+			scale--;
+		}
+	if (!seen) return start;
+	if (*p == 'e' || *p == 'E') {
+		int eneg = 0;
+		mark = p++;
+		if (*p == '-' || *p == '+') eneg = *p++ == '-';
+		if (*p < '0' || *p > '9') p = mark;
+		else {
+			for (; *p >= '0' && *p <= '9'; p++)
+				if (exponent < 10000) exponent = 10 * exponent + (*p - '0');
+			scale += eneg ? -exponent : exponent;
+		}
+	}
+	if (digits > 15 || scale < -22 || scale > 22) {
+		*value = strtod(start, &end);
+		return end;
+	}
+	*value = scale < 0 ? (double)mantissa / gridfile_pow10[-scale] : (double)mantissa * gridfile_pow10[scale];
+	if (negative) *value = -*value;
+	return p;
+}
+
+/* out-of-box penalty along an axis of N voxels at grid coordinate g, 0 within the box */
+double gridfile_penalty(double g, int N) {
+	if (g < 0 || g > N - 1) return ((g - N / 2) * (g - N / 2)) / 20.;
+	return 0.0;
+}
+
+/* fill the guard band of a padded map of a box of NX*NY*NZ voxels: with the sum of the
+   penalties of the axes a voxel is outside of if penalty, else with 0 */
+void gridfile_pad_map(double *values, int NX, int NY, int NZ, int penalty) {
+	size_t n = 0;
+	int x, y, z;
+	for (z = -GRIDGUARD; z < NZ + GRIDGUARD; z++)
+		for (y = -GRIDGUARD; y < NY + GRIDGUARD; y++)
+			for (x = -GRIDGUARD; x < NX + GRIDGUARD; x++, n++) {
+				if (x >= 0 && x < NX && y >= 0 && y < NY && z >= 0 && z < NZ) continue;
+				values[n] = penalty ? gridfile_penalty(x, NX) + gridfile_penalty(y, NY) + gridfile_penalty(z, NZ) : 0.0;
+			}
+}
+
+/* parse an AutoGrid map held in memory, e.g. read from a target archive: the box from
+   its header and, if values is not NULL, the smoothed values into the box of the padded
+   map values (the guard band is left as it is). returns the number of values read */
+size_t gridfile_parse_map(const char *text, Gridfile_header *header, double *values) {
+	char line[256];
+	const char *end;
+	size_t n = 0, nvoxels, len;
+	int i, x = 0, y = 0, z = 0;
+
+	for (i = 0; i < 6 && *text; i++) {
+		len = strcspn(text, "\n");
+		if (len >= sizeof(line)) len = sizeof(line) - 1;
+		memcpy(line, text, len);
+		line[len] = '\0';
+		if (i == 3) sscanf(line, "%*s %lf", &(header->spacing));
+		else if (i == 4) {
+			sscanf(line, "%*s %d %d %d", &(header->NX), &(header->NY), &(header->NZ));
+			header->NX++;
+			header->NY++;
+			header->NZ++;
+		}
+		else if (i == 5) sscanf(line, "%*s %lf %lf %lf", &(header->center[0]), &(header->center[1]), &(header->center[2]));
+		text += strcspn(text, "\n");
+		if (*text) text++;
+	}
+	if (i < 6) stop("Truncated gridmap_file.map header.");
+	if (!values) return 0;
+	nvoxels = (size_t)header->NX * header->NY * header->NZ;
+	while (n < nvoxels) {
+		double value = 0.0;
+		if ((end = gridfile_parse_double(text, &value)) == text) break;
+		values[((size_t)(z + GRIDGUARD) * GRIDPAD(header->NY) + y + GRIDGUARD) * GRIDPAD(header->NX) + x + GRIDGUARD] = lower_gridenergy(value);
+		n++;
+		if (++x == header->NX) {
+			x = 0;
+			if (++y == header->NY) {
+				y = 0;
+				z++;
+			}
+		}
+		text = end;
+	}
+	return n;
+}
+
+/* wall-clock seconds, for the start-up timings */
+double gridfile_wtime(void) {
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + 1e-9 * t.tv_nsec;
+}
+
+/* the whole file in one read, '\0'-terminated, NULL if it cannot be opened */
+static char *gridfile_slurp(const char *filename) {
+	struct stat st;
+	char *text;
+	size_t size, n;
+	ssize_t r;
+	int fd;
+
+	if ((fd = open(filename, O_RDONLY)) < 0) return NULL;
+	if (fstat(fd, &st) != 0 || (text = malloc((size_t)st.st_size + 1)) == NULL) {
+		close(fd);
+		return NULL;
+	}
+	size = (size_t)st.st_size;
+	for (n = 0; n < size && (r = read(fd, text + n, size - n)) > 0; n += r);
+	close(fd);
+	text[n] = '\0';
+	return text;
+}
+
+/* read the AutoGrid maps PREFIX.*.map of the mask required (bit i for map i, the C map is
+   always read) into malloc'ed padded arrays, the files concurrently when built with OpenMP. the other
+   maps share the array of the C map, that is their fallback. the box is taken from the C map.
+   stops if a map is missing, short or has other dimensions than the C map */
+void gridfile_load_maps(const char *prefix, unsigned int required, Gridfile_header *header, double *maps[GRIDFILE_NMAPS]) {
+	char mapname[GRIDFILE_NMAPS][1024];
+	char error_string[2048];
+	Gridfile_header box[GRIDFILE_NMAPS];
+	size_t nread[GRIDFILE_NMAPS], nvoxels[GRIDFILE_NMAPS];
+	int list[GRIDFILE_NMAPS], nlist = 0, k, i;
+
+	required |= 1u;
+	for (i = 0; i < GRIDFILE_NMAPS; i++) {
+		if (gridfile_fallback(i) < 0) required |= 1u << i;
+		sprintf(mapname[i], "%.900s.%s.map", prefix, gridfile_map_names[i]);
+		maps[i] = NULL;
+		nread[i] = nvoxels[i] = 0;
+		if (required & (1u << i)) list[nlist++] = i;
+	}
+
+#pragma omp parallel for schedule(dynamic, 1) private(i)
+	for (k = 0; k < nlist; k++) {
+		i = list[k];
+		char *text = gridfile_slurp(mapname[i]);
+		if (text == NULL) continue;
+		memset(box + i, 0, sizeof(Gridfile_header));
+		gridfile_parse_map(text, box + i, NULL);
+		if (box[i].NX > 0 && box[i].NY > 0 && box[i].NZ > 0) {
+			nvoxels[i] = (size_t)box[i].NX * box[i].NY * box[i].NZ;
+			if ((maps[i] = malloc((size_t)GRIDPAD(box[i].NX) * GRIDPAD(box[i].NY) * GRIDPAD(box[i].NZ) * sizeof(double))) != NULL) {
+				nread[i] = gridfile_parse_map(text, box + i, maps[i]);
+				gridfile_pad_map(maps[i], box[i].NX, box[i].NY, box[i].NZ, i < GRIDFILE_NTYPEMAPS);
+			}
+		}
+		free(text);
+	}
+
+	for (k = 0; k < nlist; k++) {
+		i = list[k];
+		if (nvoxels[i] == 0) {
+			sprintf(error_string, "Missing %s file.", mapname[i]);
+			stop(error_string);
+		}
+		if (maps[i] == NULL) stop("Unable to allocate memory in gridfile_load_maps.");
+		if (box[i].NX != box[0].NX || box[i].NY != box[0].NY || box[i].NZ != box[0].NZ) {
+			sprintf(error_string, "Grid dimensions of %s differ from the C map.", mapname[i]);
+			stop(error_string);
+		}
+		if (nread[i] != nvoxels[i]) {
+			sprintf(error_string, "Grid file %s has %lu values, expected %lu.", mapname[i], (unsigned long)nread[i], (unsigned long)nvoxels[i]);
+			stop(error_string);
+		}
+	}
+	for (i = 0; i < GRIDFILE_NMAPS; i++)
+		if (!(required & (1u << i))) maps[i] = maps[gridfile_fallback(i)];
+
+	*header = box[0];
+	header->present = required;
+	header->guard = GRIDGUARD;
+}
+
+/* convert the PREFIX.*.map AutoGrid maps into one binary grid file
+   the file is written under a temporary name and renamed, so that runs
+   starting concurrently never map a half-written file */
+void gridfile_convert(const char *prefix, const char *filename) {
+	char mapname[1024];
+	char tmpname[1024];
+	char error_string[1024];
+	Gridfile_header header;
+	double *maps[GRIDFILE_NMAPS];
+	unsigned int required = 0;
+	int i;
+
+	/* the maps with a fallback are copies of it if their .map file is missing */
+	for (i = 0; i < GRIDFILE_NMAPS; i++) {
+		sprintf(mapname, "%.900s.%s.map", prefix, gridfile_map_names[i]);
+		if (access(mapname, R_OK) == 0) required |= 1u << i;
+		else if (gridfile_fallback(i) >= 0)
+			fprintf(stderr, "WARNING: missing %s, using the %s map instead\n", mapname, gridfile_map_names[gridfile_fallback(i)]);
+	}
+	gridfile_load_maps(prefix, required, &header, maps);
+	strncpy(header.magic, GRIDFILE_MAGIC, sizeof(header.magic));
+	header.version = GRIDFILE_VERSION;
+	header.nmaps = GRIDFILE_NMAPS;
+
+	size_t nvoxels = (size_t)GRIDPAD(header.NX) * GRIDPAD(header.NY) * GRIDPAD(header.NZ);
+	double *values = malloc(GRIDFILE_NMAPS * nvoxels * sizeof(double));
+	if (!values) stop("Unable to allocate memory in gridfile_convert.");
+	for (i = 0; i < GRIDFILE_NMAPS; i++)
+		memcpy(values + i * nvoxels, maps[i], nvoxels * sizeof(double));
+	for (i = 0; i < GRIDFILE_NMAPS; i++)
+		if (header.present & (1u << i)) free(maps[i]);
+
+	sprintf(tmpname, "%.900s.%ld", filename, (long)getpid());
+	FILE *out = fopen(tmpname, "wb");
+	if (out == NULL) {
+		sprintf(error_string, "Unable to open %.900s for writing.", tmpname);
+		stop(error_string);
+	}
+	if (fwrite(&header, sizeof(Gridfile_header), 1, out) != 1 ||
+	    fwrite(values, sizeof(double), GRIDFILE_NMAPS * nvoxels, out) != GRIDFILE_NMAPS * nvoxels ||
+	    fclose(out) != 0) {
+		remove(tmpname);
+		sprintf(error_string, "Unable to write grid file %.900s.", tmpname);
+		stop(error_string);
+	}
+	free(values);
+	if (rename(tmpname, filename) != 0) {
+		remove(tmpname);
+		sprintf(error_string, "Unable to rename %.450s to %.450s.", tmpname, filename);
+		stop(error_string);
+	}
+
+	fprintf(stderr, "grid file %s written: %i %i %i, spacing %g\n", filename, header.NX, header.NY, header.NZ, header.spacing);
+}
@@ -0,0 +1,87 @@
+/*
+** Binary receptor grid container: all AutoGrid maps of a target in one
+** file that is memory-mapped read-only, so concurrent runs share it.
+**
+** Copyright (c) Yuqi Zhang, Michel Sanner, CCSB Scripps
+*/
+
+#define GRIDFILE_MAGIC "ADCPGRD"
+#define GRIDFILE_VERSION 2
+#define GRIDFILE_NMAPS 9
+#define GRIDFILE_NTYPEMAPS 7	/* maps 0..6 are atom types, 7 and 8 the e and d maps */
+#define GRIDFILE_DEFAULT_NAME "rigidReceptor.grd"
+#define GRIDFILE_DEFAULT_PREFIX "rigidReceptor"
+
+/* guard band: every map is stored with GRIDGUARD extra voxels on each side of the box.
+   the band of the atom type maps holds the out-of-box penalty, that of the e and d maps 0,
+   so a trilinear stencil anywhere within the padded grid needs no test per axis.
+   GRIDPAD(N) is the stored size of a box axis of N voxels */
+#define GRIDGUARD 4
+#define GRIDPAD(N) ((N) + 2 * GRIDGUARD)
+
+/* interleaved layout: one record of GRIDVOXEL_STRIDE floats per voxel,
+   element i holds map i, the rest is padding up to one 64-byte cache line */
+#define GRIDVOXEL_STRIDE 16
+
+/* tiled layout: the records are stored in bricks of GRIDTILE_EDGE^3 voxels
+   (one 4 KB page), bricks and the voxels within a brick in x-fastest order.
+   there is one extra brick layer per axis so that the +1 corners of the
+   last voxel are still allocated */
+#define GRIDTILE_EDGE 4
+#define GRIDTILE_SHIFT 2
+#define GRIDTILE_MASK 3
+#define GRIDTILE_VOXELS (GRIDTILE_EDGE * GRIDTILE_EDGE * GRIDTILE_EDGE)
+#define GRIDTILE_BRICKS(N) ((N) / GRIDTILE_EDGE + 1)
+
+/* coarse-to-fine bounds of the maps: level l splits the box into blocks of
+   GRIDPYRAMID_EDGE << l voxels per axis and holds the min and max of every map
+   over each block including its +1 faces, so any trilinear stencil starting in
+   a block stays within its bounds */
+#define GRIDPYRAMID_EDGE 4
+#define GRIDPYRAMID_LEVELS 5
+
+typedef struct _Gridpyramid_level {
+  int edge;		/* block edge in voxels */
+  int nb[3];		/* blocks along x, y, z */
+  double *bounds;	/* per block, x fastest: min of the maps 0..8, then max of the maps 0..8 */
+} Gridpyramid_level;
+
+/* largest magnitude of a 16-bit quantised grid value */
+#define GRIDFILE_INT16_MAX 32767
+
+/* file header, followed by GRIDFILE_NMAPS padded maps of GRIDPAD(NX)*GRIDPAD(NY)*GRIDPAD(NZ)
+   doubles (already smoothed by lower_gridenergy) in native byte order.
+   map order is 0:C, 1:N, 2:OA, 3:HD, 4:SA, 5:A, 6:NA, 7:e, 8:d */
+typedef struct _Gridfile_header {
+  char magic[8];
+  int version;
+  int nmaps;
+  int NX, NY, NZ;
+  unsigned int present; /* bit i set if map i had its own .map file, otherwise it is a copy of C */
+  int guard;		/* GRIDGUARD the maps were padded with */
+  double spacing;
+  double center[3];
+} Gridfile_header;
+
+typedef struct _Gridfile {
+  const Gridfile_header *header;
+  double *maps[GRIDFILE_NMAPS];
+  void *base;	/* mmap'd region, NULL if not open */
+  size_t size;
+} Gridfile;
+
+extern const char *gridfile_map_names[GRIDFILE_NMAPS];
+
+double lower_gridenergy(double);
+int gridfile_open(Gridfile *grid, const char *filename);
+void gridfile_close(Gridfile *grid);
+void gridfile_convert(const char *prefix, const char *filename);
+double gridfile_penalty(double g, int N);
+void gridfile_pad_map(double *values, int NX, int NY, int NZ, int penalty);
+size_t gridfile_parse_map(const char *text, Gridfile_header *header, double *values);
+void gridfile_load_maps(const char *prefix, unsigned int required, Gridfile_header *header, double *maps[GRIDFILE_NMAPS]);
+double gridfile_wtime(void);
+float *gridfile_interleave(double *maps[GRIDFILE_NMAPS], int NX, int NY, int NZ, int tiled);
+size_t gridfile_tiled_index(int x, int y, int z, int NX, int NY);
+float *gridfile_map_float(const double *map, size_t nvoxels);
+short *gridfile_map_quantise(const double *map, int NX, int NY, int NZ, double *scale, double *offset);
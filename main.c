@@ -31,6 +31,7 @@
 #include"nested.h"
 #include"checkpoint_io.h"
 #include"flex.h"
+#include"gridmap_io.h"
 
 #define VER "ADCP 0.1, Copyright (c) Yuqi Zhang, Michel Sanner, CCSB Scripps \n\
 2004 - 2010 Alexei Podtelezhnikov\n\
@@ -40,6 +41,7 @@ Options:\n\
  -f infile            input PDB file with initial conformation\n\
  or SEQuenCE          peptide sequence in ALPHA and beta states\n\
  -o outfile           redirected output file\n\
+ -T target.trg        read the receptor maps and translation points from a target archive\n\
  -a ACCEPTANCE        crankshaft rotation acceptance rate\n\
  -A AMPLITUDE,FIX_AMP crankshaft rotation amplitude and whether the amplitude should be kept fixed (default is no fixing) \n\
  -b BETA1-BETA2:INT   thermodynamic beta schedule\n\
@@ -60,6 +62,9 @@ Options:\n\
 
 #define M_LOG2E        1.4426950408889634074   
 
+/* wall-clock start of the run, for the time to the first MC step */
+static double start_wtime;
+
 
 #ifdef PARALLEL
 /* parallel job parameters */
@@ -180,10 +185,11 @@ void simulate(Chain * chain, Chaint *chaint, Biasmap* biasmap, simulation_params
 	unsigned int i, j, k = sim_params->intrvl;
 	double temp;
 	Chain *chain2 = (Chain *)malloc(sizeof(Chain));
-	chain2->aa = NULL; chain2->xaa = NULL; chain2->erg = NULL; chain2->xaa_prev = NULL;
+	chain2->aa = NULL; chain2->xaa = NULL; chain2->erg = NULL; chain2->xaa_prev = NULL; chain2->sc = NULL;
 	allocmem_chain(chain2,chain->NAA,chain->Nchains);
 
 	energy_matrix_print(chain, biasmap, &(sim_params->protein_model));
+	fprintf(stderr, "time to first MC step %.3f s\n", gridfile_wtime() - start_wtime);
 	//stop("I will stop here,\n");
 	if (sim_params->protein_model.opt == 1) {
 		// targetBest and currTargetEnergy are two global variables
@@ -210,7 +216,7 @@ void simulate(Chain * chain, Chaint *chaint, Biasmap* biasmap, simulation_params
 		char swapname[12];
 		sprintf(swapname, "swap%d.pdb", swapLength);
 		double swapEnergy[swapLength + 1];
-		Chain* swapChains[swapLength];
+		Chain* swapChains[swapLength + 1];
 
 		/*optimizing parameters*/
 		int noImprovHeatSteps = 1000000;
@@ -235,7 +241,7 @@ void simulate(Chain * chain, Chaint *chaint, Biasmap* biasmap, simulation_params
 		//initialize swapping pool, last element is with the best energy
 		for (int i = 0; i < swapLength + 1; i++) {
 			swapChains[i] = (Chain *)malloc(sizeof(Chain));
-			swapChains[i]->aa = NULL; swapChains[i]->xaa = NULL; swapChains[i]->erg = NULL; swapChains[i]->xaa_prev = NULL;
+			swapChains[i]->aa = NULL; swapChains[i]->xaa = NULL; swapChains[i]->erg = NULL; swapChains[i]->xaa_prev = NULL; swapChains[i]->sc = NULL;
 			allocmem_chain(swapChains[i], chain->NAA, chain->Nchains);
 			copybetween(swapChains[i], chain);
 			swapEnergy[i] = 9999.;
@@ -754,6 +760,10 @@ char *read_options(int argc, char *argv[], simulation_params *sim_params)
 				if (sim_params->outfile_name) free(sim_params->outfile_name);
 				copy_string(&(sim_params->outfile_name),argv[i]);
 			break;
+		case 'T':
+			if (sim_params->target_name) free(sim_params->target_name);
+			copy_string(&(sim_params->target_name),argv[i]);
+			break;
 		case 'p':
 			if (sim_params->prm) free(sim_params->prm);
 			copy_string(&sim_params->prm,argv[i]);
@@ -886,27 +896,27 @@ void AD_init(Chain *chain, simulation_params *sim_params) {
                 		hasNA = 1;
     		}
 
-		transpts_initialise();
-		gridbox_initialise();
 		/* elements are 0:C, 1:N, 2:O, 3:HD, 4:SA, 5:CA, 6:NA ,7:elec 8:desolv      */
-		gridmap_initialise("rigidReceptor.C.map", 0);
-		gridmap_initialise("rigidReceptor.N.map", 1);
-		gridmap_initialise("rigidReceptor.OA.map", 2);
-		gridmap_initialise("rigidReceptor.HD.map", 3);
-		if (hasCYS)
-			gridmap_initialise("rigidReceptor.SA.map", 4);
-		else
-			gridmap_initialise("rigidReceptor.C.map", 4);
-		if (hasAroC)
-			gridmap_initialise("rigidReceptor.A.map", 5);
-		else
-			gridmap_initialise("rigidReceptor.C.map", 5);
-		if (hasNA)
-			gridmap_initialise("rigidReceptor.NA.map", 6);
-		else
-			gridmap_initialise("rigidReceptor.C.map", 6);
-		gridmap_initialise("rigidReceptor.e.map", 7);
-		gridmap_initialise("rigidReceptor.d.map", 8);
+		/* map the binary grid file written by map2grd if there is one */
+		unsigned int required = 0x18f | (hasCYS << 4) | (hasAroC << 5) | (hasNA << 6);
+		if (sim_params->target_name) {
+			gridtarget_initialise(sim_params->target_name, required);
+		} else if (gridfile_initialise("rigidReceptor.grd", required)) {
+			transpts_initialise();
+		} else {
+			/* without their own map SA, A and NA share the C map */
+			transpts_initialise();
+			gridmaps_initialise(GRIDFILE_DEFAULT_PREFIX, required);
+		}
+		/* the interleaved and tiled records are always float */
+		if (sim_params->protein_model.grid_layout != GRID_LAYOUT_SEPARATE) {
+			if (sim_params->protein_model.grid_precision == GRID_PRECISION_INT16)
+				stop("16-bit grid maps (GridPrecision=2) need the separate layout (Grid=0).");
+			gridvoxels_initialise(sim_params->protein_model.grid_layout, 0);
+		} else if (sim_params->protein_model.grid_precision != GRID_PRECISION_DOUBLE)
+			gridprecision_initialise(sim_params->protein_model.grid_precision, 0);
+		gridpyramid_initialise();
+		rotcache_initialise(chain->NAA, sim_params->protein_model.rotcache_quantum);
 		//printf("transpoints box initialise succuss %i %g %g %g \n", transPtsCount, Xpts[0], Ypts[transPtsCount - 1], Zpts[transPtsCount - 1]);
 		fprintf(stderr, "AD Grid maps initialisation finished \n");
 	}
@@ -916,6 +926,7 @@ int main(int argc, char *argv[])
 {
 	//set a timer
 	time_t startTime = time(NULL);
+	start_wtime = gridfile_wtime();
 
 	//char *seq;
 	simulation_params sim_params;
@@ -960,6 +971,9 @@ int main(int argc, char *argv[])
 
 	//model_param_initialise(&(sim_params.protein_model));
 	model_param_read(sim_params.prm,&(sim_params.protein_model),&(sim_params.flex_params));
+	sidechain_store = sim_params.protein_model.keep_sidechains;
+	/* before any chain is allocated, as the kept side chains have room for the largest rotamer */
+	rotlib_initialise(sim_params.protein_model.rotlib_file, sim_params.protein_model.rotamer_budget, sim_params.protein_model.rotamer_cys);
 
 	ramaprob_initialise();
 	
@@ -975,8 +989,8 @@ int main(int argc, char *argv[])
 	    Chain *chain = (Chain *)malloc(sizeof(Chain)); chain->NAA = 0;
             Chaint* chaint = (Chaint *)malloc(sizeof(Chaint));
       	    chain->NAA =0;
-      	    chain->aa = NULL; chain->xaa = NULL; chain->erg = NULL; chain->xaa_prev = NULL;
-      	    chaint->aat = NULL; chaint->xaat = NULL; chaint->ergt = NULL; chaint->xaat_prev = NULL;
+      	    chain->aa = NULL; chain->xaa = NULL; chain->erg = NULL; chain->xaa_prev = NULL; chain->sc = NULL;
+      	    chaint->aat = NULL; chaint->xaat = NULL; chaint->ergt = NULL; chaint->xaat_prev = NULL; chaint->sct = NULL;
 	    /* allocate memory for the biasmap */
             Biasmap *biasmap = (Biasmap *)malloc(sizeof(Biasmap));
       	    biasmap->distb = NULL;
@@ -1100,13 +1114,37 @@ int main(int argc, char *argv[])
 #endif
 
 	fprintf(stderr, "best target energy %g\n", targetBest);
+	if (gridpyramid_tests > 0)
+		fprintf(stderr, "grid pyramid rejected %ld of %ld translation moves (%.1f%%) without the rotamer search\n",
+			gridpyramid_rejects, gridpyramid_tests, 100.0 * gridpyramid_rejects / gridpyramid_tests);
+	if (rotcache_lookups > 0)
+		fprintf(stderr, "rotamer cache hit %ld of %ld side chains (%.1f%%), %.2f us per scan, %.2f us per hit\n",
+			rotcache_hits, rotcache_lookups, 100.0 * rotcache_hits / rotcache_lookups,
+			rotcache_lookups > rotcache_hits ? 1e6 * rotcache_scan_seconds / (rotcache_lookups - rotcache_hits) : 0.0,
+			rotcache_hits > 0 ? 1e6 * rotcache_hit_seconds / rotcache_hits : 0.0);
+	if (rigid_moves > 0)
+		fprintf(stderr, "%ld rigid body moves scored with the rotamers kept\n", rigid_moves);
+	if (ergsum_drift > 1e-9)
+		fprintf(stderr, "running energy totals drifted by up to %g\n", ergsum_drift);
+	if (rigidbody_tries[RIGIDBODY_ROTATE] + rigidbody_tries[RIGIDBODY_TRANSLATE] > 0)
+		fprintf(stderr, "rigid body moves: %ld of %ld rotations accepted, step %g rad; %ld of %ld translations accepted, step %g A\n",
+			rigidbody_accepts[RIGIDBODY_ROTATE], rigidbody_tries[RIGIDBODY_ROTATE], rigidbody_step[RIGIDBODY_ROTATE],
+			rigidbody_accepts[RIGIDBODY_TRANSLATE], rigidbody_tries[RIGIDBODY_TRANSLATE], rigidbody_step[RIGIDBODY_TRANSLATE]);
+	if (pack_calls > 0)
+		fprintf(stderr, "side chain packer: %ld of %ld packings exact, %.1f%% of the rotamer states left by dead-end elimination\n",
+			pack_exact, pack_calls, 100.0 * pack_states_kept / pack_states_total);
+	for (int t = 0; t < 26; t++)
+		if (rotsearch_scans[t] > 0)
+			fprintf(stderr, "rotamer search %c: %ld of %ld grid lookups (%.1f%%)\n", 'A' + t,
+				rotsearch_lookups[t], rotsearch_scans[t], 100.0 * rotsearch_lookups[t] / rotsearch_scans[t]);
 	// free memory in AutoPK
 	if (sim_params.protein_model.external_potential_type == 5) {
 		free(Xpts);
 		free(Ypts);
 		free(Zpts);
-		for (int atype = 0; atype < sizeof(gridmapvalues) / sizeof(gridmapvalues)[0]; atype++)
-			free(gridmapvalues[atype]);
+		gridmap_finalise();
+		rotcache_finalise();
+		rotlib_finalise();
 	}
 	free(ramaprob);
 	free(alaprob);
@@ -0,0 +1,51 @@
+/*
+**  This program converts the AutoGrid maps of a receptor into the binary
+**  grid file that adcp memory-maps at start-up.
+**
+**  Copyright (c) Yuqi Zhang, Michel Sanner, CCSB Scripps
+*/
+
+#define VER "map2grd 1.0, Copyright (c) Yuqi Zhang, Michel Sanner, CCSB Scripps\n"
+#define USE "Usage: %s [options]\n\
+Options:\n\
+ -p rigidReceptor     prefix of the PREFIX.{C,N,OA,HD,SA,A,NA,e,d}.map files\n\
+ -o rigidReceptor.grd output binary grid file\n"
+
+#include<stdio.h>
+#include<stdlib.h>
+#include"gridmap_io.h"
+
+char *prefix = GRIDFILE_DEFAULT_PREFIX;
+char *outfile = GRIDFILE_DEFAULT_NAME;
+
+void read_options(int argc, char *argv[])
+{
+	int i, opt;
+
+	for (i = 1; i < argc; i++) {
+		opt = argv[i][0] == '-' ? argv[i][1] : 0;
+		if (++i >= argc)
+			opt = 0;
+
+		switch (opt) {
+		case 'p':
+			prefix = argv[i];
+			break;
+		case 'o':
+			outfile = argv[i];
+			break;
+		default:
+			fprintf(stderr, VER USE, argv[0]);
+			exit(EXIT_FAILURE);
+		}
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	read_options(argc, argv);
+
+	gridfile_convert(prefix, outfile);
+
+	return EXIT_SUCCESS;
+}
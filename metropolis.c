@@ -29,6 +29,9 @@
 #define Ergt(I,J)   ergt[(I - start) * chain->NAA + (J)]
 //#define Ergt(I,J)   ergt[(I) * chain->NAA + (J)]
 
+/* commits of moves between two sums of the running totals of the energy matrix */
+#define ERGSUM_PERIOD 1024
+
 
 /***********************************************************/
 /****           MOVES AND METROPOLIS CRITERIA           ****/
@@ -44,20 +47,111 @@ static int reModNum(int a, int mod) {
 	return ((a-1)%mod)+1;
 }
 
-static int indMoved(int ind, int start, int end){
-	if (start>=end){
-		if (ind>end && ind<start)
-			return 0;
-		else
-			return 1;
-	} else {
-		if (ind>=start && ind<=end)
-			return 1;
-		else
-			return 0;
+/* whether residue ind is in the segment start..end of a move on a chain of n residues,
+   end past n wrapping around the ring of a cyclic peptide. end is taken as it is, not
+   reModNum'd, so start == end is the one residue and end == start + n the whole ring */
+static int indMoved(int ind, int start, int end, int n){
+	if (end > n)
+		return ind >= start || ind <= reModNum(end, n);
+	return ind >= start && ind <= end;
+}
+
+/* whether a move draws new sidechain dihedral angles: with P = 1/4, unless fixed */
+static int trial_newchi(simulation_params *sim_params)
+{
+	return (sim_params->protein_model).use_gamma_atoms != NO_GAMMA && !(sim_params->protein_model).fix_chi_angles && rand()/(double)RAND_MAX < 0.25;
+}
+
+/* The trial chain is copy-on-write: a move refreshes the residues start..end it rebuilds
+   from chain (end past NAA-1 wrapping around the ring), with new sidechain dihedral angles
+   if newchi, and the energy terms read the residues out of the segment from chain. */
+static void trial_refresh(Chain *chain, Chaint *chaint, int start, int end, int newchi, simulation_params *sim_params)
+{
+	for (int k = start; k <= end; k++) {
+		int i = reModNum(k, chain->NAA-1);
+		AA *a = chaint->aat + i, *b = chain->aa + i;
+		a->etc = b->etc;
+		a->num = b->num;
+		a->id = b->id;
+		a->chainid = b->chainid;
+		a->SCRot = b->SCRot;
+		a->SCTrial = b->SCTrial;
+		if ((sim_params->protein_model).use_gamma_atoms == NO_GAMMA)
+			continue;
+		if (!newchi) {
+			a->chi1 = b->chi1;
+			a->chi2 = b->chi2;
+			continue;
+		}
+		if (b->id != 'G' && b->id != 'A' && b->chi1 != DBL_MAX)
+			a->chi1 = sidechain_dihedral(b->id, sim_params->protein_model.sidechain_properties);
+		if ((b->id == 'V' || b->id == 'I' || b->id == 'T') && b->chi2 != DBL_MAX)
+			a->chi2 = sidechain_dihedral2(b->id, a->chi1, sim_params->protein_model.sidechain_properties);
+	}
+}
+
+/* The trial of a rigid translation of the whole chain: chaint's residues are chain's moved
+   by v, copied and moved in one pass. The CA-CA vectors do not change, xaat is left alone. */
+static void trial_translate(Chain *chain, Chaint *chaint, const double v[3])
+{
+	for (int j = 1; j < chain->NAA; j++) {
+		AA *a = chaint->aat + j;
+		*a = chain->aa[j];
+		for (int i = 0; i < 3; i++) {
+			if (a->etc & G__)
+				a->g[i] += v[i];
+			if (a->etc & G2_)
+				a->g2[i] += v[i];
+			if (a->id != 'P')
+				a->h[i] += v[i];
+			a->n[i] += v[i];
+			a->ca[i] += v[i];
+			a->c[i] += v[i];
+			a->o[i] += v[i];
+			if (a->id != 'G')
+				a->cb[i] += v[i];
+		}
 	}
 }
 
+/* Write the energies of an accepted move into the energy matrix of the chain: the one and
+   two residue terms saved in chaint, the external energies of the moved residues (none if
+   ADEnergies is NULL), the global and, if cyclic, the cyclic bond energies. Only the rows
+   of the moved residues and the named slots are written, and the running totals of the
+   matrix change by what is written; they are added up again every ERGSUM_PERIOD commits.
+   A rejected move writes nothing, its rows in chaint are left to the next one. */
+static void energy_matrix_commit(Chain *chain, Chaint *chaint, int start, int end, double *ADEnergies, double SSEnergy, double cyclicBondEnergy, int cyclic)
+{
+	static long commits = 0;
+	int i, j, r;
+	double q;
+
+	for (i = start; i <= end; i++) {
+		r = reModNum(i, chain->NAA-1);
+		for (j = 1; j < chain->NAA; j++) {
+			q = chaint->Ergt(i, j);
+			if (j == r)
+				chain->ergloc += q - chain->Erg(r, j);
+			else
+				chain->ergpair += q - chain->Erg(r, j);
+			chain->Erg(r, j) = chain->Erg(j, r) = q;
+		}
+	}
+	if (ADEnergies)
+		for (j = start; j <= end; j++) {
+			r = reModNum(j, chain->NAA-1);
+			ErgExternal(chain) += ADEnergies[j-start] - chain->Erg(0, r);
+			chain->Erg(0, r) = ADEnergies[j-start];
+		}
+
+	if (cyclic) {
+		ErgCyclic(chain) = cyclicBondEnergy;
+	}
+	ErgGlobal(chain) = SSEnergy;
+	if (++commits % ERGSUM_PERIOD == 0)
+		ergsum_drift = fmax(ergsum_drift, energy_matrix_sum(chain));
+}
+
 /* Check if the proposed move (saved in chaint) is allowed
    by applying the Metropolis criteria on the energy change.
    If the move is allowed, update the coordinates and the
@@ -66,6 +160,7 @@ static int allowed(Chain *chain, Chaint *chaint, Biasmap* biasmap, int start, in
 {	
 	int i, j;
 	double q, loss = 0.0;
+	double reach = energy2_reach(&(sim_params->protein_model));
 	int linked = 0;
 	//get the AD energy first as it will set position for gamma atoms
 	double externalloss = 0.0;
@@ -87,18 +182,18 @@ static int allowed(Chain *chain, Chaint *chaint, Biasmap* biasmap, int start, in
 				if ( ( j==1 || j==chain->NAA-1)){
 					if (sim_params->protein_model.external_potential_type2 != 4)
 						q += 0;
-					else if (j==1 && indMoved(2,start,reModNum(end,chain->NAA-1)) && linked)
+					else if (j==1 && indMoved(2,start,end,chain->NAA-1) && linked)
 						q += ramabias(chaint->aat + chain->NAA - 1, chaint->aat + 1, chaint->aat + 2);
 					else if (j==1 && linked)
 						q += ramabias(chaint->aat + chain->NAA - 1, chaint->aat + 1, chain->aa + 2);	
 					else if (j==1)
-						q += ramabias(chain->aa + chain->NAA - 1, chaint->aat + 1, chaint->aat + 2);	
-					else if (j==chain->NAA-1 && indMoved(chain->NAA-1,start,reModNum(end,chain->NAA-1)) && linked)
+						q += ramabias(chain->aa + chain->NAA - 1, chaint->aat + 1, (indMoved(2,start,end,chain->NAA-1) ? chaint->aat : chain->aa) + 2);	
+					else if (j==chain->NAA-1 && indMoved(chain->NAA-1,start,end,chain->NAA-1) && linked)
 						q += ramabias(chaint->aat + j - 1, chaint->aat + j, chaint->aat +1);
 					else if (j==chain->NAA-1 && linked)
 						q += ramabias(chain->aa + j - 1, chaint->aat + j, chaint->aat +1);
 					else
-						q += ramabias(chaint->aat + j - 1, chaint->aat + j, chain->aa +1);
+						q += ramabias((indMoved(j-1,start,end,chain->NAA-1) ? chaint->aat : chain->aa) + j - 1, chaint->aat + j, chain->aa +1);
 				} else if (i == start)
 					q += ramabias(chain->aa + reModNum(i-1, chain->NAA-1), chaint->aat + reModNum(i, chain->NAA-1), chaint->aat + reModNum(i+1, chain->NAA-1));
 				else if (i == end)
@@ -106,13 +201,13 @@ static int allowed(Chain *chain, Chaint *chaint, Biasmap* biasmap, int start, in
 				else
 					q += ramabias(chaint->aat + reModNum(i-1, chain->NAA-1), chaint->aat + reModNum(i, chain->NAA-1), chaint->aat + reModNum(i+1, chain->NAA-1));
 			} 
-			else if (indMoved(j,start,reModNum(end,chain->NAA-1))){
+			else if (indMoved(j,start,end,chain->NAA-1)){
 				if ((reModNum(i, chain->NAA-1) == 1 && j == chain->NAA-1 && sim_params->protein_model.external_potential_type2 == 4)) {
 					q = energy2cyclic(biasmap,chaint->aat + 1, chaint->aat + chain->NAA - 1, &(sim_params->protein_model));
 					chaint->Ergt(j, reModNum(i, chain->NAA-1)) = q;
 				} else if(j > reModNum(i, chain->NAA-1)) {
 					//fprintf(stderr,"MC move q = %d %d, loss = %d %d haha %d %d,",i,j,start,end,indMoved(j,start,reModNum(end,chain->NAA-1)),linked);
-					q = energy2(biasmap,(chaint->aat) + reModNum(i, chain->NAA-1), (chaint->aat) + j, &(sim_params->protein_model));
+					q = energy2_ranged(biasmap,(chaint->aat) + reModNum(i, chain->NAA-1), (chaint->aat) + j, reach, &(sim_params->protein_model));
 					if (j < start && linked) {
 						//fprintf(stderr,"aaa move q = %d %d, loss = %d %d haha %d %d,\n",i,j,start,end,indMoved(j,start,reModNum(end,chain->NAA-1)),linked);
 						chaint->Ergt(j + chain->NAA-1, reModNum(i, chain->NAA-1)) = q;
@@ -131,7 +226,7 @@ static int allowed(Chain *chain, Chaint *chaint, Biasmap* biasmap, int start, in
 				else if (i == 1 && j == chain->NAA-1 && sim_params->protein_model.external_potential_type2 == 4)
 					q = energy2cyclic(biasmap,chaint->aat + 1, chain->aa + chain->NAA - 1, &(sim_params->protein_model));
 				else
-					q = energy2(biasmap,chaint->aat + reModNum(i, chain->NAA-1), (chain->aa) + j, &(sim_params->protein_model));
+					q = energy2_ranged(biasmap,chaint->aat + reModNum(i, chain->NAA-1), (chain->aa) + j, reach, &(sim_params->protein_model));
 			}
 
 			chaint->Ergt(i, j) = q;
@@ -142,10 +237,10 @@ static int allowed(Chain *chain, Chaint *chaint, Biasmap* biasmap, int start, in
 	/*Also take into account the global_energy term */
 	double SSEnergy = global_energy(start,end,chain,chaint,biasmap,&(sim_params->protein_model));
 	double SSloss = 0.0;
-	SSloss = chain->Erg(chain->NAA - 1, 0) - SSEnergy;
-	//loss += (chain->Erg(0, 0) - q);
+	SSloss = ErgGlobal(chain) - SSEnergy;
+	//loss += (ErgExternal(chain) - q);
 	//fprintf(stderr,"MC move q = %g, loss = %g,",q,loss);
-	//double externalloss = (chain->Erg(0, 0) - q);
+	//double externalloss = (ErgExternal(chain) - q);
 
 	currTargetEnergy = sim_params->protein_model.opt_totE_weight*(totenergy(chain)-loss)
 				+ (sim_params->protein_model.opt_extE_weight+sim_params->protein_model.opt_totE_weight)*(extenergy(chain)-externalloss);
@@ -156,16 +251,16 @@ static int allowed(Chain *chain, Chaint *chaint, Biasmap* biasmap, int start, in
 	double internalloss = loss;
 	double external_k = 1.0;
 	if (sim_params->protein_model.external_potential_type == 5 || sim_params->protein_model.external_potential_type2 == 4)	external_k = sim_params->protein_model.external_k[0];
-	//if (chain->Erg(0, 0) > 5 || currTargetEnergy - targetBest > 15) external_k = 0.5;
+	//if (ErgExternal(chain) > 5 || currTargetEnergy - targetBest > 15) external_k = 0.5;
 	//if ((targetBest > 0 || currTargetEnergy - targetBest < 25.) && (externalloss < -10 || loss < -10 )) external_k = 0.05 * external_k;
-	//if (chain->Erg(0, 0) < 1000 && rand()%100<10) external_k = 0.05 * external_k;
+	//if (ErgExternal(chain) < 1000 && rand()%100<10) external_k = 0.05 * external_k;
 	//if (externalloss < -10 || loss < -10) external_k = 0.15 * external_k;
-	//if (chain->Erg(0, 0) > 20 ||chain->Erg(0, 0) > 50) external_k = 0.2 * external_k;
+	//if (ErgExternal(chain) > 20 ||ErgExternal(chain) > 50) external_k = 0.2 * external_k;
 	//if ((targetBest > 0 || currTargetEnergy - targetBest < 25.) && (externalloss < -10 || loss < -10 )) external_k = 0.05 * external_k;
 
 	//loss is negative!! if loss is negative, it's worse, bad
 	/* Metropolis criteria */
-	//loss += q - chain->Erg(0, 0);
+	//loss += q - ErgExternal(chain);
 	//loss = loss/sqrt(chain->NAA) + externalloss;
 	//external_k = 0.05 * external_k;
 	double cyclicBondEnergy = 0.0;
@@ -179,7 +274,7 @@ static int allowed(Chain *chain, Chaint *chaint, Biasmap* biasmap, int start, in
 			cyclicBondEnergy = cyclic_energy((chain->aa) + 1, (chaint->aat) + chain->NAA - 1, 0);
 		else
 			cyclicBondEnergy = cyclic_energy((chain->aa) + 1, (chain->aa) + chain->NAA - 1, 0);
-		externalloss += chain->Erg(1, 0) - cyclicBondEnergy;
+		externalloss += ErgCyclic(chain) - cyclicBondEnergy;
 	}
 
 	loss = loss + SSloss + externalloss;
@@ -235,24 +330,11 @@ static int allowed(Chain *chain, Chaint *chaint, Biasmap* biasmap, int start, in
 	}
 
 	/* commit accepted changes */
-	for (i = start; i <= end; i++)
-		for (j = 1; j < chain->NAA; j++)
-	    	chain->Erg(reModNum(i, chain->NAA-1), j) = chain->Erg(j, reModNum(i, chain->NAA-1)) = chaint->Ergt(i, j);
     if (sim_params->protein_model.external_potential_type == 5) {
-		for (j = start; j <= end; j++)
-			chain->Erg(0, reModNum(j, chain->NAA-1)) = ADEnergy_Chaint[j-start];
+		energy_matrix_commit(chain, chaint, start, end, ADEnergy_Chaint, SSEnergy, cyclicBondEnergy, sim_params->protein_model.external_potential_type2 == 4);
 		//free(ADEnergy_Chaint);
-    }
-	chain->Erg(0, 0) = 0.0;
-
-	for (j = 1; j < chain->NAA; j++) {
-		chain->Erg(0, 0) += chain->Erg(0, j);
-	}
-
-	if (sim_params->protein_model.external_potential_type2 == 4) {
-		chain->Erg(1, 0) = cyclicBondEnergy;
-	}
-	chain->Erg(chain->NAA - 1, 0) = SSEnergy;
+    } else
+		energy_matrix_commit(chain, chaint, start, end, NULL, SSEnergy, cyclicBondEnergy, sim_params->protein_model.external_potential_type2 == 4);
 	*currE -= internalloss + externalloss;
 	//free(ADEnergy_Chaint);
     return 1;
@@ -272,36 +354,6 @@ void transmutate(Chain * chain, Chaint *chaint, Biasmap *biasmap, double ampl, d
 	//no transPts identified. transPtsCount == 1 means only the center of box is found.
 	if (transPtsCount == 1) return;
 	double transvec[3];
-	//copy chain to chaint
-	for (int j = 1; j < chain->NAA; j++){
-		chaint->aat[j].etc = chain->aa[j].etc;
-		chaint->aat[j].num = chain->aa[j].num;
-		chaint->aat[j].id = chain->aa[j].id;
-		chaint->aat[j].chainid = chain->aa[j].chainid;
-		chaint->aat[j].SCRot = chain->aa[j].SCRot;
-		for(int i = 0; i < 3; i++){
-			chaint->aat[j].h[i] = chain->aa[j].h[i];	
-			chaint->aat[j].n[i] =  chain->aa[j].n[i];		
-			chaint->aat[j].ca[i] = chain->aa[j].ca[i];		
-			chaint->aat[j].c[i] = chain->aa[j].c[i];		
-			chaint->aat[j].o[i] = chain->aa[j].o[i];
-			chaint->aat[j].cb[i] = chain->aa[j].cb[i];
-			chaint->aat[j].g[i] = chain->aa[j].g[i];
-			chaint->aat[j].g2[i] = chain->aa[j].g2[i];
-			chaint->xaat[j][i][0] = chain->xaa[j][i][0];
-			chaint->xaat[j][i][1] = chain->xaa[j][i][1];
-			chaint->xaat[j][i][2] = chain->xaa[j][i][2];
-		}
-		//chaint->aat[j] = chain->aa[j];
-	}
-	
-
-	casttriplet(chaint->xaat[0], chain->xaa[0]);
-	for (int i = 1; i <= chain->NAA - 1; i++) {
-		casttriplet(chaint->xaat[i], chain->xaa[i]);
-	}
-	casttriplet(chaint->xaat_prev[chain->aa[1].chainid], chain->xaa_prev[chain->aa[1].chainid]);
-
 	//get a random transpoints
 	int transPtsID = rand() % transPtsCount;
 
@@ -312,30 +364,7 @@ void transmutate(Chain * chain, Chaint *chaint, Biasmap *biasmap, double ampl, d
 	transvec[2] =  -chain->aa[centerAAID].c[2] + Zpts[transPtsID];
 
 	//apply the transvec to all atoms
-	double movement = 0;
-	//fprintf(stderr, "translational move %g %g %g %d \n", transvec[0][vecind], transvec[1][vecind], transvec[2][vecind],chain->NAA);
-	for (int i = 0; i < 3; i++) {
-		movement = transvec[i];
-		for (int j = 1; j < chain->NAA; j++) {
-			if (chaint->aat[j].etc & G__){
-				chaint->aat[j].g[i] += movement;
-			}
-			if (chaint->aat[j].etc & G2_){
-				chaint->aat[j].g2[i] += movement;
-			}
-
-			if (chaint->aat[j].id != 'P') {
-				chaint->aat[j].h[i] += movement;
-			}
-			chaint->aat[j].n[i] += movement;
-			chaint->aat[j].ca[i] += movement;
-			chaint->aat[j].c[i] += movement;
-			chaint->aat[j].o[i] += movement;
-			if (chaint->aat[j].id != 'G') {
-				chaint->aat[j].cb[i] += movement;
-			}
-		}
-	}
+	trial_translate(chain, chaint, transvec);
 
 	//score the external energy, the internal energy stays the same
 	double ADEnergy_Chaint[chain->NAA-1];
@@ -343,22 +372,12 @@ void transmutate(Chain * chain, Chaint *chaint, Biasmap *biasmap, double ampl, d
 	ADenergyNoClash(ADEnergy_Chaint, 1, chain->NAA-1,chain,chaint,&(sim_params->protein_model), 0);
 
 	//default is to accept all transmutate move and commit the move
-	casttriplet(chain->xaa[0], chaint->xaat[0]);
-
-	for (int i = 1; i <= chain->NAA - 1; i++) {
-		casttriplet(chain->xaa[i], chaint->xaat[i]);
-	}
-
-
-	chain->Erg(0, 0) = 0.0;
 	//if (transExtEne < -30) fprintf(stderr, "committing moved !!\n");
-	for (int j = 1; j < chain->NAA; j++) {
-	    chain->Erg(0, j) = ADEnergy_Chaint[j - 1];
-		chain->Erg(0, 0) += chain->Erg(0, j);
-	}
+	energy_matrix_external(chain, ADEnergy_Chaint);
 
 	for (int i = 1; i <= chain->NAA - 1; i++) {
 		chain->aa[i] = chaint->aat[i];
+		if (chain->sc && chaint->sct) sidechain_copy(chain->sc + i, chaint->sct + i);
 	}
 	fprintf(stderr, "transmutate!!! %g %g %g\n", chain->aa[centerAAID].c[0], chain->aa[centerAAID].c[1], chain->aa[centerAAID].c[2]);
 	fprintf(stderr, "transmutate!!! %g %g %g\n", Xpts[transPtsID], Ypts[transPtsID], Zpts[transPtsID]);
@@ -367,6 +386,83 @@ void transmutate(Chain * chain, Chaint *chaint, Biasmap *biasmap, double ampl, d
 }
 
 
+/* The Metropolis test of a move of the whole chain as a rigid body, its trial in chaint:
+   the internal energy stays the same, so only the external energy is scored. An accepted
+   move is committed, with the CA-CA vectors if rotated, and its change of energy taken off currE. */
+static int rigid_metropolis(Chain *chain, Chaint *chaint, double *currE, simulation_params *sim_params, int rotated)
+{
+	int i;
+	double ADEnergy_Chaint[chain->NAA-1];
+	//double* ADEnergy_Chaint;
+
+
+	double externalloss = 0.0;
+	/* the Metropolis threshold is drawn first, so that a move whose best possible
+	   energy from the grid pyramid would be rejected skips the rotamer search */
+	int threshold = rand();
+	/* a short move keeps the side chains, and leaves the rotamer search to the longer ones */
+	int rigid = ADenergyRigid(ADEnergy_Chaint, chain, chaint, &(sim_params->protein_model));
+	if (!rigid && sim_params->protein_model.external_potential_type == 5 && sim_params->protein_model.external_k[0] > 0.0) {
+		double bestloss = -ADenergyNoClash_bound(1, chain->NAA-1, chain, chaint, &(sim_params->protein_model), 1);
+		for (i = 1; i <= chain->NAA-1; i++) bestloss += chain->Erg(0, i);
+		gridpyramid_tests++;
+		/* the smallest external_k below is 0.05 external_k[0] */
+		if (bestloss < 0.0 && bestloss * RAND_MAX * 0.05 * sim_params->protein_model.external_k[0] < -threshold) {
+			gridpyramid_rejects++;
+			return 0;
+		}
+	}
+	//double* ADEnergy_Chaint;
+	if (sim_params->protein_model.external_potential_type == 5){
+		if (!rigid)
+			ADenergyNoClash(ADEnergy_Chaint, 1, chain->NAA-1,chain,chaint,&(sim_params->protein_model), 1);
+		//ADEnergy_Chaint = ADenergyNoClash(1, chain->NAA-1,chain,chaint,&(sim_params->protein_model), 0);
+		for (i = 1; i <= chain->NAA-1; i++){
+			externalloss += chain->Erg(0, i) - ADEnergy_Chaint[i-1];
+		}
+	}
+	//if loss is negative, it's worse, bad
+
+        //currTargetEnergy = (sim_params->protein_model.opt_extE_weight+sim_params->protein_model.opt_totE_weight)*(extenergy(chain)-externalloss);
+
+	double external_k = 1.0;
+	if (sim_params->protein_model.external_potential_type == 5 || sim_params->protein_model.external_potential_type2 == 4)	external_k = sim_params->protein_model.external_k[0];
+	//if (externalloss < -10) external_k = 0.09 * external_k;
+
+
+
+	if (externalloss < -10) external_k = 0.05 * external_k;
+	//if ((targetBest > 0 || currTargetEnergy - targetBest < 25) && externalloss < -10) external_k = 0.05 * external_k;
+	//if (ErgExternal(chain) > 50) external_k = 0.2 * external_k;
+
+	//if (moved && allowed(chain, chaint, biasmap, 1, chain->NAA - 1, logLstar, currE, sim_params)) {
+	if (externalloss < 0.0 && externalloss * RAND_MAX * external_k < -threshold) {
+		//free(ADEnergy_Chaint);
+		return 0;
+	}
+
+	else {
+
+		if (rotated) {
+			for (i = 0; i < chain->NAA; i++)
+				casttriplet(chain->xaa[i], chaint->xaat[i]);
+			for (i = 0; i <= chain->Nchains; i++)
+				casttriplet(chain->xaa_prev[i], chaint->xaat_prev[i]);
+		}
+	    energy_matrix_external(chain, ADEnergy_Chaint);
+
+		for (int i = 1; i <= chain->NAA - 1; i++) {
+			chain->aa[i] = chaint->aat[i];
+			if (chain->sc && chaint->sct) sidechain_copy(chain->sc + i, chaint->sct + i);
+		}
+		*currE -= externalloss;
+		//copybetween(chain, chaint);
+		//free(ADEnergy_Chaint);
+		return 1;
+	}
+}
+
+
 /* Make a translation move. */
 static int transmove(Chain * chain, Chaint *chaint, Biasmap *biasmap, double ampl, double logLstar, double * currE, simulation_params *sim_params)
 {
@@ -382,41 +478,7 @@ static int transmove(Chain * chain, Chaint *chaint, Biasmap *biasmap, double amp
 		return 0;
 	}
 	double transvec[3];
-	int i, j;
-	for (j = 1; j < chain->NAA; j++){
-		chaint->aat[j].etc = chain->aa[j].etc;
-		chaint->aat[j].num = chain->aa[j].num;
-		chaint->aat[j].id = chain->aa[j].id;
-		chaint->aat[j].chainid = chain->aa[j].chainid;
-		chaint->aat[j].SCRot = chain->aa[j].SCRot;
-		for(i = 0; i < 3; i++){
-
-
-
-			if (chaint->aat[j].id != 'P') {
-				chaint->aat[j].h[i] = chain->aa[j].h[i];
-			}
-			chaint->aat[j].n[i] =  chain->aa[j].n[i];
-			chaint->aat[j].ca[i] = chain->aa[j].ca[i];
-			chaint->aat[j].c[i] = chain->aa[j].c[i];
-			chaint->aat[j].o[i] = chain->aa[j].o[i];
-			if (chaint->aat[j].id != 'G') {
-				chaint->aat[j].cb[i] = chain->aa[j].cb[i];
-			}
-			if (chaint->aat[j].etc & G__){
-				chaint->aat[j].g[i] = chain->aa[j].g[i];
-			}
-			if (chaint->aat[j].etc & G2_){
-				chaint->aat[j].g2[i] = chain->aa[j].g2[i];
-			}
-			chaint->xaat[j][i][0] = chain->xaa[j][i][0];
-			chaint->xaat[j][i][1] = chain->xaa[j][i][1];
-			chaint->xaat[j][i][2] = chain->xaa[j][i][2];
-
-
-		}
-		//chaint->aat[j] = chain->aa[j];
-	}
+	int i;
 	for(i = 0; i < 3; i++){
 		chaint->xaat_prev[0][i][0] = chain->xaa_prev[0][i][0];
 		chaint->xaat_prev[0][i][1] = chain->xaa_prev[0][i][1];
@@ -442,7 +504,7 @@ static int transmove(Chain * chain, Chaint *chaint, Biasmap *biasmap, double amp
 	//fprintf(stderr, "translational move %g %g %g %d \n", transvec[0][vecind], transvec[1][vecind], transvec[2][vecind],chain->NAA);
 	for (i = 0; i < 3; i++) {	
 		movement[i] = 0.0;
-		if (chain->Erg(0, 0) > 0) {
+		if (ErgExternal(chain) > 0) {
 			if (length > 0.4) {
 				movement[i] = 2. * rand() / RAND_MAX - 1;
 			}
@@ -458,88 +520,191 @@ static int transmove(Chain * chain, Chaint *chaint, Biasmap *biasmap, double amp
 				movement[i] = transvec[i] * length / abs(vecind2 - vecind1);
 			}
 		}	
-		for (int j = 1; j < chain->NAA; j++) {
-			if (chaint->aat[j].etc & G__){
-				chaint->aat[j].g[i] += movement[i];
-			}
-			if (chaint->aat[j].etc & G2_){
-				chaint->aat[j].g2[i] += movement[i];
-			}
-			if (chaint->aat[j].id != 'P') {
-				chaint->aat[j].h[i] += movement[i];
-			}
-			chaint->aat[j].n[i] += movement[i];
-			chaint->aat[j].ca[i] += movement[i];
-			chaint->aat[j].c[i] += movement[i];
-			chaint->aat[j].o[i] += movement[i];
-
-			if (chaint->aat[j].id != 'G') {
-				chaint->aat[j].cb[i] += movement[i];
-			}
-
-		}
 	}
+	trial_translate(chain, chaint, movement);
 
 
-	double ADEnergy_Chaint[chain->NAA-1];
-	//double* ADEnergy_Chaint;
+	return rigid_metropolis(chain, chaint, currE, sim_params, 0);
+}
 
+/* rigid-body pose of the peptide backbone on the receptor grid, for transopt:
+   x = (t, radius * w) moves atom r to R(w) r + center + t, r relative to the centroid */
+typedef struct {
+	int n;
+	double *X, *Y, *Z;	/* atoms relative to center */
+	int *types;
+	double *charges;
+	vector center;
+	double radius;		/* radius of gyration, so the rotation variables are in A like the translation */
+} Rigidpose;
+
+#define RIGIDOPT_MEMORY 5	/* L-BFGS correction pairs */
+#define RIGIDOPT_MAXSTEP 1.0	/* largest step of the translation and rotation variables in A */
+
+/* rotation matrix of the rotation vector w */
+static void rigid_rotmatrix(matrix t, vector w)
+{
+	vector axis;
+	double angle = sqrt(square(w));
+	if (angle < 1e-12) {
+		axis[0] = 1.0; axis[1] = axis[2] = 0.0;
+		angle = 0.0;
+	} else
+		scale(axis, 1.0 / angle, w);
+	rotmatrix(t, axis, angle);
+}
 
-	double externalloss = 0.0;
-	//double* ADEnergy_Chaint;
-	if (sim_params->protein_model.external_potential_type == 5){
-		ADenergyNoClash(ADEnergy_Chaint, 1, chain->NAA-1,chain,chaint,&(sim_params->protein_model), 1);
-		//ADEnergy_Chaint = ADenergyNoClash(1, chain->NAA-1,chain,chaint,&(sim_params->protein_model), 0);
-		for (i = 1; i <= chain->NAA-1; i++){
-			externalloss += chain->Erg(0, i) - ADEnergy_Chaint[i-1];
-		}
+/* grid energy of the backbone at pose x and its gradient: the summed atom forces for the translation,
+   the torque about the centroid mapped through the Jacobian of the rotation vector for the rotation */
+static double rigid_energy(const Rigidpose *pose, const double x[6], double grad[6])
+{
+	matrix t;
+	vector w, torque, p, f, wt, wwt;
+	double erg = 0.0, angle, a, b;
+	int k;
+
+	scale(w, 1.0 / pose->radius, (double *)x + 3);
+	rigid_rotmatrix(t, w);
+	grad[0] = grad[1] = grad[2] = 0.0;
+	torque[0] = torque[1] = torque[2] = 0.0;
+	for (k = 0; k < pose->n; k++) {
+		vector r = { pose->X[k], pose->Y[k], pose->Z[k] };
+		vector tf;
+		matrixvector(p, t, r);
+		erg += gridenergy_gradient(p[0] + pose->center[0] + x[0], p[1] + pose->center[1] + x[1],
+			p[2] + pose->center[2] + x[2], pose->types[k], pose->charges[k], f);
+		add(grad, grad, f);
+		add(torque, torque, crossprod(tf, p, f));
+	}
+	/* dE/dw = J^T torque, J = I + a [w]x + b [w]x^2 the left Jacobian of the rotation vector */
+	angle = sqrt(square(w));
+	if (angle < 1e-6) {
+		a = 0.5;
+		b = 1.0 / 6.0;
+	} else {
+		a = (1.0 - cos(angle)) / (angle * angle);
+		b = (angle - sin(angle)) / (angle * angle * angle);
 	}
-	//if loss is negative, it's worse, bad
-
-        //currTargetEnergy = (sim_params->protein_model.opt_extE_weight+sim_params->protein_model.opt_totE_weight)*(extenergy(chain)-externalloss);
-
-	double external_k = 1.0;
-	if (sim_params->protein_model.external_potential_type == 5 || sim_params->protein_model.external_potential_type2 == 4)	external_k = sim_params->protein_model.external_k[0];
-	//if (externalloss < -10) external_k = 0.09 * external_k;
-
+	crossprod(wt, w, torque);
+	crossprod(wwt, w, wt);
+	for (k = 0; k < 3; k++) grad[3 + k] = (torque[k] - a * wt[k] + b * wwt[k]) / pose->radius;
+	return erg;
+}
 
+/* minimise rigid_energy from x with L-BFGS and a backtracking line search,
+   returns the number of iterations, energy and x are updated */
+static int rigid_lbfgs(const Rigidpose *pose, double x[6], double *energy, int maxiter)
+{
+	double s[RIGIDOPT_MEMORY][6], y[RIGIDOPT_MEMORY][6], rho[RIGIDOPT_MEMORY], alpha[RIGIDOPT_MEMORY];
+	double g[6], d[6], xn[6], gn[6];
+	double erg, ergn, gamma = 1.0;
+	int iter, k, m, stored = 0, newest = -1;
+
+	erg = rigid_energy(pose, x, g);
+	for (iter = 0; iter < maxiter; iter++) {
+		/* two-loop recursion for d = -H g */
+		for (k = 0; k < 6; k++) d[k] = -g[k];
+		for (m = 0; m < stored; m++) {
+			int j = (newest - m + RIGIDOPT_MEMORY) % RIGIDOPT_MEMORY;
+			alpha[j] = 0.0;
+			for (k = 0; k < 6; k++) alpha[j] += rho[j] * s[j][k] * d[k];
+			for (k = 0; k < 6; k++) d[k] -= alpha[j] * y[j][k];
+		}
+		for (k = 0; k < 6; k++) d[k] *= gamma;
+		for (m = stored - 1; m >= 0; m--) {
+			int j = (newest - m + RIGIDOPT_MEMORY) % RIGIDOPT_MEMORY;
+			double beta = 0.0;
+			for (k = 0; k < 6; k++) beta += rho[j] * y[j][k] * d[k];
+			for (k = 0; k < 6; k++) d[k] += (alpha[j] - beta) * s[j][k];
+		}
 
-	if (externalloss < -10) external_k = 0.05 * external_k;
-	//if ((targetBest > 0 || currTargetEnergy - targetBest < 25) && externalloss < -10) external_k = 0.05 * external_k;
-	//if (chain->Erg(0, 0) > 50) external_k = 0.2 * external_k;
+		double slope = 0.0, length = 0.0;
+		for (k = 0; k < 6; k++) {
+			slope += g[k] * d[k];
+			length += d[k] * d[k];
+		}
+		length = sqrt(length);
+		if (length < 1e-6) break;
+		if (slope >= 0.0) {
+			/* not a descent direction, restart from steepest descent */
+			for (k = 0; k < 6; k++) d[k] = -g[k];
+			slope = -length * length;
+			stored = 0;
+		}
+		double step = length > RIGIDOPT_MAXSTEP ? RIGIDOPT_MAXSTEP / length : 1.0;
 
-	//if (moved && allowed(chain, chaint, biasmap, 1, chain->NAA - 1, logLstar, currE, sim_params)) {
-	if (externalloss < 0.0 && externalloss * RAND_MAX * external_k < -rand()) {
-		//free(ADEnergy_Chaint);
-		return 0;
+		/* Armijo backtracking */
+		for (m = 0; m < 10; m++, step *= 0.5) {
+			for (k = 0; k < 6; k++) xn[k] = x[k] + step * d[k];
+			ergn = rigid_energy(pose, xn, gn);
+			if (ergn <= erg + 1e-4 * step * slope) break;
+		}
+		if (m == 10) break;
+
+		double sy = 0.0, yy = 0.0;
+		newest = (newest + 1) % RIGIDOPT_MEMORY;
+		for (k = 0; k < 6; k++) {
+			s[newest][k] = xn[k] - x[k];
+			y[newest][k] = gn[k] - g[k];
+			sy += s[newest][k] * y[newest][k];
+			yy += y[newest][k] * y[newest][k];
+			x[k] = xn[k];
+			g[k] = gn[k];
+		}
+		double decrease = erg - ergn;
+		erg = ergn;
+		if (sy > 1e-10) {
+			rho[newest] = 1.0 / sy;
+			gamma = sy / yy;
+			if (stored < RIGIDOPT_MEMORY) stored++;
+		} else
+			newest = (newest - 1 + RIGIDOPT_MEMORY) % RIGIDOPT_MEMORY;
+		if (decrease < 1e-5) {
+			iter++;
+			break;
+		}
 	}
+	*energy = erg;
+	return iter;
+}
 
-	else {
-
-		//casttriplet(chain->xaa_prev[chain->aa[1].chainid], chaint->xaat_prev[chain->aa[1].chainid]);
-		//
-		//for (int i = 0; i <= chain->NAA - 1; i++) {
-		//	casttriplet(chain->xaa[i], chaint->xaat[i]);
-		//}
-
-
-	    chain->Erg(0, 0) = 0.0;
-
-	    for (int j = 1; j < chain->NAA; j++) {
-	        chain->Erg(0, j) = ADEnergy_Chaint[j - 1];
-	    	chain->Erg(0, 0) += chain->Erg(0, j);
-	    }
+/* move an atom of the pose to the lab frame */
+static void rigid_place(vector a, matrix t, vector center, const double x[6])
+{
+	vector r, p;
+	subtract(r, a, center);
+	matrixvector(p, t, r);
+	a[0] = p[0] + center[0] + x[0];
+	a[1] = p[1] + center[1] + x[1];
+	a[2] = p[2] + center[2] + x[2];
+}
 
-		for (int i = 1; i <= chain->NAA - 1; i++) {
-			chain->aa[i] = chaint->aat[i];
-		}
-		//copybetween(chain, chaint);
-		//free(ADEnergy_Chaint);
-		return 1;
-	}
+/* The trial of chain placed by the rigid body move t, center, x of rigid_place: all atoms,
+   copied and placed in one pass, and the CA-CA vectors */
+static void trial_rigid(Chain *chain, Chaint *chaint, matrix t, vector center, const double x[6])
+{
+	int i, j;
+	for (j = 1; j < chain->NAA; j++) {
+		AA *a = chaint->aat + j;
+		*a = chain->aa[j];
+		if (a->etc & G__) rigid_place(a->g, t, center, x);
+		if (a->etc & G2_) rigid_place(a->g2, t, center, x);
+		if (a->id != 'P') rigid_place(a->h, t, center, x);
+		rigid_place(a->n, t, center, x);
+		rigid_place(a->ca, t, center, x);
+		rigid_place(a->c, t, center, x);
+		rigid_place(a->o, t, center, x);
+		if (a->id != 'G') rigid_place(a->cb, t, center, x);
+	}
+	for (j = 0; j < chain->NAA; j++)
+		rotation(chaint->xaat[j], t, chain->xaa[j]);
+	for (i = 0; i <= chain->Nchains; i++)
+		rotation(chaint->xaat_prev[i], t, chain->xaa_prev[i]);
 }
 
-/* Do a translational optimization in a Solis-Wets fashion. */
+/* Do a rigid-body optimization of the peptide on the grid maps: L-BFGS over
+   the translation and rotation using the analytic grid gradients of the backbone,
+   then one full scoring with side chains; the pose is kept if it lowers the energy. */
 int transopt(Chain * chain, Chaint *chaint, Biasmap *biasmap, double ampl, double logLstar, double * currE, simulation_params *sim_params, int mod)
 {
         for (int i = 1; i < sim_params->NAA; i++) {
@@ -550,153 +715,120 @@ int transopt(Chain * chain, Chaint *chaint, Biasmap *biasmap, double ampl, doubl
 	if (sim_params->protein_model.external_potential_type != 5) {
 		return 0;
 	}
-	/*translational optimization*/
-	//
-	//double transvec[3][chain->NAA - 1];
-	double transvec[3];
 
-	//copy chain to chiant
+	/* the backbone atoms about their centroid, read from chain: chaint is only
+	   filled in once the optimization has found a better pose */
 	int i, j;
-	for (j = 1; j < chain->NAA; j++){
-		chaint->aat[j].etc = chain->aa[j].etc;
-		chaint->aat[j].num = chain->aa[j].num;
-		chaint->aat[j].id = chain->aa[j].id;
-		chaint->aat[j].chainid = chain->aa[j].chainid;
-		chaint->aat[j].SCRot = chain->aa[j].SCRot;
-		for(i = 0; i < 3; i++){
-			chaint->aat[j].h[i] = chain->aa[j].h[i];	
-			chaint->aat[j].n[i] =  chain->aa[j].n[i];		
-			chaint->aat[j].ca[i] = chain->aa[j].ca[i];		
-			chaint->aat[j].c[i] = chain->aa[j].c[i];		
-			chaint->aat[j].o[i] = chain->aa[j].o[i];
-			chaint->aat[j].cb[i] = chain->aa[j].cb[i];
-			chaint->aat[j].g[i] = chain->aa[j].g[i];
-			chaint->aat[j].g2[i] = chain->aa[j].g2[i];
-			chaint->xaat[j][i][0] = chain->xaa[j][i][0];
-			chaint->xaat[j][i][1] = chain->xaa[j][i][1];
-			chaint->xaat[j][i][2] = chain->xaa[j][i][2];
-		}
-		//chaint->aat[j] = chain->aa[j];
-	}
-	for(i = 0; i < 3; i++){
-		chaint->xaat_prev[0][i][0] = chain->xaa_prev[0][i][0];
-		chaint->xaat_prev[0][i][1] = chain->xaa_prev[0][i][1];
-		chaint->xaat_prev[0][i][2] = chain->xaa_prev[0][i][2];
-	}
-
-	double movement[3];
-	int noImprovStep = 0;
-	double currExtE = 0.0;
-	double currADEnergy[chain->NAA-1], ADEnergy_Chaint[chain->NAA-1];
-	double extE = chain->Erg(0,0); //This is the current best E and will be updated
-	int step = 0;
-	int maxStep = 10;
-	int maxNoImprovStep = 3;
-	if (mod == 1){
-		int maxStep = 30;
-		int maxNoImprovStep = 5;
-	}
-
-	for (step = 0; step < maxStep; step++) {
-		if (noImprovStep >= maxNoImprovStep) break;
-		for (i = 0; i < 3; i++) {
-			if (step == 0) movement[i] = 0.0;
-			if (step == 1) movement[i] = 0.2 * rand()/RAND_MAX - 0.1;
-			for (int j = 1; j < chain->NAA; j++) {
-				if (chaint->aat[j].etc & G__){
-					chaint->aat[j].g[i] += movement[i];
-				}
-				if (chaint->aat[j].etc & G2_){
-					chaint->aat[j].g2[i] += movement[i];
-				}
-				if (chaint->aat[j].id != 'P') {
-					chaint->aat[j].h[i] += movement[i];
-				}
-				chaint->aat[j].n[i] += movement[i];
-				chaint->aat[j].ca[i] += movement[i];
-				chaint->aat[j].c[i] += movement[i];
-				chaint->aat[j].o[i] += movement[i];
-				if (chaint->aat[j].id != 'G') {
-					chaint->aat[j].cb[i] += movement[i];
-				}
-			}
-		}
-		ADenergyNoClash(currADEnergy, 1, chain->NAA-1,chain,chaint,&(sim_params->protein_model), 1);
-		currExtE = 0.0;
-		for (i = 1; i <= chain->NAA-1; i++){
-			currExtE += currADEnergy[i-1];
-			//fprintf(stderr,"%g !!!", currADEnergy[i-1]);
-		}
-		//fprintf(stderr,"transopt %g \n!!!", currExtE);
-		if (currExtE < extE) {
-		//find better energy
-			extE = currExtE;
-			//free(ADEnergy_Chaint);
-			for (i = 1; i <= chain->NAA-1; i++){
-				ADEnergy_Chaint[i-1] = currADEnergy[i-1];
-			}
-			noImprovStep = 0;
-			for (i = 0; i < 3; i++) movement[i] = 0.2 * rand()/RAND_MAX - 0.1;
-		} else {
-			
-		//redo the change and make the step smaller
-			for (i = 0; i < 3; i++) {
-				for (int j = 1; j < chain->NAA; j++) {
-					if (chaint->aat[j].etc & G__){
-						chaint->aat[j].g[i] -= movement[i];
-					}
-					if (chaint->aat[j].etc & G2_){
-						chaint->aat[j].g2[i] -= movement[i];
-					}
-					if (chaint->aat[j].id != 'P') {
-						chaint->aat[j].h[i] -= movement[i];
-					}
-					chaint->aat[j].n[i] -= movement[i];
-					chaint->aat[j].ca[i] -= movement[i];
-					chaint->aat[j].c[i] -= movement[i];
-					chaint->aat[j].o[i] -= movement[i];
-					if (chaint->aat[j].id != 'G') {
-						chaint->aat[j].cb[i] -= movement[i];
-					}
-				}
-				if (rand()%100 > 20)
-					movement[i] = -movement[i]/2;	
-			}
-			noImprovStep += 1;
-		}
+	int nbRes = chain->NAA - 1;
+	double X[6 * nbRes], Y[6 * nbRes], Z[6 * nbRes], charges[6 * nbRes];
+	int types[6 * nbRes];
+	Rigidpose pose = { 0, X, Y, Z, types, charges, { 0.0, 0.0, 0.0 }, 0.0 };
+	pose.n = ADbackbone_atoms(1, chain->NAA - 1, chain, NULL, X, Y, Z, types, charges, NULL);
+	for (i = 0; i < pose.n; i++) {
+		pose.center[0] += X[i] / pose.n;
+		pose.center[1] += Y[i] / pose.n;
+		pose.center[2] += Z[i] / pose.n;
+	}
+	for (i = 0; i < pose.n; i++) {
+		X[i] -= pose.center[0];
+		Y[i] -= pose.center[1];
+		Z[i] -= pose.center[2];
+		pose.radius += (X[i] * X[i] + Y[i] * Y[i] + Z[i] * Z[i]) / pose.n;
+	}
+	pose.radius = sqrt(pose.radius) + 1.0;
+
+	double x[6] = { 0.0, 0.0, 0.0, 0.0, 0.0, 0.0 }, g[6];
+	double startE = rigid_energy(&pose, x, g), bbE;
+	int steps = rigid_lbfgs(&pose, x, &bbE, mod == 1 ? 30 : 10);
+	if (bbE - startE > -0.00001) return 0;
+
+	/* apply the pose to all atoms and the amide frames */
+	matrix t;
+	vector w;
+	scale(w, 1.0 / pose.radius, x + 3);
+	rigid_rotmatrix(t, w);
+	trial_rigid(chain, chaint, t, pose.center, x);
 
-		//for (int i = 1; i <= chain->NAA -1; i++) {
-		//	fprintf(stderr, " %d", (chaint->aat + i)->SCRot);
-		//}
-		//fprintf(stderr," transopt %g %g %g %g %g %d!!!\n", currExtE, extE ,movement[0] ,movement[1], movement[2], noImprovStep);
+	double ADEnergy_Chaint[chain->NAA-1];
+	double extE = 0.0;
+	if (!ADenergyRigid(ADEnergy_Chaint, chain, chaint, &(sim_params->protein_model)))
+		ADenergyNoClash(ADEnergy_Chaint, 1, chain->NAA-1,chain,chaint,&(sim_params->protein_model), 1);
+	for (i = 1; i <= chain->NAA-1; i++){
+		extE += ADEnergy_Chaint[i-1];
 	}
-	if (extE - chain->Erg(0,0) > -0.00001) return 0;
-	//casttriplet(chain->xaa_prev[chain->aa[1].chainid], chaint->xaat_prev[chain->aa[1].chainid]);
-	//
-	//for (int i = 0; i <= chain->NAA - 1; i++) {
-	//	casttriplet(chain->xaa[i], chaint->xaat[i]);
-	//}
+	if (extE - ErgExternal(chain) > -0.00001) return 0;
 
-	//fprintf(stderr," transopt %g %g %g %g %g %d!!!\n", chain->Erg(0, 0), extE ,chaint->aat[1].c[0] - chain->aa[1].c[0], chaint->aat[1].c[1] - chain->aa[1].c[1], chaint->aat[1].c[2] - chain->aa[1].c[2], step);
-	chain->Erg(0, 0) = 0.0;
+	energy_matrix_external(chain, ADEnergy_Chaint);
 
-	for (int j = 1; j < chain->NAA; j++) {
-	    chain->Erg(0, j) = ADEnergy_Chaint[j - 1];
-	 	chain->Erg(0, 0) += chain->Erg(0, j);
-	}
-
-	//free(ADEnergy_Chaint);
-	//free(currADEnergy);
-	
 	for (int i = 1; i <= chain->NAA - 1; i++) {
 		chain->aa[i] = chaint->aat[i];
+		if (chain->sc && chaint->sct) sidechain_copy(chain->sc + i, chaint->sct + i);
 	}
-	//copybetween(chain, chaint);
-	return step;
+	for (j = 0; j < chain->NAA; j++)
+		casttriplet(chain->xaa[j], chaint->xaat[j]);
+	for (i = 0; i <= chain->Nchains; i++)
+		casttriplet(chain->xaa_prev[i], chaint->xaat_prev[i]);
+	return steps;
 	
 }
 
 
+double rigidbody_step[2] = RIGIDBODY_STEPS;
+
+/* Make a rigid body move: rotate the whole chain about the centroid of its CA atoms by up to
+   rigidbody_step[RIGIDBODY_ROTATE] about a random axis, or translate it by up to
+   rigidbody_step[RIGIDBODY_TRANSLATE] along each axis, the two at random. Only the external
+   energy is scored, and the step of the kind tried is adapted. */
+static int rigidbody(Chain *chain, Chaint *chaint, double *currE, simulation_params *sim_params)
+{
+	static long window[2];	/* accepted moves of the current window of each kind */
+	const double discrete = 2.0 / RAND_MAX;
+	const double largest[2] = RIGIDBODY_MAX;
+	double x[6] = { 0.0, 0.0, 0.0, 0.0, 0.0, 0.0 };
+	int i, kind, accepted;
+
+	for (i = 1; i < chain->NAA; i++)
+		if (chain->aa[i].etc & FIXED) return 0;
+	if (sim_params->protein_model.external_potential_type != 5)
+		return 0;
+
+	kind = rand() & 0x1 ? RIGIDBODY_TRANSLATE : RIGIDBODY_ROTATE;
+	if (kind == RIGIDBODY_ROTATE) {
+		matrix t;
+		vector a, center = { 0.0, 0.0, 0.0 };
+		for (i = 1; i < chain->NAA; i++)
+			add(center, center, chain->aa[i].ca);
+		scale(center, 1.0 / (chain->NAA - 1), center);
+		randvector(a);
+		rotmatrix(t, a, rigidbody_step[kind] * (discrete * rand() - 1.0));
+		trial_rigid(chain, chaint, t, center, x);
+	} else {
+		for (i = 0; i < 3; i++)
+			x[i] = rigidbody_step[kind] * (discrete * rand() - 1.0);
+		trial_translate(chain, chaint, x);
+	}
+	accepted = rigid_metropolis(chain, chaint, currE, sim_params, kind == RIGIDBODY_ROTATE);
+
+	rigidbody_tries[kind]++;
+	if (accepted) {
+		rigidbody_accepts[kind]++;
+		window[kind]++;
+	}
+	if (rigidbody_tries[kind] % RIGIDBODY_WINDOW == 0) {
+		double acceptance = (double) window[kind] / RIGIDBODY_WINDOW;
+		double target = sim_params->protein_model.rigid_body_accept[kind];
+		if (acceptance < target - RIGIDBODY_TOLERANCE)
+			rigidbody_step[kind] *= RIGIDBODY_FACTOR;
+		else if (acceptance > target + RIGIDBODY_TOLERANCE)
+			rigidbody_step[kind] /= RIGIDBODY_FACTOR;
+		if (rigidbody_step[kind] > largest[kind])
+			rigidbody_step[kind] = largest[kind];
+		window[kind] = 0;
+	}
+	return accepted;
+}
+
+
 /* Make a crankshaft move.  This is a local move that involves
    the crankshaft rotation of up to 4 peptde bonds.  Propose a
    move, and apply the Metropolis criteria. */
@@ -707,44 +839,8 @@ static int crankshaft(Chain * chain, Chaint *chaint, Biasmap *biasmap, double am
 	vector a;
 	matrix t;
 	const double discrete = 2.0 / RAND_MAX;
-    
-	//if(sim_params->NS){ 
-	for (int i = 1; i < chain->NAA; i++){
-		chaint->aat[i].etc = chain->aa[i].etc;
-		chaint->aat[i].num = chain->aa[i].num;
-		chaint->aat[i].id = chain->aa[i].id;
-		chaint->aat[i].chainid = chain->aa[i].chainid;
-		chaint->aat[i].SCRot = chain->aa[i].SCRot;
-	}
-	//}
-
-    
-   
-	/* setup sidechain dihedral angles */
-	/* They change with P = 1/4 (unless fixed) */
-	if ((sim_params->protein_model).use_gamma_atoms != NO_GAMMA) {
-	    if (!(sim_params->protein_model).fix_chi_angles && rand()/(double)RAND_MAX < 0.25) { /* change chi angles */
-		for (int i = 1; i < chain->NAA; i++){ 
-		    //fprintf(stderr,"chi angles of amino acid %d",i);
-		    //fprintf(stderr," %c",chain->aa[i].id);
-		    //fprintf(stderr," %g",chain->aa[i].chi1); //would fail for G,A
-		    //fprintf(stderr," %g\n",chain->aa[i].chi2); //would fail for all but V,I,T
-		    if(chain->aa[i].id != 'G' && chain->aa[i].id != 'A' && chain->aa[i].chi1 != DBL_MAX) {
-			chaint->aat[i].chi1 = sidechain_dihedral(chain->aa[i].id, sim_params->protein_model.sidechain_properties);//aa[i].chi1;
-		    }
-		    if((chain->aa[i].id == 'V' || chain->aa[i].id == 'I' || chain->aa[i].id == 'T') && chain->aa[i].chi2 != DBL_MAX) {
-			chaint->aat[i].chi2 = sidechain_dihedral2(chain->aa[i].id,chaint->aat[i].chi1, sim_params->protein_model.sidechain_properties);//aa[i].chi2;
-		    }
-		}
-	    } else {
-		for (int i = 1; i < chain->NAA; i++){
-			//TODO: we might need this here: if(chain->aa[i].id != 'G' && chain->aa[i].id != 'A') {
-			    chaint->aat[i].chi1 = chain->aa[i].chi1;
-			    chaint->aat[i].chi2 = chain->aa[i].chi2;
-			//}
-		} 
-	    }
-	}
+	/* sidechain dihedral angles change with P = 1/4 (unless fixed) */
+	int newchi = trial_newchi(sim_params);
 
 	// Calculate the look-up table of allowed MC moves on the 1st call.
 	// This will avoid moves involving residues on more than 1 chain
@@ -907,7 +1003,7 @@ static int crankshaft(Chain * chain, Chaint *chaint, Biasmap *biasmap, double am
 	}
 	int swappp = 0;
 	//for cyclic peptide Gary Hack
-	while (sim_params->protein_model.external_potential_type2 == 4 && (start == 0 || end == chain->NAA) && ((toss%50) > chain->Erg(1, 0))) {
+	while (sim_params->protein_model.external_potential_type2 == 4 && (start == 0 || end == chain->NAA) && ((toss%50) > ErgCyclic(chain))) {
 		toss = rand();
 		len = toss & 0x3;	/* segment length minus one */
 		if (len > chain->NAA - 2)
@@ -926,7 +1022,7 @@ static int crankshaft(Chain * chain, Chaint *chaint, Biasmap *biasmap, double am
 	//if (swappp == 1) fprintf(stderr, "s %d e %d \n", start, end);
 	//fprintf(stderr, "s2 %d e %d\n", start, end);
 
-	if (chain->Erg(0,0)>1000)
+	if (ErgExternal(chain)>1000)
 		ampl = 2 * ampl;
 
 	/* pivot or crankshaft */
@@ -966,6 +1062,9 @@ static int crankshaft(Chain * chain, Chaint *chaint, Biasmap *biasmap, double am
 	}
 
 	
+	/* the residues the move rebuilds, start and end as the pivots below leave them */
+	trial_refresh(chain, chaint, start + pivot_around_end, end - pivot_around_start, newchi, sim_params);
+
 	/* setup fixed ends for crankshaft or pivot */
 	if (pivot_around_end != 1) { // there is a fixed start site
 		casttriplet(chaint->xaat[start], chain->xaa[start]); //TODO: use start - 1 ??
@@ -1091,6 +1190,7 @@ static int crankshaft(Chain * chain, Chaint *chaint, Biasmap *biasmap, double am
 	//fprintf(stderr,"committing amino acid aa %d - %d\n",start,end);
 	for (int i = start; i <= end; i++) {
 		chain->aa[i] = chaint->aat[i];
+		if (chain->sc && chaint->sct) sidechain_copy(chain->sc + i, chaint->sct + i);
 	}
 
 	return 1;
@@ -1113,6 +1213,7 @@ int flipChain(Chain * chain, Chaint *chaint, Biasmap *biasmap, double ampl, doub
 		chaint->aat[i].id = chain->aa[i].id;
 		chaint->aat[i].chainid = chain->aa[i].chainid;
 		chaint->aat[i].SCRot = chain->aa[i].SCRot;
+		chaint->aat[i].SCTrial = chain->aa[i].SCTrial;
 	}
 	//}
     
@@ -1183,13 +1284,13 @@ int flipChain(Chain * chain, Chaint *chaint, Biasmap *biasmap, double ampl, doub
 	}
 
 
-	//fprintf(stderr, "before flip %g \n", chain->Erg(0,0));
+	//fprintf(stderr, "before flip %g \n", ErgExternal(chain));
 	//double eK = sim_params->protein_model.external_k[0];
 	//sim_params->protein_model.external_k[0] = 0.0000001;
     /* testing if move is allowed */
 	//if (!allowed(chain,chaint,biasmap,start, end, logLstar,currE, sim_params))
 	//	return 0;	/* disregard rejected changes */
-	//fprintf(stderr, "after flip %g \n", chain->Erg(0,0));
+	//fprintf(stderr, "after flip %g \n", ErgExternal(chain));
 	//sim_params->protein_model.external_k[0] = eK;
 
 
@@ -1199,12 +1300,7 @@ int flipChain(Chain * chain, Chaint *chaint, Biasmap *biasmap, double ampl, doub
 
 	
 
-	chain->Erg(0, 0) = 0.0;
-
-	for (int j = 1; j < chain->NAA; j++) {
-		chain->Erg(0, j) = ADEnergy_Chaint[j - 1];
-	    chain->Erg(0, 0) += chain->Erg(0, j);
-	}
+	energy_matrix_external(chain, ADEnergy_Chaint);
 
 
 	/* commit accepted changes */
@@ -1224,6 +1320,7 @@ int flipChain(Chain * chain, Chaint *chaint, Biasmap *biasmap, double ampl, doub
 	//fprintf(stderr,"committing amino acid aa %d - %d\n",start,end);
 	for (int i = start; i <= end; i++) {
 		chain->aa[i] = chaint->aat[i];
+		if (chain->sc && chaint->sct) sidechain_copy(chain->sc + i, chaint->sct + i);
 	}
 	tests(chain, biasmap, sim_params->tmask, sim_params, 0x11, NULL);
 	return 1;
@@ -1240,58 +1337,8 @@ static int crankshaftcyclic(Chain * chain, Chaint *chaint, Biasmap *biasmap, dou
 	vector a;
 	matrix t;
 	const double discrete = 2.0 / RAND_MAX;
-    
-	//if(sim_params->NS){ 
-	for (int j = 1; j < chain->NAA; j++){
-		chaint->aat[j].etc = chain->aa[j].etc;
-		chaint->aat[j].num = chain->aa[j].num;
-		chaint->aat[j].id = chain->aa[j].id;
-		chaint->aat[j].chainid = chain->aa[j].chainid;
-		chaint->aat[j].SCRot = chain->aa[j].SCRot;
-		for(int i = 0; i < 3; i++){
-			chaint->aat[j].h[i] = chain->aa[j].h[i];	
-			chaint->aat[j].n[i] =  chain->aa[j].n[i];		
-			chaint->aat[j].ca[i] = chain->aa[j].ca[i];		
-			chaint->aat[j].c[i] = chain->aa[j].c[i];		
-			chaint->aat[j].o[i] = chain->aa[j].o[i];
-			chaint->aat[j].cb[i] = chain->aa[j].cb[i];
-			chaint->aat[j].g[i] = chain->aa[j].g[i];
-			chaint->aat[j].g2[i] = chain->aa[j].g2[i];
-			chaint->xaat[j][i][0] = chain->xaa[j][i][0];
-			chaint->xaat[j][i][1] = chain->xaa[j][i][1];
-			chaint->xaat[j][i][2] = chain->xaa[j][i][2];
-		}
-		//chaint->aat[j] = chain->aa[j];
-	}
-	//}
-
-    
-   
-	/* setup sidechain dihedral angles */
-	/* They change with P = 1/4 (unless fixed) */
-	if ((sim_params->protein_model).use_gamma_atoms != NO_GAMMA) {
-	    if (!(sim_params->protein_model).fix_chi_angles && rand()/(double)RAND_MAX < 0.25) { /* change chi angles */
-		for (int i = 1; i < chain->NAA; i++){ 
-		    //fprintf(stderr,"chi angles of amino acid %d",i);
-		    //fprintf(stderr," %c",chain->aa[i].id);
-		    //fprintf(stderr," %g",chain->aa[i].chi1); //would fail for G,A
-		    //fprintf(stderr," %g\n",chain->aa[i].chi2); //would fail for all but V,I,T
-		    if(chain->aa[i].id != 'G' && chain->aa[i].id != 'A' && chain->aa[i].chi1 != DBL_MAX) {
-			chaint->aat[i].chi1 = sidechain_dihedral(chain->aa[i].id, sim_params->protein_model.sidechain_properties);//aa[i].chi1;
-		    }
-		    if((chain->aa[i].id == 'V' || chain->aa[i].id == 'I' || chain->aa[i].id == 'T') && chain->aa[i].chi2 != DBL_MAX) {
-			chaint->aat[i].chi2 = sidechain_dihedral2(chain->aa[i].id,chaint->aat[i].chi1, sim_params->protein_model.sidechain_properties);//aa[i].chi2;
-		    }
-		}
-	    } else {
-		for (int i = 1; i < chain->NAA; i++){
-			//TODO: we might need this here: if(chain->aa[i].id != 'G' && chain->aa[i].id != 'A') {
-			    chaint->aat[i].chi1 = chain->aa[i].chi1;
-			    chaint->aat[i].chi2 = chain->aa[i].chi2;
-			//}
-		} 
-	    }
-	}
+	/* sidechain dihedral angles change with P = 1/4 (unless fixed) */
+	int newchi = trial_newchi(sim_params);
 
 	toss = rand();
 	/* segment length */
@@ -1305,6 +1352,8 @@ static int crankshaftcyclic(Chain * chain, Chaint *chaint, Biasmap *biasmap, dou
 	end = (start + len + 1) ;
 		
 
+	trial_refresh(chain, chaint, start, end, newchi, sim_params);
+
 	//fprintf(stderr,"committing amino acid xaa %d - %d %d\n",start,end,len);
 
 	/* setup fixed ends for crankshaft or pivot */	
@@ -1361,6 +1410,7 @@ static int crankshaftcyclic(Chain * chain, Chaint *chaint, Biasmap *biasmap, dou
 	//fprintf(stderr,"committing amino acid aa %d - %d\n",start,end);
 	for (int i = start; i <= end; i++) {
 		chain->aa[reModNum(i , chain->NAA-1)] = chaint->aat[reModNum(i , chain->NAA-1)];
+		if (chain->sc && chaint->sct) sidechain_copy(chain->sc + reModNum(i , chain->NAA-1), chaint->sct + reModNum(i , chain->NAA-1));
 	}
 	return 1;
 }
@@ -1373,15 +1423,7 @@ int rotate_cyclic(Chain * chain, Chaint *chaint, Biasmap *biasmap, double ampl,
 	vector a;
 	matrix t;
 	const double discrete = 2.0 / RAND_MAX;    
-	//if(sim_params->NS){ 
-	for (int i = 1; i < chain->NAA; i++){
-		chaint->aat[i].etc = chain->aa[i].etc;
-		chaint->aat[i].num = chain->aa[i].num;
-		chaint->aat[i].id = chain->aa[i].id;
-		chaint->aat[i].chainid = chain->aa[i].chainid;
-		chaint->aat[i].SCRot = chain->aa[i].SCRot;
-	}
-	//}
+	trial_refresh(chain, chaint, 1, chain->NAA - 1, 0, sim_params);
     
 
 //TODO multi-chain protein
@@ -1471,13 +1513,13 @@ int rotate_cyclic(Chain * chain, Chaint *chaint, Biasmap *biasmap, double ampl,
 	}
 
 
-	//fprintf(stderr, "before rotate %g \n", chain->Erg(0,0));
+	//fprintf(stderr, "before rotate %g \n", ErgExternal(chain));
 	double eK = sim_params->protein_model.external_k[0];
 	sim_params->protein_model.external_k[0] = 0.01;
     /* testing if move is allowed */
 	if (!allowed(chain,chaint,biasmap,start, end, logLstar,currE, sim_params))
 		return 0;	/* disregard rejected changes */
-	fprintf(stderr, "after rotate %g \n", chain->Erg(0,0));
+	fprintf(stderr, "after rotate %g \n", ErgExternal(chain));
 	sim_params->protein_model.external_k[0] = eK;
 
 	tests(chain, biasmap, sim_params->tmask, sim_params, 0x11, NULL);
@@ -1487,11 +1529,11 @@ int rotate_cyclic(Chain * chain, Chaint *chaint, Biasmap *biasmap, double ampl,
 
 	
 
-	//chain->Erg(0, 0) = 0.0;
+	//ErgExternal(chain) = 0.0;
 	//
 	//for (int j = 1; j < chain->NAA; j++) {
 	//	chain->Erg(0, j) = ADEnergy_Chaint[j - 1];
-	//    chain->Erg(0, 0) += chain->Erg(0, j);
+	//    ErgExternal(chain) += chain->Erg(0, j);
 	//}
 
 
@@ -1508,6 +1550,7 @@ int rotate_cyclic(Chain * chain, Chaint *chaint, Biasmap *biasmap, double ampl,
 	fprintf(stderr,"committing rotating amino acid aa %d - %d\n",start,end);
 	for (int i = start; i <= end; i++) {
 		chain->aa[i] = chaint->aat[i];
+		if (chain->sc && chaint->sct) sidechain_copy(chain->sc + i, chaint->sct + i);
 	}
 	tests(chain, biasmap, sim_params->tmask, sim_params, 0x11, NULL);
 	return 1;
@@ -1529,6 +1572,7 @@ static int crankshaft_adk(Chain * chain, Chaint *chaint, Biasmap *biasmap, doubl
 		chaint->aat[i].id = chain->aa[i].id;
 		chaint->aat[i].chainid = chain->aa[i].chainid;
 		chaint->aat[i].SCRot = chain->aa[i].SCRot;
+		chaint->aat[i].SCTrial = chain->aa[i].SCTrial;
 	}
 	//}
 
@@ -1772,6 +1816,7 @@ static int crankshaft_adk(Chain * chain, Chaint *chaint, Biasmap *biasmap, doubl
 	//fprintf(stderr,"committing amino acid aa %d - %d\n",start,end);
 	for (int i = start; i <= end; i++) {
 		chain->aa[i] = chaint->aat[i];
+		if (chain->sc && chaint->sct) sidechain_copy(chain->sc + i, chaint->sct + i);
 	}
 
 	return 1;
@@ -1795,7 +1840,14 @@ int move(Chain *chain,Chaint *chaint, Biasmap *biasmap, double logLstar, double
 	static int transaccept = 0, reject = 0;    
 	int moved = 0;
 	if (changeamp == -1) { sim_params->accept_counter = 0; sim_params->reject_counter = 0; transaccept = 0; }
-	if (sim_params->protein_model.external_potential_type2 == 4 && chain->Erg(1,0)<0.1) {
+	if (sim_params->protein_model.rigid_body > 0.0 && rand() < sim_params->protein_model.rigid_body * RAND_MAX) {
+		if (rigidbody(chain, chaint, currE, sim_params)) {
+			sim_params->accept_counter++;
+			moved = 1;
+		}
+		else sim_params->reject_counter++;
+	}
+	else if (sim_params->protein_model.external_potential_type2 == 4 && ErgCyclic(chain)<0.1) {
 		if (crankshaftcyclic(chain,chaint,biasmap,sim_params->amplitude,logLstar,currE, sim_params)){
 			sim_params->accept_counter++; 
 			moved = 1;
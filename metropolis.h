@@ -12,5 +12,17 @@ void transmutate(Chain * chain, Chaint *chaint, Biasmap *biasmap, double ampl, d
 int flipChain(Chain * chain, Chaint *chaint, Biasmap *biasmap, double ampl, double logLstar, double * currE, simulation_params *sim_params);
 int rotate_cyclic(Chain * chain, Chaint *chaint, Biasmap *biasmap, double ampl, double logLstar, double * currE, simulation_params *sim_params);
 int transopt(Chain * chain, Chaint *chaint, Biasmap *biasmap, double ampl, double logLstar, double * currE, simulation_params *sim_params, int mod);
+/* rigid body moves (RigidBody=): rotations of the whole chain about its centroid and translations,
+   each with its step (rad, A) adapted every RIGIDBODY_WINDOW moves of its kind towards its target
+   acceptance rate, as the amplitude of the crankshaft moves is, and bounded by RIGIDBODY_MAX */
+#define RIGIDBODY_ROTATE 0
+#define RIGIDBODY_TRANSLATE 1
+#define RIGIDBODY_STEPS { 0.1, 0.5 }
+#define RIGIDBODY_MAX { M_PI, 4.0 }
+#define RIGIDBODY_WINDOW 100
+#define RIGIDBODY_TOLERANCE 0.03
+#define RIGIDBODY_FACTOR 0.9
+long rigidbody_tries[2], rigidbody_accepts[2];
+double rigidbody_step[2];
 int move(Chain *chain, Chaint *chaint, Biasmap *biasmap,double logLstar, double *currE,int changeamp, simulation_params *sim_params);
 void finalize(Chain *chain, Chaint *chaint, Biasmap *biasmap);
@@ -92,11 +92,11 @@ void new_amplitude(Chain **cpoints, Biasmap *biasmap, int current_stored, simula
   double oldamp = sim_params->amplitude;
   Chaint *chaint;
   chaint = (Chaint*)malloc(sizeof(Chaint));
-  chaint->aat = NULL; chaint->ergt = NULL;  chaint->xaat = NULL; chaint->xaat_prev = NULL;
+  chaint->aat = NULL; chaint->ergt = NULL;  chaint->xaat = NULL; chaint->xaat_prev = NULL; chaint->sct = NULL;
   double currE;
   int copies;
   Chain temporary;
-  temporary.aa = NULL; temporary.xaa = NULL; temporary.erg = NULL; temporary.xaa_prev = NULL;
+  temporary.aa = NULL; temporary.xaa = NULL; temporary.erg = NULL; temporary.xaa_prev = NULL; temporary.sc = NULL;
   allocmem_chain(&temporary,(*cpoints)[0].NAA,(*cpoints)[0].Nchains);
 
   //calculate amplitude
@@ -832,7 +832,7 @@ void output_NS_point(ChainHash *chainhash, Chain *cpoints, Biasmap *biasmap, sim
 	Chain temporary; //if the chain needs collecting from another processor
 
 	if (rank == 0) {
-	  temporary.aa = NULL; temporary.xaa = NULL; temporary.erg = NULL; temporary.xaa_prev = NULL;
+	  temporary.aa = NULL; temporary.xaa = NULL; temporary.erg = NULL; temporary.xaa_prev = NULL; temporary.sc = NULL;
 	  allocmem_chain(&temporary,cpoints[0].NAA,cpoints[0].Nchains);
 	  //We need to update AA.id and AA.num, because those are not sent through MPI.
 	  for (int i=0; i< sim_params->NAA; i++) {
@@ -897,14 +897,14 @@ void nestedsampling(int thinning, int maxiter, simulation_params *sim_params){
   //NS points and their chaint-s
   Chain* cpoints = NULL;
   Chaint *chaint= (Chaint*)malloc(sizeof(Chaint));
-  chaint->aat = NULL; chaint->ergt = NULL;  chaint->xaat = NULL; chaint->xaat_prev = NULL;
+  chaint->aat = NULL; chaint->ergt = NULL;  chaint->xaat = NULL; chaint->xaat_prev = NULL; chaint->sct = NULL;
   //biasmap
   Biasmap *biasmap = (Biasmap*)malloc(sizeof(Biasmap));
   biasmap->distb = NULL;
   //temporary chain for reading in
   Chain* temporary = NULL;
   temporary = (Chain *)malloc(sizeof(Chain));
-  temporary->aa = NULL; temporary->xaa = NULL; temporary->erg = NULL; temporary->xaa_prev = NULL;
+  temporary->aa = NULL; temporary->xaa = NULL; temporary->erg = NULL; temporary->xaa_prev = NULL; temporary->sc = NULL;
   //number of chains
   int N = 0;
   //number of chains stored on this processor
@@ -1106,7 +1106,7 @@ void nestedsampling(int thinning, int maxiter, simulation_params *sim_params){
 #endif
   chaincopies = (Chain*)malloc(sizeof(Chain)*size_of_chaincopies);
   for(int i = 0; i < size_of_chaincopies; i++){
-    chaincopies[i].aa = NULL; chaincopies[i].erg = NULL;
+    chaincopies[i].aa = NULL; chaincopies[i].erg = NULL; chaincopies[i].sc = NULL;
     chaincopies[i].NAA = temporary->NAA; chaincopies[i].Nchains = temporary->Nchains;
     chaincopies[i].xaa = NULL; chaincopies[i].xaa_prev = NULL;
     allocmem_chain(&chaincopies[i],chaincopies[i].NAA,chaincopies[i].Nchains);
@@ -0,0 +1,464 @@
+/*
+** Global side chain packing: the rotamers of the moved residues are chosen
+** together, over a table of the clashes between the rotamers of neighbouring
+** residues, by dead-end elimination and a bounded depth-first search instead
+** of one residue after the other.
+**
+** Copyright (c) Yuqi Zhang, Michel Sanner, CCSB Scripps
+*/
+
+#include<stdlib.h>
+#include<stdio.h>
+#include<string.h>
+#include<math.h>
+#include<float.h>
+
+#include"canonicalAA.h"
+#include"error.h"
+#include"params.h"
+#include"vector.h"
+#include"rotation.h"
+#include"aadict.h"
+#include"peptide.h"
+#include"vdw.h"
+#include"energy.h"
+
+#define PACK_CLASH 6.5		/* penalty of a side chain atom clashing, as in scoreSideChainNoClash */
+#define PACK_EPS 1e-9
+#define PACK_SINGLES 4		/* states whose worst energy bounds the singles elimination */
+
+/* the states of one residue: numRand trials of the frame times the rotamers */
+typedef struct _Packres {
+	AA *a;
+	int nbRot, nbAtoms, nbStates;
+	const int *atypes;
+	float (*tc)[3];		/* nbStates * nbAtoms transformed atoms */
+	double (*centers)[2][3];	/* per state, the g and g2 it would give the residue */
+	int centerFlags[2];	/* g, g2 are atoms of the residue (G__, G2_) */
+	unsigned char *fixedClash;	/* per state and atom, a heavy atom clashing with the fixed atoms */
+	double *grid;		/* per state, the grid energy of its atoms */
+	double *single;		/* per state, grid energy plus the clashes with the fixed atoms */
+	char *alive;		/* per state, not eliminated */
+	double *atomReach;	/* per state, farthest heavy atom from CA not clashing with the fixed atoms, -1 if none */
+	double reach;		/* farthest atom or center from CA over the states */
+} Packres;
+
+typedef struct _Pack {
+	int n;
+	Packres *res;
+	double **pair;		/* n*n, [i*n+j] for neighbours i < j: clashes of state si of i with state sj of j */
+	int *order;		/* residues in the order of the search */
+	int *state, *bestState;
+	double best, *minSingle;
+	long nodes;
+	int exact;
+} Pack;
+
+/* the rotamer library of a residue type; NULL for the types that are not packed (G, A, P, and C unless RotCys=1) */
+const Rotlib *sidechain_library(char id)
+{
+	const Rotlib *lib = rotlib(id);
+	return lib && lib->mode == ROTLIB_NOCLASH ? lib : NULL;
+}
+
+static double dist2(const double *p, const float *q)
+{
+	return (p[0] - q[0]) * (p[0] - q[0]) + (p[1] - q[1]) * (p[1] - q[1]) + (p[2] - q[2]) * (p[2] - q[2]);
+}
+
+/* the centers of two residues are within the clash distance of an atom of the other only if their
+   CA are closer than this */
+static int pack_neighbours(const Packres *r, const Packres *q)
+{
+	double d = r->reach + q->reach + 2.2;
+	return (r->a->ca[0] - q->a->ca[0]) * (r->a->ca[0] - q->a->ca[0]) + (r->a->ca[1] - q->a->ca[1]) * (r->a->ca[1] - q->a->ca[1])
+		+ (r->a->ca[2] - q->a->ca[2]) * (r->a->ca[2] - q->a->ca[2]) < d * d;
+}
+
+/* the atoms of residue r in its states, their grid energies and their clashes with the fixed atoms,
+   which for r are also the CB of the other packed residues */
+static void pack_states(Packres *r, AA *a, int nbRes, AA **res, const Clashgrid *fixed, int numRand)
+{
+	const Rotlib *lib = sidechain_library(a->id);
+	const int nbRot = lib->nbRot, nbAtoms = lib->nbAtoms;
+	const Rotlib_scratch *scratch = rotlib_scratch(ROTLIB_SCRATCH_PACK);
+	double *X = scratch->x, *Y = scratch->y, *Z = scratch->z, *energy = scratch->energies;
+	int i, j, k, t;
+	float N[3] = { a->n[0], a->n[1], a->n[2] };
+	float CA[3] = { a->ca[0], a->ca[1], a->ca[2] };
+	float CB[3] = { a->cb[0], a->cb[1], a->cb[2] };
+	float mat[3][4];
+
+	r->a = a;
+	r->atypes = lib->atypes;
+	r->nbRot = nbRot;
+	r->nbAtoms = nbAtoms;
+	r->nbStates = numRand * nbRot;
+	r->tc = malloc(r->nbStates * nbAtoms * sizeof(*r->tc));
+	r->centers = malloc(r->nbStates * sizeof(*r->centers));
+	r->fixedClash = malloc(r->nbStates * nbAtoms);
+	r->grid = malloc(r->nbStates * sizeof(double));
+	r->single = malloc(r->nbStates * sizeof(double));
+	r->alive = malloc(r->nbStates);
+	r->atomReach = malloc(r->nbStates * sizeof(double));
+	if (!r->tc || !r->centers || !r->fixedClash || !r->grid || !r->single || !r->alive || !r->atomReach)
+		stop("Unable to allocate the side chain packer.");
+	r->centerFlags[0] = (a->etc & G__) != 0;
+	r->centerFlags[1] = (a->etc & G2_) != 0;
+	r->reach = 0.0;
+
+	/* the trials move N as in scoreSideChainNoClash */
+	for (t = 0; t < numRand; t++) {
+		rotlib_jitter(a, t, N);
+		sidechain_frame(N, CA, CB, mat);
+		/* all rotamers in the frame, and their grid energies in one batch */
+		rotlib_transform(lib, mat, X, Y, Z);
+		gridenergy_batch(nbRot * nbAtoms, X, Y, Z, lib->types, lib->batchCharges, energy);
+		for (i = 0; i < nbRot; i++) {
+			int s = t * nbRot + i;
+			float (*tc)[3] = r->tc + s * nbAtoms;
+			double grid = 0.0, clash = 0.0;
+			r->atomReach[s] = -1.0;
+			for (j = 0; j < nbAtoms; j++) {
+				const int at = i * nbAtoms + j;
+				tc[j][0] = X[at];
+				tc[j][1] = Y[at];
+				tc[j][2] = Z[at];
+				grid += energy[at];
+				r->fixedClash[s * nbAtoms + j] = r->atypes[j] != 3 && checkClash(tc[j][0], tc[j][1], tc[j][2], fixed);
+				for (k = 0; k < nbRes && r->atypes[j] != 3 && !r->fixedClash[s * nbAtoms + j]; k++)
+					if (res[k] != a && dist2(res[k]->cb, tc[j]) < CLASH_DISTANCE2) r->fixedClash[s * nbAtoms + j] = 1;
+				if (r->fixedClash[s * nbAtoms + j]) clash += PACK_CLASH;
+				else if (r->atypes[j] != 3) r->atomReach[s] = fmax(r->atomReach[s], sqrt(dist2(a->ca, tc[j])));
+				r->reach = fmax(r->reach, sqrt(dist2(a->ca, tc[j])));
+			}
+			for (k = 0; k < 3; k++) {
+				r->centers[s][0][k] = a->g[k];
+				r->centers[s][1][k] = a->g2[k];
+			}
+			sidechain_centers(a->id, X + i * nbAtoms, Y + i * nbAtoms, Z + i * nbAtoms, r->centers[s][0], r->centers[s][1]);
+			r->grid[s] = grid;
+			r->single[s] = grid + clash;
+			r->alive[s] = 1;
+		}
+	}
+}
+
+/* heavy atoms of state s of r, not clashing with the fixed atoms already, within the clash distance of the centers c */
+static int pack_clashes(const Packres *r, int s, const double c[2][3], const int flags[2])
+{
+	const float (*tc)[3] = (const float (*)[3]) r->tc + s * r->nbAtoms;
+	int j, k, n = 0;
+
+	for (j = 0; j < r->nbAtoms; j++) {
+		if (r->atypes[j] == 3 || r->fixedClash[s * r->nbAtoms + j]) continue;
+		for (k = 0; k < 2; k++)
+			if (flags[k] && dist2(c[k], tc[j]) < CLASH_DISTANCE2) {
+				n++;
+				break;
+			}
+	}
+	return n;
+}
+
+static double pack_pair(const Pack *P, int i, int si, int j, int sj)
+{
+	if (i < j) return P->pair[i * P->n + j] ? P->pair[i * P->n + j][si * P->res[j].nbStates + sj] : 0.0;
+	return P->pair[j * P->n + i] ? P->pair[j * P->n + i][sj * P->res[i].nbStates + si] : 0.0;
+}
+
+/* the smallest distance of the centers of state s of r from the point p, DBL_MAX if r has none */
+static double pack_center_dist(const Packres *r, int s, const double p[3])
+{
+	double d = DBL_MAX;
+	for (int c = 0; c < 2; c++) {
+		const double *g = r->centers[s][c];
+		if (r->centerFlags[c])
+			d = fmin(d, sqrt((g[0] - p[0]) * (g[0] - p[0]) + (g[1] - p[1]) * (g[1] - p[1]) + (g[2] - p[2]) * (g[2] - p[2])));
+	}
+	return d;
+}
+
+/* the clashes of state s of r and state u of q */
+static int pack_pair_clashes(const Packres *r, int s, const Packres *q, int u)
+{
+	int n = 0;
+	if (pack_center_dist(q, u, r->a->ca) < r->atomReach[s] + 2.2)
+		n += pack_clashes(r, s, q->centers[u], q->centerFlags);
+	if (pack_center_dist(r, s, q->a->ca) < q->atomReach[u] + 2.2)
+		n += pack_clashes(q, u, r->centers[s], r->centerFlags);
+	return n;
+}
+
+/* a state whose single energy alone is above the worst energy of another one, that one's single
+   energy plus the most it can clash with each neighbour, cannot be chosen: the clash penalties are
+   positive. the worst energies of the PACK_SINGLES states of lowest single energy are worked out */
+static void pack_eliminate_singles(Pack *P)
+{
+	for (int i = 0; i < P->n; i++) {
+		Packres *r = P->res + i;
+		int lowest[PACK_SINGLES], nbLowest = 0, k;
+		double best = DBL_MAX;
+		for (int s = 0; s < r->nbStates; s++) {
+			if (nbLowest < PACK_SINGLES) k = nbLowest++;
+			else if (r->single[s] < r->single[lowest[PACK_SINGLES - 1]]) k = PACK_SINGLES - 1;
+			else continue;
+			for (; k > 0 && r->single[lowest[k - 1]] > r->single[s]; k--) lowest[k] = lowest[k - 1];
+			lowest[k] = s;
+		}
+		for (k = 0; k < nbLowest; k++) {
+			int t = lowest[k];
+			double worst = r->single[t];
+			for (int j = 0; j < P->n && worst < best; j++) {
+				Packres *q = P->res + j;
+				int most = 0;
+				if (j == i || !pack_neighbours(r, q)) continue;
+				for (int u = 0; u < q->nbStates; u++) {
+					int n = pack_pair_clashes(r, t, q, u);
+					if (n > most) most = n;
+				}
+				worst += PACK_CLASH * most;
+			}
+			best = fmin(best, worst);
+		}
+		for (int s = 0; s < r->nbStates; s++)
+			if (r->single[s] > best + PACK_EPS) r->alive[s] = 0;
+	}
+}
+
+/* the clashes of the live states of neighbouring residues */
+static void pack_pairs(Pack *P)
+{
+	for (int i = 0; i < P->n; i++)
+		for (int j = i + 1; j < P->n; j++) {
+			Packres *r = P->res + i, *q = P->res + j;
+			P->pair[i * P->n + j] = NULL;
+			if (!pack_neighbours(r, q)) continue;
+			double *table = calloc(r->nbStates * q->nbStates, sizeof(double));
+			if (!table) stop("Unable to allocate the side chain packer.");
+			int nonzero = 0;
+			for (int si = 0; si < r->nbStates; si++) {
+				if (!r->alive[si]) continue;
+				for (int sj = 0; sj < q->nbStates; sj++) {
+					if (!q->alive[sj]) continue;
+					int n = pack_pair_clashes(r, si, q, sj);
+					table[si * q->nbStates + sj] = PACK_CLASH * n;
+					nonzero |= n;
+				}
+			}
+			if (nonzero) P->pair[i * P->n + j] = table;
+			else free(table);
+		}
+}
+
+/* Goldstein's criterion: state s of i is dead if some state t of i is better in every context,
+   single(s) - single(t) + sum over j of min over u of pair(s, u) - pair(t, u) > 0. each term lies
+   between -maxPair(t) and maxPair(s), the largest clashes of a state with j, which settle most
+   pairs s, t without the sum */
+static void pack_eliminate_goldstein(Pack *P)
+{
+	int changed = 1;
+
+	while (changed) {
+		changed = 0;
+		for (int i = 0; i < P->n; i++) {
+			Packres *r = P->res + i;
+			double maxPair[r->nbStates];
+			for (int s = 0; s < r->nbStates; s++) {
+				maxPair[s] = 0.0;
+				if (!r->alive[s]) continue;
+				for (int j = 0; j < P->n; j++) {
+					if (j == i || !P->pair[i < j ? i * P->n + j : j * P->n + i]) continue;
+					double most = 0.0;
+					for (int u = 0; u < P->res[j].nbStates; u++)
+						if (P->res[j].alive[u]) most = fmax(most, pack_pair(P, i, s, j, u));
+					maxPair[s] += most;
+				}
+			}
+			for (int s = 0; s < r->nbStates; s++) {
+				if (!r->alive[s]) continue;
+				for (int t = 0; t < r->nbStates && r->alive[s]; t++) {
+					if (t == s || !r->alive[t]) continue;
+					double gap = r->single[s] - r->single[t];
+					if (gap + maxPair[s] <= PACK_EPS) continue;
+					if (gap - maxPair[t] <= PACK_EPS) {
+						for (int j = 0; j < P->n; j++) {
+							if (j == i || !P->pair[i < j ? i * P->n + j : j * P->n + i]) continue;
+							Packres *q = P->res + j;
+							double least = DBL_MAX;
+							for (int u = 0; u < q->nbStates; u++)
+								if (q->alive[u]) least = fmin(least, pack_pair(P, i, s, j, u) - pack_pair(P, i, t, j, u));
+							gap += least;
+						}
+					}
+					if (gap > PACK_EPS) {
+						r->alive[s] = 0;
+						changed = 1;
+					}
+				}
+			}
+		}
+	}
+}
+
+/* energy of P->state, or of residue i in state s against the others of P->state */
+static double pack_energy_of(const Pack *P, int i, int s)
+{
+	double e = P->res[i].single[s];
+	for (int j = 0; j < P->n; j++)
+		if (j != i) e += pack_pair(P, i, s, j, P->state[j]);
+	return e;
+}
+
+/* iterated conditional modes from the best single states, the first solution of the search */
+static void pack_icm(Pack *P)
+{
+	int i, s, changed = 1, sweeps = 0;
+	double e = 0.0;
+
+	for (i = 0; i < P->n; i++) {
+		Packres *r = P->res + i;
+		P->state[i] = -1;
+		for (s = 0; s < r->nbStates; s++)
+			if (r->alive[s] && (P->state[i] < 0 || r->single[s] < r->single[P->state[i]])) P->state[i] = s;
+	}
+	while (changed && sweeps++ < 10) {
+		changed = 0;
+		for (i = 0; i < P->n; i++) {
+			Packres *r = P->res + i;
+			double best = pack_energy_of(P, i, P->state[i]);
+			for (s = 0; s < r->nbStates; s++) {
+				if (!r->alive[s]) continue;
+				double es = pack_energy_of(P, i, s);
+				if (es < best - PACK_EPS) {
+					best = es;
+					P->state[i] = s;
+					changed = 1;
+				}
+			}
+		}
+	}
+	for (i = 0; i < P->n; i++) {
+		e += P->res[i].single[P->state[i]];
+		for (int j = i + 1; j < P->n; j++) e += pack_pair(P, i, P->state[i], j, P->state[j]);
+	}
+	P->best = e;
+	memcpy(P->bestState, P->state, P->n * sizeof(int));
+}
+
+/* depth-first over P->order; the residues not placed yet add at least their best single energy */
+static void pack_search(Pack *P, int depth, double energy, double rest)
+{
+	if (depth == P->n) {
+		if (energy < P->best - PACK_EPS) {
+			P->best = energy;
+			memcpy(P->bestState, P->state, P->n * sizeof(int));
+		}
+		return;
+	}
+	if (++P->nodes > PACK_NODES) {
+		P->exact = 0;
+		return;
+	}
+	int i = P->order[depth];
+	Packres *r = P->res + i;
+	rest -= P->minSingle[i];
+	for (int s = 0; s < r->nbStates && P->nodes <= PACK_NODES; s++) {
+		if (!r->alive[s]) continue;
+		double e = energy + r->single[s];
+		for (int d = 0; d < depth; d++) e += pack_pair(P, i, s, P->order[d], P->state[P->order[d]]);
+		if (e + rest >= P->best - PACK_EPS) continue;
+		P->state[i] = s;
+		pack_search(P, depth + 1, e, rest);
+	}
+}
+
+void sidechain_pack(int nbRes, AA **res, const Clashgrid *fixed, int numRand, double *energies)
+{
+	Pack P;
+	int i, j, s, alive[nbRes];
+	double rest = 0.0;
+
+	if (nbRes == 0) return;
+	P.n = nbRes;
+	P.res = malloc(nbRes * sizeof(Packres));
+	P.pair = calloc(nbRes * nbRes, sizeof(double *));
+	P.order = malloc(nbRes * sizeof(int));
+	P.state = malloc(nbRes * sizeof(int));
+	P.bestState = malloc(nbRes * sizeof(int));
+	P.minSingle = malloc(nbRes * sizeof(double));
+	if (!P.res || !P.pair || !P.order || !P.state || !P.bestState || !P.minSingle)
+		stop("Unable to allocate the side chain packer.");
+
+	for (i = 0; i < nbRes; i++) {
+		pack_states(P.res + i, res[i], nbRes, res, fixed, numRand);
+		pack_states_total += P.res[i].nbStates;
+	}
+	pack_eliminate_singles(&P);
+	pack_pairs(&P);
+	pack_eliminate_goldstein(&P);
+
+	/* the residues with the fewest states left first */
+	for (i = 0; i < nbRes; i++) {
+		alive[i] = 0;
+		P.minSingle[i] = DBL_MAX;
+		for (s = 0; s < P.res[i].nbStates; s++)
+			if (P.res[i].alive[s]) {
+				alive[i]++;
+				P.minSingle[i] = fmin(P.minSingle[i], P.res[i].single[s]);
+			}
+		pack_states_kept += alive[i];
+		for (j = i; j > 0 && alive[P.order[j - 1]] > alive[i]; j--) P.order[j] = P.order[j - 1];
+		P.order[j] = i;
+		rest += P.minSingle[i];
+	}
+	pack_icm(&P);
+	P.nodes = 0;
+	P.exact = 1;
+	pack_search(&P, 0, 0.0, rest);
+	pack_calls++;
+	pack_exact += P.exact;
+
+	/* each residue takes its atoms clashing with the fixed atoms or the gamma atoms of the others */
+	for (i = 0; i < nbRes; i++) {
+		Packres *r = P.res + i;
+		AA *a = r->a;
+		s = P.bestState[i];
+		double e = r->grid[s];
+		const float (*tc)[3] = (const float (*)[3]) r->tc + s * r->nbAtoms;
+		for (int k = 0; k < r->nbAtoms; k++) {
+			int clash = r->fixedClash[s * r->nbAtoms + k];
+			for (j = 0; j < nbRes && !clash && r->atypes[k] != 3; j++) {
+				Packres *q = P.res + j;
+				if (j == i) continue;
+				for (int c = 0; c < 2; c++)
+					if (q->centerFlags[c] && dist2(q->centers[P.bestState[j]][c], tc[k]) < CLASH_DISTANCE2) clash = 1;
+			}
+			if (clash) e += PACK_CLASH;
+		}
+		energies[i] = e;
+		a->SCRot = s % r->nbRot;
+		a->SCTrial = s / r->nbRot;
+		for (int k = 0; k < 3; k++) {
+			a->g[k] = r->centers[s][0][k];
+			a->g2[k] = r->centers[s][1][k];
+		}
+	}
+
+	for (i = 0; i < nbRes; i++) {
+		free(P.res[i].tc);
+		free(P.res[i].centers);
+		free(P.res[i].fixedClash);
+		free(P.res[i].grid);
+		free(P.res[i].single);
+		free(P.res[i].alive);
+		free(P.res[i].atomReach);
+	}
+	for (i = 0; i < nbRes * nbRes; i++) free(P.pair[i]);
+	free(P.res);
+	free(P.pair);
+	free(P.order);
+	free(P.state);
+	free(P.bestState);
+	free(P.minSingle);
+}
@@ -0,0 +1,196 @@
+/*
+**  This program checks energy2_ranged() against energy2() on every residue
+**  pair of random chains, and times the two over the same pairs. The
+**  residues of a chain keep their own geometry but are placed with their
+**  CAs scattered over a box and turned at random, so that pairs of all
+**  distances, near and beyond the reach of the contact terms, are tried.
+**  The model parameters are read as by the main program, e.g.
+**  pairbench -p Bias=NULL,Elec=1.0,10.0,1
+**
+**  Copyright (c) Yuqi Zhang, Michel Sanner, CCSB Scripps
+*/
+
+#define VER "pairbench 1.0, Copyright (c) Yuqi Zhang, Michel Sanner, CCSB Scripps\n"
+#define USE "Usage: %s [options]\n\
+Options:\n\
+ -a ACDEFGHIKLMNPQRSTVWY    sequence, repeated up to the chain length\n\
+ -n 60        residues per chain\n\
+ -c 200       number of random chains\n\
+ -b 30        edge of the box the CAs are scattered over (A)\n\
+ -s 1         random seed\n\
+ -p Bias=NULL model parameters, as for the main program\n"
+
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<math.h>
+#include<time.h>
+
+#include"error.h"
+#include"params.h"
+#include"aadict.h"
+#include"vector.h"
+#include"rotation.h"
+#include"peptide.h"
+#include"vdw.h"
+#include"energy.h"
+
+char *alphabet = "ACDEFGHIKLMNPQRSTVWY";
+int naa = 60;
+int nchains = 200;
+double box = 30.0;
+unsigned int seed = 1;
+char *prm = "Bias=NULL";
+
+void read_options(int argc, char *argv[])
+{
+	int i, opt;
+
+	for (i = 1; i < argc; i++) {
+		opt = argv[i][0] == '-' ? argv[i][1] : 0;
+		if (++i >= argc)
+			opt = 0;
+
+		switch (opt) {
+		case 'a':
+			alphabet = argv[i];
+			break;
+		case 'n':
+			naa = atoi(argv[i]);
+			break;
+		case 'c':
+			nchains = atoi(argv[i]);
+			break;
+		case 'b':
+			box = atof(argv[i]);
+			break;
+		case 's':
+			seed = (unsigned int)atoi(argv[i]);
+			break;
+		case 'p':
+			prm = argv[i];
+			break;
+		default:
+			fprintf(stderr, VER USE, argv[0]);
+			exit(EXIT_FAILURE);
+		}
+	}
+	if (naa < 2 || nchains <= 0 || box <= 0.0 || strlen(alphabet) == 0) {
+		fprintf(stderr, VER USE, argv[0]);
+		exit(EXIT_FAILURE);
+	}
+}
+
+double uniform(double lo, double hi)
+{
+	return lo + (hi - lo) * rand() / (double)RAND_MAX;
+}
+
+/* move an atom of a residue turned by t about its CA ca and put at p */
+void place(vector x, matrix t, vector ca, vector p)
+{
+	vector d, r;
+
+	subtract(d, x, ca);
+	matrixvector(r, t, d);
+	add(x, r, p);
+}
+
+/* scatter the residues of aa over the box, each turned at random about its CA */
+void scatter(AA *aa, AA *from, int n)
+{
+	int i, k;
+	vector axis, p, ca;
+	matrix t;
+
+	for (i = 1; i < n; i++) {
+		aa[i] = from[i];
+		randvector(axis);
+		rotmatrix(t, axis, uniform(-M_PI, M_PI));
+		for (k = 0; k < 3; k++)
+			p[k] = uniform(0.0, box);
+		castvec(ca, aa[i].ca);
+		place(aa[i].h, t, ca, p);
+		place(aa[i].n, t, ca, p);
+		place(aa[i].c, t, ca, p);
+		place(aa[i].o, t, ca, p);
+		place(aa[i].cb, t, ca, p);
+		place(aa[i].g, t, ca, p);
+		place(aa[i].g2, t, ca, p);
+		castvec(aa[i].ca, p);
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	simulation_params sim_params;
+	model_params *mod_params = &(sim_params.protein_model);
+
+	read_options(argc, argv);
+	param_initialise(&sim_params);
+	set_lj_default_params(mod_params);
+	sim_params.prm = malloc(strlen(prm) + 1);
+	if (!sim_params.prm) stop("Unable to allocate memory in pairbench.");
+	strcpy(sim_params.prm, prm);
+	model_param_read(sim_params.prm, mod_params, &(sim_params.flex_params));
+	initialize_sidechain_properties(mod_params);
+	vdw_cutoff_distances_calculate(&sim_params, stderr, 0);
+	peptide_init();
+
+	char *seq = malloc(naa + 1);
+	if (!seq) stop("Unable to allocate memory in pairbench.");
+	for (int i = 0; i < naa; i++) seq[i] = alphabet[i % strlen(alphabet)];
+	seq[naa] = '\0';
+
+	Chain *chain = (Chain *)malloc(sizeof(Chain));
+	Chaint *chaint = (Chaint *)malloc(sizeof(Chaint));
+	Biasmap *biasmap = (Biasmap *)malloc(sizeof(Biasmap));
+	if (!chain || !chaint || !biasmap) stop("Unable to allocate memory in pairbench.");
+	chain->NAA = 0;
+	chain->aa = NULL; chain->xaa = NULL; chain->erg = NULL; chain->xaa_prev = NULL; chain->sc = NULL;
+	chaint->aat = NULL; chaint->xaat = NULL; chaint->ergt = NULL; chaint->xaat_prev = NULL; chaint->sct = NULL;
+	biasmap->distb = NULL;
+	srand(seed);
+	build_peptide_from_sequence(chain, chaint, seq, &sim_params);
+	biasmap_initialise(chain, biasmap, mod_params);
+
+	const int n = chain->NAA;
+	const double reach = energy2_reach(mod_params);
+	AA *aa = malloc(n * sizeof(AA));
+	double *full = malloc(n * n * sizeof(double)), *ranged = malloc(n * n * sizeof(double));
+	if (!aa || !full || !ranged) stop("Unable to allocate memory in pairbench.");
+
+	long pairs = 0, apart = 0, mismatches = 0;
+	double largest = 0.0, tfull = 0.0, tranged = 0.0;
+	clock_t begin;
+	int c, i, j;
+
+	for (c = 0; c < nchains; c++) {
+		scatter(aa, chain->aa, n);
+		begin = clock();
+		for (i = 1; i < n; i++)
+			for (j = 1; j < i; j++)
+				full[i * n + j] = energy2(biasmap, aa + i, aa + j, mod_params);
+		tfull += (double)(clock() - begin) / CLOCKS_PER_SEC;
+		begin = clock();
+		for (i = 1; i < n; i++)
+			for (j = 1; j < i; j++)
+				ranged[i * n + j] = energy2_ranged(biasmap, aa + i, aa + j, reach, mod_params);
+		tranged += (double)(clock() - begin) / CLOCKS_PER_SEC;
+		for (i = 1; i < n; i++)
+			for (j = 1; j < i; j++) {
+				pairs++;
+				if (energy2_apart(aa + i, aa + j, reach, mod_params)) apart++;
+				if (ranged[i * n + j] != full[i * n + j]) {
+					mismatches++;
+					largest = fmax(largest, fabs(ranged[i * n + j] - full[i * n + j]));
+				}
+			}
+	}
+
+	printf("%ld pairs of %d chains of %d residues, box %g A, reach %g A\n", pairs, nchains, n - 1, box, reach);
+	printf("%ld pairs (%.1f%%) apart, scored without the contact terms\n", apart, 100.0 * apart / pairs);
+	printf("energy2 %.3f s, energy2_ranged %.3f s\n", tfull, tranged);
+	printf("%ld pairs differ, largest difference %g\n", mismatches, largest);
+	return mismatches ? EXIT_FAILURE : EXIT_SUCCESS;
+}
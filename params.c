@@ -27,6 +27,7 @@ void param_initialise(simulation_params *this) {
   this->outfile = stdout;
   this->infile_name = NULL;
   this->outfile_name = NULL;
+  this->target_name = NULL;
   this->pace = 0;
   this->stretch = 16;
   this->tmask = 0x0;
@@ -89,6 +90,8 @@ void param_initialise(simulation_params *this) {
   this->checkpoint_file = NULL;
   this->checkpoint_counter = 0;
   this->restart_from_checkpoint = 0;
+  this->checkpoint_sidechains = 0;
+  this->checkpoint_ergpacked = 0;
   this->checkpoint = 0;
 
   model_param_initialise(&(this->protein_model));
@@ -113,6 +116,7 @@ void param_finalise(simulation_params *this) {
 
   if (this->infile_name) free(this->infile_name);
   if (this->outfile_name) free(this->outfile_name);
+  if (this->target_name) free(this->target_name);
 
   this->pace = 0;
   this->stretch = 0;
@@ -177,6 +181,8 @@ void param_finalise(simulation_params *this) {
   }
   this->checkpoint_counter = 0;
   this->restart_from_checkpoint = 0;
+  this->checkpoint_sidechains = 0;
+  this->checkpoint_ergpacked = 0;
   this->checkpoint = 0;
 
 
@@ -319,6 +325,21 @@ void model_param_initialise(model_params *this) {
   this->external_ztip2 = 0.0;
   this->external_constrained_aalist_file2 = NULL;
 
+  /* AutoDock grid maps */
+  this->grid_layout = GRID_LAYOUT_SEPARATE;
+  this->grid_precision = GRID_PRECISION_DOUBLE;
+  this->rotcache_quantum = 0.0;
+  this->sidechain_pack = 0;
+  this->rotlib_file = NULL;
+  this->rotamer_budget = 0;
+  this->rotamer_cys = 0;
+  this->rotamer_jitter = 2;
+  this->rigid_move = 0.0;
+  this->keep_sidechains = 0;
+  this->rigid_body = 0.0;
+  this->rigid_body_accept[0] = 0.3;
+  this->rigid_body_accept[1] = 0.3;
+
   //CAUTION!: aadict.c depends on params.c's model_params.  This means that
   //    initialize_sidechain_properties will have to be called after all updates
   //    of the vdW parameters; it can't be called from here, due to circular dependencies.
@@ -420,6 +441,7 @@ void model_param_finalise(model_params *this) {
 
   /* fixed amino acids */
   if (this->fixed_aalist_file) free(this->fixed_aalist_file);
+  if (this->rotlib_file) free(this->rotlib_file);
 
   /*optimizing strategy*/
   this->opt = 0;
@@ -737,6 +759,7 @@ void model_params_copy(model_params *to, model_params *from) {
   /* strings */
   copy_string(&(to->contact_map_file), from->contact_map_file);
   copy_string(&(to->fixed_aalist_file), from->fixed_aalist_file);
+  copy_string(&(to->rotlib_file), from->rotlib_file);
   copy_string(&(to->external_constrained_aalist_file), from->external_constrained_aalist_file);
   copy_string(&(to->external_constrained_aalist_file2), from->external_constrained_aalist_file2);
   /* sidechain_properties */
@@ -782,6 +805,7 @@ void sim_params_copy(simulation_params *to, simulation_params *from) {
   copy_string(&(to->sequence), from->sequence);
   copy_string(&(to->infile_name), from->infile_name);
   copy_string(&(to->outfile_name), from->outfile_name);
+  copy_string(&(to->target_name), from->target_name);
   copy_string(&(to->checkpoint_filename), from->checkpoint_filename);
 
   //double arrays
@@ -1229,6 +1253,101 @@ void model_param_read(char *prm, /* input line */
 	}
 
 
+	/* storage layout of the AutoDock grid maps */
+	k = sscanf(prm, "Grid=%d", &(this->grid_layout));
+	if (k>0) {
+		if (this->grid_layout < GRID_LAYOUT_SEPARATE || this->grid_layout > GRID_LAYOUT_TILED)
+			stop("Grid layout has to be 0 (separate maps), 1 (interleaved voxels) or 2 (tiled voxels).");
+		found_param += 1;
+		start = 5;
+	}
+
+	/* storage precision of the separate grid maps */
+	k = sscanf(prm, "GridPrecision=%d", &(this->grid_precision));
+	if (k>0) {
+		if (this->grid_precision < GRID_PRECISION_DOUBLE || this->grid_precision > GRID_PRECISION_INT16)
+			stop("Grid precision has to be 0 (double), 1 (float) or 2 (16-bit quantised).");
+		found_param += 1;
+		start = 14;
+	}
+
+	/* side chain cache of the AutoDock grid energy */
+	k = sscanf(prm, "RotCache=%lf", &(this->rotcache_quantum));
+	if (k>0) {
+		if (this->rotcache_quantum < 0)
+			stop("RotCache has to be 0 (no cache) or the rounding of the backbone frames in A.");
+		found_param += 1;
+		start = 9;
+	}
+
+	/* side chain packing of the AutoDock grid energy */
+	k = sscanf(prm, "Pack=%d", &(this->sidechain_pack));
+	if (k>0) {
+		if (this->sidechain_pack < 0 || this->sidechain_pack > 1)
+			stop("Pack has to be 0 (sequential placement) or 1 (global packer).");
+		found_param += 1;
+		start = 5;
+	}
+
+	/* rotamer library of the AutoDock grid energy */
+	char rotlib_file[256];
+	if ((k=sscanf(prm, "Rotlib=%255[^,]", rotlib_file)) == 1) {
+		if (this->rotlib_file) free(this->rotlib_file);
+		copy_string(&(this->rotlib_file), rotlib_file);
+		found_param += 1;
+		start = strlen(rotlib_file) + strlen("Rotlib=");
+	}
+
+	k = sscanf(prm, "RotBudget=%d", &(this->rotamer_budget));
+	if (k>0) {
+		if (this->rotamer_budget < 0)
+			stop("RotBudget has to be 0 (all rotamers) or the most rotamers per residue type.");
+		found_param += 1;
+		start = 10;
+	}
+
+	k = sscanf(prm, "RotCys=%d", &(this->rotamer_cys));
+	if (k>0) {
+		if (this->rotamer_cys < 0 || this->rotamer_cys > 1)
+			stop("RotCys has to be 0 (gamma atom) or 1 (rotamers).");
+		found_param += 1;
+		start = 7;
+	}
+
+	k = sscanf(prm, "RotJitter=%d", &(this->rotamer_jitter));
+	if (k>0) {
+		if (this->rotamer_jitter < 0 || this->rotamer_jitter >= 64)	/* ROTLIB_JITTERS */
+			stop("RotJitter has to be between 0 and 63 moves of N.");
+		found_param += 1;
+		start = 10;
+	}
+
+	k = sscanf(prm, "RigidMove=%lf", &(this->rigid_move));
+	if (k>0) {
+		if (this->rigid_move < 0)
+			stop("RigidMove has to be 0 (always search the rotamers) or the longest rigid body move in A.");
+		found_param += 1;
+		start = 10;
+	}
+
+	k = sscanf(prm, "SideChains=%d", &(this->keep_sidechains));
+	if (k>0) {
+		if (this->keep_sidechains < 0 || this->keep_sidechains > 1)
+			stop("SideChains has to be 0 (keep the rotamer indices) or 1 (keep the placed side chains).");
+		found_param += 1;
+		start = 11;
+	}
+
+	k = sscanf(prm, "RigidBody=%lf,%lf,%lf", &(this->rigid_body), &(this->rigid_body_accept[0]), &(this->rigid_body_accept[1]));
+	if (k>0) {
+		if (this->rigid_body < 0 || this->rigid_body > 1)
+			stop("RigidBody has to be the share of rigid body moves, from 0 (none) to 1.");
+		if (this->rigid_body_accept[0] <= 0 || this->rigid_body_accept[0] >= 1 || this->rigid_body_accept[1] <= 0 || this->rigid_body_accept[1] >= 1)
+			stop("The acceptance rates of the rigid body rotations and translations have to be between 0 and 1.");
+		found_param += 1;
+		start = 10;
+	}
+
 	/* external potential */
 	int xdir = 0;
 	int ydir = 0;
@@ -1659,6 +1778,17 @@ void model_param_print(model_params this, FILE *outfile) {
   fprintf(outfile,"external_k[0](2): %g\n",this.external_k2[0]);
   fprintf(outfile,"external_r0[0](2): %g\n",this.external_r02[0]);
   if (this.external_potential_type2 == 3) fprintf(outfile,"external_ztip(2): %g\n",this.external_ztip2);
+  fprintf(outfile,"grid layout (%d: separate maps, %d: interleaved voxels, %d: tiled voxels): %d\n",GRID_LAYOUT_SEPARATE,GRID_LAYOUT_INTERLEAVED,GRID_LAYOUT_TILED,this.grid_layout);
+  fprintf(outfile,"grid precision (%d: double, %d: float, %d: 16-bit quantised): %d\n",GRID_PRECISION_DOUBLE,GRID_PRECISION_FLOAT,GRID_PRECISION_INT16,this.grid_precision);
+  fprintf(outfile,"side chain cache rounding (A, 0: no cache): %g\n",this.rotcache_quantum);
+  fprintf(outfile,"side chain packing (0: sequential, 1: global packer): %d\n",this.sidechain_pack);
+  fprintf(outfile,"rotamer library file: %s\n",this.rotlib_file ? this.rotlib_file : "built-in");
+  fprintf(outfile,"rotamers per residue type (0: all): %d\n",this.rotamer_budget);
+  fprintf(outfile,"CYS side chain (0: gamma atom, 1: rotamers): %d\n",this.rotamer_cys);
+  fprintf(outfile,"side chain scan moves of N: %d\n",this.rotamer_jitter);
+  fprintf(outfile,"rigid body moves keeping the rotamers up to (A, 0: none): %g\n",this.rigid_move);
+  fprintf(outfile,"placed side chains kept in the chain (0: no, 1: yes): %d\n",this.keep_sidechains);
+  fprintf(outfile,"share of rigid body moves (0: none): %g, target acceptance of rotations %g and translations %g\n",this.rigid_body,this.rigid_body_accept[0],this.rigid_body_accept[1]);
   fprintf(outfile,"============END=MODEL=PARAMETERS===================\n");
 
 }
@@ -1687,6 +1817,7 @@ void param_print(simulation_params this, FILE *outfile) {
   fprintf(outfile,"--GENERAL--\n");
   fprintf(outfile,"infile_name %s\n",this.infile_name);
   fprintf(outfile,"outfile_name %s\n",this.outfile_name);
+  if (this.target_name) fprintf(outfile,"target_name %s\n",this.target_name);
   fprintf(outfile,"pace %d\n",this.pace);
   fprintf(outfile,"stretch %d\n",this.stretch);
   fprintf(outfile,"test mask %x\n",this.tmask);
@@ -1754,6 +1885,8 @@ void param_print(simulation_params this, FILE *outfile) {
   fprintf(outfile,"checkpoint filename %s\n",this.checkpoint_filename);
   fprintf(outfile,"checkpoint_counter %d\n",this.checkpoint_counter);
   fprintf(outfile,"restart_from_checkpoint %d\n",this.restart_from_checkpoint);
+  fprintf(outfile,"checkpoint side chains %d\n",this.checkpoint_sidechains);
+  fprintf(outfile,"checkpoint compact energy matrix %d\n",this.checkpoint_ergpacked);
   fprintf(outfile,"checkpoint %d\n",this.checkpoint);
 
   model_param_print(this.protein_model, outfile);
@@ -22,6 +22,14 @@
 #define EXTERNAL_POSITIVE 1003
 #define EXTERNAL_POSNEG   1004
 
+#define GRID_LAYOUT_SEPARATE    0 //one double array per AutoDock map
+#define GRID_LAYOUT_INTERLEAVED 1 //one padded float record per voxel holding all maps
+#define GRID_LAYOUT_TILED       2 //interleaved records stored in 4x4x4 voxel bricks
+
+#define GRID_PRECISION_DOUBLE 0 //separate maps as read
+#define GRID_PRECISION_FLOAT  1 //separate maps rounded to float
+#define GRID_PRECISION_INT16  2 //separate maps quantised to 16 bits with a per-map scale and offset
+
 //Usage help for the parameter string
 #define PARAM_USE "Usage of the parameter string -p Param1=...[,...][,Param2=...][,Param3=...,...,...]\n\
 Options:\n\
@@ -38,7 +46,17 @@ Options:\n\
  Rgyr                   secondary radius of gyration\n\
  SSbond                 S-S bonds\n\
  fixed                  fixed amino acid list\n\
- external               external potential\n"
+ external               external potential\n\
+ Grid                   storage layout of the AutoDock grid maps (0: separate maps, 1: interleaved voxels, 2: tiled voxels)\n\
+ GridPrecision          storage precision of the separate grid maps (0: double, 1: float, 2: 16-bit quantised)\n\
+ RotCache               cache the side chains of backbone frames rounded to this many A (0: no cache)\n\
+ Rotlib                 binary rotamer library file written by rotlib2bin, replacing the built-in types it has\n\
+ RotBudget              most rotamers per residue type, those of the highest priors (0: all)\n\
+ RotCys                 score CYS by its rotamers instead of its gamma atom (0: gamma atom, 1: rotamers)\n\
+ RotJitter              moves of N tried by the side chain scans of the moved residues, besides N itself (default 2)\n\
+ RigidMove              score translation moves up to this many A with the side chains kept (0: always search the rotamers)\n\
+ SideChains             keep the placed side chain atoms in the chain and write them to the PDB files (0: off, 1: on)\n\
+ RigidBody              share of moves that rotate or translate the whole peptide, then the target acceptance rates of the rotations and translations (default 0,0.3,0.3)\n"
 
 /* side chain properties of the protein model */
 typedef struct {
@@ -245,6 +263,19 @@ typedef struct {
   double external_r02[3]; /* x y z */
   double external_ztip2; /* for conincal potential */
   char *external_constrained_aalist_file2;
+  /* AutoDock grid maps */
+  int grid_layout; // GRID_LAYOUT_SEPARATE, GRID_LAYOUT_INTERLEAVED or GRID_LAYOUT_TILED
+  int grid_precision; // GRID_PRECISION_DOUBLE, GRID_PRECISION_FLOAT or GRID_PRECISION_INT16
+  double rotcache_quantum; // rounding of the backbone frames of the side chain cache, 0 for no cache
+  int sidechain_pack; // 1: pack the moved side chains together, 0: one after the other in both directions
+  char *rotlib_file; // binary rotamer library read over the built-in one, NULL for none
+  int rotamer_budget; // most rotamers per residue type, 0 for all
+  int rotamer_cys; // 1: CYS scored by its rotamers, 0: by its gamma atom
+  int rotamer_jitter; // moves of N of the side chain scans of the moved residues, besides N itself
+  double rigid_move; // longest rigid body move scored with the rotamers kept, 0 for none
+  int keep_sidechains; // 1: the chains keep their placed side chain atoms, 0: only the rotamer indices
+  double rigid_body; // share of the moves that are rigid body rotations or translations, 0 for none
+  double rigid_body_accept[2]; // target acceptance rates of the rigid body rotations and translations
   /* sidechain properties */
   sidechain_properties_ *sidechain_properties;
 
@@ -276,6 +307,7 @@ typedef struct {
   /* general simulation */
   char *infile_name;    /* input filename */
   char *outfile_name;   /* output filename */
+  char *target_name;    /* .trg target archive of the receptor maps, NULL to read them from the current directory */
   FILE *infile;
   FILE *outfile;
   unsigned int pace;
@@ -340,6 +372,8 @@ typedef struct {
   int checkpoint_counter;
   int checkpoint;
   int restart_from_checkpoint;
+  int checkpoint_sidechains; // 1: the entries of the open checkpoint file carry the placed side chains
+  int checkpoint_ergpacked; // 1: the entries of the open checkpoint file carry the compact energy matrix
   model_params protein_model;
 
   /*normal mode analysis parameters */
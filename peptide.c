@@ -55,6 +55,61 @@ double ican_ = 0.6813;
 double skew = -3.063;
 double skew_ = -1.121;
 
+int sidechain_store = 0;
+
+/* whether sc is the side chain of residue a in its current frame */
+int sidechain_valid(const Sidechain *sc, const AA *a)
+{
+	const double *frame[3] = { a->n, a->ca, a->cb };
+	if (sc->nbAtoms <= 0 || sc->SCRot != a->SCRot || sc->SCTrial != a->SCTrial)
+		return 0;
+	for (int k = 0; k < 9; k++)
+		if (sc->frame[k] != frame[k / 3][k % 3]) return 0;
+	return 1;
+}
+
+/* the atoms a side chain has room for, those of the largest rotamer of the libraries in use */
+int sidechain_room()
+{
+	return rotlib_atoms();
+}
+
+/* the side chains of nres residues, none placed, replacing sc (which may be NULL) */
+Sidechain *sidechain_alloc(Sidechain *sc, int nres)
+{
+	const int room = sidechain_room();
+	sidechain_free(sc);
+	sc = (Sidechain *) malloc(nres * sizeof(Sidechain));
+	int *atypes = (int *) malloc((size_t) nres * room * sizeof(int));
+	double (*xyz)[3] = malloc((size_t) nres * room * sizeof(*xyz));
+	if (sc == NULL || atypes == NULL || xyz == NULL) stop("sidechain_alloc: Insufficient memory");
+	for (int i = 0; i < nres; i++) {
+		sc[i].nbAtoms = 0;
+		sc[i].atypes = atypes + (size_t) i * room;
+		sc[i].xyz = xyz + (size_t) i * room;
+	}
+	return sc;
+}
+
+void sidechain_free(Sidechain *sc)
+{
+	if (sc == NULL) return;
+	/* the atoms of all residues start at those of the first */
+	free(sc[0].atypes);
+	free(sc[0].xyz);
+	free(sc);
+}
+
+void sidechain_copy(Sidechain *to, const Sidechain *from)
+{
+	to->nbAtoms = from->nbAtoms;
+	to->SCRot = from->SCRot;
+	to->SCTrial = from->SCTrial;
+	memcpy(to->frame, from->frame, sizeof(to->frame));
+	memcpy(to->atypes, from->atypes, from->nbAtoms * sizeof(int));
+	memcpy(to->xyz, from->xyz, from->nbAtoms * sizeof(*to->xyz));
+}
+
 
 /***********************************************************/
 /****            INITIALISATION OF CONSTANTS            ****/
@@ -817,14 +872,9 @@ void aat_init(Chain * chain, Chaint * chaint){
     (chaint)->aat = (AA *) realloc((chaint)->aat, chain->NAA * sizeof(AA));
     (chaint)->xaat = (triplet *) realloc((chaint)->xaat, chain->NAA * sizeof(triplet));
     (chaint)->ergt = (double *) realloc((chaint)->ergt, 5 * chain->NAA * chain->NAA * sizeof(double));
-    int i;	
-    for (i = 1; i < chain->NAA; i++) {
-	  (chaint)->aat[i].id = chain->aa[i].id;
-	  (chaint)->aat[i].etc = chain->aa[i].etc;
-	  (chaint)->aat[i].num = chain->aa[i].num;
-	  (chaint)->aat[i].chainid = chain->aa[i].chainid;
-	  (chaint)->aat[i].SCRot = chain->aa[i].SCRot;
-    }
+    /* all of aat, the moves read atoms of residues they leave unbuilt */
+    memcpy((chaint)->aat, chain->aa, chain->NAA * sizeof(AA));
+    if (sidechain_store) (chaint)->sct = sidechain_alloc((chaint)->sct, chain->NAA);
   }	
   if(sizeof(chaint)->xaat_prev != (chain->Nchains+1) * sizeof(triplet)){
     (chaint)->xaat_prev = (triplet *) realloc((chaint)->xaat_prev, (chain->Nchains+1) * sizeof(triplet));
@@ -862,6 +912,7 @@ void allocmem_chain(Chain *chain, int NAA, int Nchains)
 	(chain)->aa =  (AA*)realloc((chain)->aa, (chain)->NAA * sizeof(AA));
 //	fprintf(stderr,"allocating erg: %ld\n",(chain)->NAA * (chain)->NAA * sizeof(double));
 	(chain)->erg = (double*)realloc((chain)->erg, (chain)->NAA * (chain)->NAA * sizeof(double));
+	(chain)->ergloc = (chain)->ergpair = 0.0;
 	///fprintf(stderr," %g",chain->erg);
 	(chain)->xaa = (triplet*)realloc((chain)->xaa,(chain)->NAA * sizeof(triplet));
 	(chain)->xaa_prev = (triplet*)realloc((chain)->xaa_prev,((chain)->Nchains + 1) * sizeof(triplet));
@@ -871,6 +922,7 @@ void allocmem_chain(Chain *chain, int NAA, int Nchains)
 		if ((chain)->xaa_prev == NULL) stop("allocmem_chain: Insufficient memory (chain->xaa_prev)");
 		if ((chain)->erg == NULL) stop("allocmem_chain: Insufficient memory (chain->erg)");
 	}
+	if (sidechain_store) (chain)->sc = sidechain_alloc((chain)->sc, (chain)->NAA);
 }
 
 
@@ -959,6 +1011,7 @@ void build_peptide_from_sequence(Chain * chain, Chaint *chaint, char *str, simul
 
 	for (i = 1; i < chain->NAA; i++) {
 		chain->aa[i].SCRot = 0;
+		chain->aa[i].SCTrial = 0;
 		
 
 		if (chain->aa[i].etc & PSI)
@@ -1007,8 +1060,8 @@ void build_peptide_from_sequence(Chain * chain, Chaint *chaint, char *str, simul
 	if ((sim_params->protein_model).external_potential_type == 5 && transPtsCount!=0) {
 		//srand(sim_params->seed);
 		int transPtsID = rand() % transPtsCount;
-		chain->aa[0].ca[0] = Xpts[transPtsID];
-		chain->aa[0].ca[1] = Ypts[transPtsID];
+		chain->aa[0].ca[0] = Xpts[transPtsID];
+		chain->aa[0].ca[1] = Ypts[transPtsID];
 		chain->aa[0].ca[2] = Zpts[transPtsID];
 		//chain->aa[0].ca[0] = centerX - randx * (NX - 1) * spacing / 4;
 		//chain->aa[0].ca[1] = centerY - randy * (NY - 1) * spacing / 4;
@@ -1256,8 +1309,8 @@ static double psi_angle(struct AA *a, triplet xct)
 
 /****                     PRINTING                      ****/
 
-/* Printing an amino acid residue in PDB format */
-int pdbrecord( AA *a, int j, model_params *mod_params, FILE *outfile)
+/* Printing an amino acid residue in PDB format, with its full side chain sc if not NULL */
+static int pdbrecord_sidechain( AA *a, const Sidechain *sc, int j, model_params *mod_params, FILE *outfile)
 {
 	char fmt[] = "ATOM  %5d %4s XAA A9999    %8.3f%8.3f%8.3f\n";
 	//const char chain = 'A';
@@ -1274,7 +1327,16 @@ int pdbrecord( AA *a, int j, model_params *mod_params, FILE *outfile)
 	fprintf(outfile,fmt, ++j, " O  ", a->o[0], a->o[1], a->o[2]);
 	if (a->id != 'G') {
 		fprintf(outfile,fmt, ++j, " CB ", a->cb[0], a->cb[1], a->cb[2]);
-		if (mod_params->use_gamma_atoms != NO_GAMMA) {
+		if (sc) {
+			/* the heavy atoms of the rotamer, named by element and their place in the rotamer library */
+			const char elements[] = "CNOHSCN";
+			char name[8];
+			for (int k = 0; k < sc->nbAtoms; k++) {
+				if (sc->atypes[k] == 3 || sc->atypes[k] < 0 || sc->atypes[k] > 6) continue;
+				sprintf(name, " %c%-2d", elements[sc->atypes[k]], (k + 1) % 100);
+				fprintf(outfile,fmt, ++j, name, sc->xyz[k][0], sc->xyz[k][1], sc->xyz[k][2]);
+			}
+		} else if (mod_params->use_gamma_atoms != NO_GAMMA) {
 #ifdef LINUS_1995
 			/* LINUS 1995 doesn't have CG for PRO, so we have to skip for PRO */
 			if (a->id != 'A' && a->id != 'P' && a->g[2] < FAR) {
@@ -1321,8 +1383,15 @@ int pdbrecord( AA *a, int j, model_params *mod_params, FILE *outfile)
 	return j;
 }
 
-/* Printing an amino acid chain in PDB format */
-void pdbprint( AA *a, int count, model_params *mod_params, FILE *outfile, double *E_tot)
+/* Printing an amino acid residue in PDB format */
+int pdbrecord( AA *a, int j, model_params *mod_params, FILE *outfile)
+{
+	return pdbrecord_sidechain(a, NULL, j, mod_params, outfile);
+}
+
+/* Printing an amino acid chain in PDB format, residue i with its full side chain sc[i] if sc is not
+   NULL and that side chain is valid */
+static void pdbprint_sidechains( AA *a, const Sidechain *sc, int count, model_params *mod_params, FILE *outfile, double *E_tot)
 {
 	int i, j;
 	static int model = 1;
@@ -1335,7 +1404,7 @@ void pdbprint( AA *a, int count, model_params *mod_params, FILE *outfile, double
 			fprintf(outfile,"TER   %5d      %3s %c%4d\n",
 			       j, aa123(a[i].id), 'A', i);
 		}
-		j = pdbrecord(a + i, j, mod_params, outfile);
+		j = pdbrecord_sidechain(a + i, sc && sidechain_valid(sc + i, a + i) ? sc + i : NULL, j, mod_params, outfile);
 	}
 
 	fprintf(outfile,"TER   %5d      %3s %c%4d\n",
@@ -1344,6 +1413,18 @@ void pdbprint( AA *a, int count, model_params *mod_params, FILE *outfile, double
 	model++;
 }
 
+/* Printing an amino acid chain in PDB format */
+void pdbprint( AA *a, int count, model_params *mod_params, FILE *outfile, double *E_tot)
+{
+	pdbprint_sidechains(a, NULL, count, mod_params, outfile, E_tot);
+}
+
+/* Printing a chain in PDB format, with the side chains it keeps */
+void pdbprint_chain(Chain *chain, model_params *mod_params, FILE *outfile, double *E_tot)
+{
+	pdbprint_sidechains(chain->aa, chain->sc, chain->NAA, mod_params, outfile, E_tot);
+}
+
 /****                      READING                      ****/
 
 /* Increase the size of allocated memory for the amino acid array pointer */
@@ -1590,6 +1671,10 @@ void freemem_chain(Chain *chain)
 		free(chain->xaa_prev);
 		chain->xaa_prev = NULL;
 	    }
+	    if (chain->sc) {
+		sidechain_free(chain->sc);
+		chain->sc = NULL;
+	    }
 	}
 }
 
@@ -1612,6 +1697,10 @@ void freemem_chaint(Chaint *chaint)
 		free(chaint->xaat_prev);
 		chaint->xaat_prev = NULL;
 	    }
+	    if (chaint->sct) {
+		sidechain_free(chaint->sct);
+		chaint->sct = NULL;
+	    }
     } 
 }
 
@@ -2020,7 +2109,7 @@ int pdbin(Chain *chain, simulation_params *sim_params, FILE *infile)
 	/* scan the PDB-like input from infile, and allocate the memory */
 
     Chain *tempchain = malloc(sizeof(Chain));
-	tempchain->NAA = 0; tempchain->Nchains = 0; tempchain->aa = NULL; tempchain->erg = NULL; tempchain->xaa = NULL; tempchain->xaa_prev = NULL;
+	tempchain->NAA = 0; tempchain->Nchains = 0; tempchain->aa = NULL; tempchain->erg = NULL; tempchain->xaa = NULL; tempchain->xaa_prev = NULL; tempchain->sc = NULL;
 	retv = getpdb(&(tempchain->aa), &(tempchain->NAA), &(tempchain->Nchains), infile);
 //	fprintf(stderr,"tempchain->NAA=%d\n",tempchain->NAA);
 	
@@ -2133,6 +2222,7 @@ void initialize(Chain *chain, Chaint * chaint, simulation_params *sim_params)
 	amidorient(chain->xaa_prev[1], NULL, (chain->aa) + 1);
 	for (i = 1; i < chain->NAA - 1 ; i++) {
 		chain->aa[i].SCRot = 0;
+		chain->aa[i].SCTrial = 0;
 		if (chain->aa[i].chainid == chain->aa[i+1].chainid) { //build the next amino acid
 			castvec(orig, chain->aa[i + 1].ca);
 			//first find the right xaa[i]
@@ -2273,6 +2363,7 @@ int i,j;
     to->aa[j].chi1 = from->aa[j].chi1;
     to->aa[j].chi2 = from->aa[j].chi2;
 	to->aa[j].SCRot = from->aa[j].SCRot;
+	to->aa[j].SCTrial = from->aa[j].SCTrial;
     for(i = 0; i < 3; i++){
       to->aa[j].h[i] = from->aa[j].h[i];	
 	  to->aa[j].n[i] =  from->aa[j].n[i];		
@@ -2297,6 +2388,10 @@ int i,j;
   for(i = 0; i < to->NAA*to->NAA; i++){
 	to->erg[i] = from->erg[i];  
   }
+  to->ergloc = from->ergloc;
+  to->ergpair = from->ergpair;
+  if (to->sc && from->sc)
+	for(i = 0; i < to->NAA; i++) sidechain_copy(to->sc + i, from->sc + i);
   to->ll = from->ll;	
 }
 
@@ -52,6 +52,7 @@ typedef struct _AA {
 	char id;		/* 1-letter type abbreviation */
 	int chainid;		/* chain id (1, 2, ...) */
 	int SCRot;   /*best scoring side chain coords*/
+	int SCTrial;	/* move of N (rotlib_jitter) of the scan trial SCRot is from */
 	//vector *SCAtoms;
 } AA;
 
@@ -65,24 +66,55 @@ typedef struct _FLEX_data{
 } FLEX_data;
 
 
+/* the side chain of a residue as placed by the AutoDock grid energy (SideChains=1): all atoms of
+   rotamer SCRot of trial SCTrial in the frame N, CA, CB, valid while the residue has that frame.
+   the atoms are held by the array of the chain, room for the largest rotamer in use per residue,
+   so side chains are copied with sidechain_copy */
+typedef struct _Sidechain {
+	int nbAtoms;		/* 0 if the residue has no rotamer */
+	int SCRot, SCTrial;
+	double frame[9];	/* N, CA, CB */
+	int *atypes;		/* element types 0:C, 1:N, 2:O, 3:H, 4:S, 5:CA, 6:NA */
+	double (*xyz)[3];
+} Sidechain;
+extern int sidechain_store;	/* 1: the chains keep their side chains (SideChains=1) */
+int sidechain_valid(const Sidechain *sc, const AA *a);
+Sidechain *sidechain_alloc(Sidechain *sc, int nres);
+void sidechain_free(Sidechain *sc);
+void sidechain_copy(Sidechain *to, const Sidechain *from);
+int sidechain_room();
+
 /* amino acid chain type */
 typedef struct _Chain {
 	AA *aa;
 	triplet *xaa;
 	triplet *xaa_prev; //previous xaa for chain start only
 	double *erg;
+	double ergloc, ergpair; /* running totals of the diagonal and of the pairs of erg (energy.c) */
 	double ll; /*logL only used for Nested sampling */
     int NAA;
     int Nchains;
     FLEX_data *flex_data; //only used in nma.c otherwise ignored
+    Sidechain *sc; /* per residue, NULL unless sidechain_store */
 } Chain;
 
-/* temporary amino acid chain type */
+/* the slots of the energy matrix Erg (energy.c, metropolis.c) that hold no residue pair, in the row
+   and column of residue 0: the external energy, the sum of the per residue external energies of row 0,
+   the cyclic bond energy and the global energy, Erg(0, 0), Erg(1, 0) and Erg(NAA - 1, 0) */
+#define ErgExternal(c) ((c)->erg[0])
+#define ErgCyclic(c) ((c)->erg[(c)->NAA])
+#define ErgGlobal(c) ((c)->erg[((c)->NAA - 1) * (c)->NAA])
+
+/* temporary amino acid chain type, copy-on-write: a move only writes the residues start..end it
+   rebuilds (and the CA-CA vectors around them), the others are stale and are read from Chain.
+   The range is not kept here, the scoring and the commit are given start..end by the move.
+   Rigid body moves place every atom, as the grid energy reads them all */
 typedef struct _Chaint {
 	triplet *xaat;
 	triplet *xaat_prev; //previous xaa for chain start only
 	AA *aat;
 	double *ergt;
+	Sidechain *sct; /* per residue, NULL unless sidechain_store */
 } Chaint;
 
 /* bias map type */
@@ -133,5 +165,6 @@ int aligned( AA *,  AA *);
 /* peptide chain i/o */
 int pdbrecord( AA *, int, model_params *mod_params, FILE *outfile);
 void pdbprint( AA *, int, model_params *mod_params, FILE *outfile, double *totenergy);
+void pdbprint_chain(Chain *chain, model_params *mod_params, FILE *outfile, double *totenergy);
 int getaa( AA *, FILE *infile);
 int getpdb( AA **, int *NAA, int *Nchains, FILE *infile);
@@ -201,13 +201,13 @@ void initialize_displacement(Chain *chain, Biasmap *biasmap, simulation_params *
 
 	Chain chain_init;
 	chain_init.NAA = 0;
-	chain_init.aa = NULL; chain_init.xaa = NULL; chain_init.erg = NULL; chain_init.xaa_prev = NULL;
+	chain_init.aa = NULL; chain_init.xaa = NULL; chain_init.erg = NULL; chain_init.xaa_prev = NULL; chain_init.sc = NULL;
         allocmem_chain(&chain_init,chain->NAA,chain->Nchains);
 	Chaint chaint;
-	chaint.aat = NULL; chaint.xaat = NULL; chaint.ergt = NULL; chaint.xaat_prev = NULL;
+	chaint.aat = NULL; chaint.xaat = NULL; chaint.ergt = NULL; chaint.xaat_prev = NULL; chaint.sct = NULL;
 	Chain displacements;
 	displacements.NAA = 0;
-	displacements.aa = NULL; displacements.xaa = NULL; displacements.erg = NULL; displacements.xaa_prev = NULL;
+	displacements.aa = NULL; displacements.xaa = NULL; displacements.erg = NULL; displacements.xaa_prev = NULL; displacements.sc = NULL;
         allocmem_chain(&displacements,chain->NAA,chain->Nchains);
 	
 	/* calculate initialized distances */
@@ -1521,7 +1521,7 @@ void pdbout(Chain *chain,Biasmap *biasmap, simulation_params *sim_params, void *
 {
 	//fprintf(stderr,"Outputting PDB, %d amino acids.\n", chain->NAA-1);
 	double E_tot = totenergy(chain);
-	pdbprint(chain->aa, chain->NAA, &(sim_params->protein_model), sim_params->outfile, &E_tot);
+	pdbprint_chain(chain, &(sim_params->protein_model), sim_params->outfile, &E_tot);
 /*  vector mol_com;
   mol_com[0] = mol_com[1] = mol_com[2] = 0.0;
   for (int i = 1; i < chain->NAA; i++){
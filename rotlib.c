@@ -0,0 +1,389 @@
+/*
+** The rotamer libraries as float structure-of-arrays, built at start-up
+** from canonicalAA.c or read from a binary library file written by
+** rotlib2bin, for the vectorised frame transform of gridkernel.c and the
+** batched grid energies.
+**
+** Copyright (c) Yuqi Zhang, Michel Sanner, CCSB Scripps
+*/
+
+#define _POSIX_C_SOURCE 200112L
+
+#include<stdlib.h>
+#include<stdio.h>
+#include<string.h>
+#include<math.h>
+#include<limits.h>
+
+#include"canonicalAA.h"
+#include"error.h"
+#include"params.h"
+#include"vector.h"
+#include"rotation.h"
+#include"aadict.h"
+#include"peptide.h"
+#include"vdw.h"
+#include"energy.h"
+
+extern struct _ARG ARG;
+extern struct _ASN ASN;
+extern struct _ASP ASP;
+extern struct _CYS CYS;
+extern struct _GLN GLN;
+extern struct _GLU GLU;
+extern struct _HIS HIS;
+extern struct _ILE ILE;
+extern struct _LEU LEU;
+extern struct _LYS LYS;
+extern struct _MET MET;
+extern struct _PHE PHE;
+extern struct _PRO PRO;
+extern struct _SER SER;
+extern struct _THR THR;
+extern struct _TRP TRP;
+extern struct _TYR TYR;
+extern struct _VAL VAL;
+
+static Rotlib rotlibs[26];	/* by id - 'A', nbRot 0 without a library */
+static float rotlib_jitters[ROTLIB_JITTERS][3];
+static int rotlib_ready = 0;
+static int rotlib_max_atoms = 0, rotlib_max_n = 0;	/* of the largest library in use */
+static Rotlib_scratch rotlib_scratches[ROTLIB_SCRATCHES];
+
+/* the radical inverse of i in base b, in [0, 1) */
+static double rotlib_halton(int i, int b)
+{
+	double f = 1.0, h = 0.0;
+	for (; i > 0; i /= b) {
+		f /= b;
+		h += f * (i % b);
+	}
+	return h;
+}
+
+static void *rotlib_alloc(size_t size)
+{
+	void *p;
+	if (posix_memalign(&p, ROTLIB_LANES * sizeof(float), size) != 0)
+		stop("Unable to allocate the rotamer libraries.");
+	return p;
+}
+
+static void rotlib_free(Rotlib *lib)
+{
+	free(lib->atypes);
+	free(lib->charges);
+	free(lib->prior);
+	free(lib->x);
+	free(lib->y);
+	free(lib->z);
+	free(lib->types);
+	free(lib->batchCharges);
+	free(lib->radius);
+	memset(lib, 0, sizeof(Rotlib));
+}
+
+/* the float arrays of lib from its nbRot rotamers, rotamer i taken from source[i] of coords */
+static void rotlib_arrays(Rotlib *lib, const double *coords, const int *source)
+{
+	const int nbAtoms = lib->nbAtoms;
+	int i, j, k;
+
+	lib->n = (lib->nbRot * nbAtoms + ROTLIB_LANES - 1) / ROTLIB_LANES * ROTLIB_LANES;
+	if (lib->radius == NULL && (lib->radius = malloc(nbAtoms * sizeof(double))) == NULL)
+		stop("Unable to allocate the rotamer libraries.");
+	lib->x = rotlib_alloc(lib->n * sizeof(float));
+	lib->y = rotlib_alloc(lib->n * sizeof(float));
+	lib->z = rotlib_alloc(lib->n * sizeof(float));
+	lib->types = rotlib_alloc(lib->n * sizeof(int));
+	lib->batchCharges = rotlib_alloc(lib->n * sizeof(double));
+	/* the padding is at the origin, with no charge */
+	for (k = 0; k < lib->n; k++) {
+		lib->x[k] = lib->y[k] = lib->z[k] = 0.0f;
+		lib->types[k] = lib->atypes[0];
+		lib->batchCharges[k] = 0.0;
+	}
+	for (j = 0; j < nbAtoms; j++) lib->radius[j] = 0.0;
+	for (i = 0; i < lib->nbRot; i++)
+		for (j = 0; j < nbAtoms; j++) {
+			const double *c = coords + 3 * (source[i] * nbAtoms + j);
+			k = i * nbAtoms + j;
+			lib->x[k] = c[0];
+			lib->y[k] = c[1];
+			lib->z[k] = c[2];
+			lib->types[k] = lib->atypes[j];
+			lib->batchCharges[k] = lib->charges[j];
+			lib->radius[j] = fmax(lib->radius[j], sqrt((double) lib->x[k] * lib->x[k] + (double) lib->y[k] * lib->y[k] + (double) lib->z[k] * lib->z[k]));
+		}
+}
+
+/* the library of residue type id, replacing any earlier one. prior may be NULL for equal priors */
+static void rotlib_build(char id, int mode, int nbRot, int nbAtoms, const int *atypes, const double *charges, const double *prior, const double *coords)
+{
+	Rotlib *lib = rotlibs + (id - 'A');
+	int *source, i;
+
+	if (nbRot < 1 || nbAtoms < 1 || nbRot > (INT_MAX - ROTLIB_LANES) / nbAtoms)
+		stop("Rotamer library empty or too large.");
+	if (mode < 0 || mode >= ROTLIB_MODES)
+		stop("Unknown rotamer library mode.");
+	rotlib_free(lib);
+	lib->id = id;
+	lib->mode = mode;
+	lib->nbRot = nbRot;
+	lib->nbAtoms = nbAtoms;
+	lib->atypes = malloc(nbAtoms * sizeof(int));
+	lib->charges = malloc(nbAtoms * sizeof(double));
+	lib->prior = malloc(nbRot * sizeof(double));
+	source = malloc(nbRot * sizeof(int));
+	if (!lib->atypes || !lib->charges || !lib->prior || !source)
+		stop("Unable to allocate the rotamer libraries.");
+	memcpy(lib->atypes, atypes, nbAtoms * sizeof(int));
+	memcpy(lib->charges, charges, nbAtoms * sizeof(double));
+	for (i = 0; i < nbRot; i++) {
+		lib->prior[i] = prior ? prior[i] : 1.0 / nbRot;
+		source[i] = i;
+	}
+	rotlib_arrays(lib, coords, source);
+	free(source);
+}
+
+/* keep the budget rotamers of lib with the highest priors, ties to the lower index, in library order */
+static void rotlib_budget(Rotlib *lib, int budget)
+{
+	int *keep, i, j, m, n = 0;
+	double *coords, *prior;
+
+	if (budget <= 0 || lib->nbRot <= budget) return;
+	keep = malloc(budget * sizeof(int));
+	prior = malloc(budget * sizeof(double));
+	coords = malloc((size_t) lib->nbRot * lib->nbAtoms * 3 * sizeof(double));
+	if (!keep || !prior || !coords)
+		stop("Unable to allocate the rotamer libraries.");
+	for (i = 0; i < lib->nbRot; i++) {
+		for (j = 0; j < lib->nbAtoms; j++) {
+			m = i * lib->nbAtoms + j;
+			coords[3 * m] = lib->x[m];
+			coords[3 * m + 1] = lib->y[m];
+			coords[3 * m + 2] = lib->z[m];
+		}
+		/* insertion by prior, the earlier index first among equals */
+		for (m = n; m > 0 && lib->prior[keep[m - 1]] < lib->prior[i]; m--)
+			if (m < budget) keep[m] = keep[m - 1];
+		if (m < budget) {
+			keep[m] = i;
+			if (n < budget) n++;
+		}
+	}
+	/* back to library order */
+	for (i = 1; i < n; i++)
+		for (m = i; m > 0 && keep[m - 1] > keep[m]; m--) {
+			j = keep[m];
+			keep[m] = keep[m - 1];
+			keep[m - 1] = j;
+		}
+	for (i = 0; i < n; i++) prior[i] = lib->prior[keep[i]];
+	free(lib->x);
+	free(lib->y);
+	free(lib->z);
+	free(lib->types);
+	free(lib->batchCharges);
+	lib->nbRot = n;
+	memcpy(lib->prior, prior, n * sizeof(double));
+	rotlib_arrays(lib, coords, keep);
+	free(keep);
+	free(prior);
+	free(coords);
+}
+
+/* the binary rotamer library: a Rotlib_header, then per residue type a Rotlib_record followed by
+   nbAtoms int atom types, nbAtoms double charges, nbRot double priors and nbRot * nbAtoms * 3
+   double coordinates in the frame of the residue (CA at the origin, N on -x, CB in the z=0 plane),
+   all in native byte order */
+static void rotlib_read(const char *filename)
+{
+	char error_string[1024];
+	Rotlib_header header;
+	int i;
+
+	FILE *in = fopen(filename, "rb");
+	if (in == NULL) {
+		sprintf(error_string, "Unable to open rotamer library %.900s.", filename);
+		stop(error_string);
+	}
+	if (fread(&header, sizeof(header), 1, in) != 1 || strncmp(header.magic, ROTLIB_MAGIC, sizeof(header.magic)) != 0 ||
+	    header.version != ROTLIB_VERSION || header.nbLibs < 0 || header.nbLibs > 26) {
+		fclose(in);
+		sprintf(error_string, "%.900s is not a version %d rotamer library.", filename, ROTLIB_VERSION);
+		stop(error_string);
+	}
+	for (i = 0; i < header.nbLibs; i++) {
+		Rotlib_record record;
+		int *atypes = NULL;
+		double *charges = NULL, *prior = NULL, *coords = NULL;
+		int ok = fread(&record, sizeof(record), 1, in) == 1 && record.id >= 'A' && record.id <= 'Z' &&
+		    record.nbRot >= 1 && record.nbAtoms >= 1 && record.nbRot <= (INT_MAX - ROTLIB_LANES) / record.nbAtoms;
+		if (ok) {
+			atypes = malloc(record.nbAtoms * sizeof(int));
+			charges = malloc(record.nbAtoms * sizeof(double));
+			prior = malloc(record.nbRot * sizeof(double));
+			coords = malloc((size_t) record.nbRot * record.nbAtoms * 3 * sizeof(double));
+			if (!atypes || !charges || !prior || !coords)
+				stop("Unable to allocate the rotamer libraries.");
+			ok = fread(atypes, sizeof(int), record.nbAtoms, in) == (size_t) record.nbAtoms &&
+			    fread(charges, sizeof(double), record.nbAtoms, in) == (size_t) record.nbAtoms &&
+			    fread(prior, sizeof(double), record.nbRot, in) == (size_t) record.nbRot &&
+			    fread(coords, 3 * sizeof(double), (size_t) record.nbRot * record.nbAtoms, in) == (size_t) record.nbRot * record.nbAtoms;
+		}
+		if (!ok) {
+			fclose(in);
+			sprintf(error_string, "Rotamer library %.900s is truncated or corrupt.", filename);
+			stop(error_string);
+		}
+		rotlib_build(record.id, record.mode, record.nbRot, record.nbAtoms, atypes, charges, prior, coords);
+		free(atypes);
+		free(charges);
+		free(prior);
+		free(coords);
+	}
+	fclose(in);
+	fprintf(stderr, "rotamer library %s: %d residue types\n", filename, header.nbLibs);
+}
+
+/* write the libraries in use to filename, in the format of rotlib_read */
+void rotlib_write(const char *filename)
+{
+	char error_string[1024];
+	Rotlib_header header;
+	int i, k, ok = 1;
+
+	if (!rotlib_ready) rotlib_initialise(NULL, 0, 0);
+	FILE *out = fopen(filename, "wb");
+	if (out == NULL) {
+		sprintf(error_string, "Unable to open %.900s for writing.", filename);
+		stop(error_string);
+	}
+	memset(&header, 0, sizeof(header));
+	strncpy(header.magic, ROTLIB_MAGIC, sizeof(header.magic));
+	header.version = ROTLIB_VERSION;
+	for (i = 0; i < 26; i++)
+		if (rotlibs[i].nbRot > 0) header.nbLibs++;
+	ok = fwrite(&header, sizeof(header), 1, out) == 1;
+	for (i = 0; i < 26 && ok; i++) {
+		const Rotlib *lib = rotlibs + i;
+		Rotlib_record record;
+		if (lib->nbRot == 0) continue;
+		memset(&record, 0, sizeof(record));
+		record.id = lib->id;
+		record.mode = lib->mode;
+		record.nbRot = lib->nbRot;
+		record.nbAtoms = lib->nbAtoms;
+		ok = fwrite(&record, sizeof(record), 1, out) == 1 &&
+			fwrite(lib->atypes, sizeof(int), lib->nbAtoms, out) == (size_t) lib->nbAtoms &&
+			fwrite(lib->charges, sizeof(double), lib->nbAtoms, out) == (size_t) lib->nbAtoms &&
+			fwrite(lib->prior, sizeof(double), lib->nbRot, out) == (size_t) lib->nbRot;
+		for (k = 0; k < lib->nbRot * lib->nbAtoms && ok; k++) {
+			double c[3] = { lib->x[k], lib->y[k], lib->z[k] };
+			ok = fwrite(c, sizeof(double), 3, out) == 3;
+		}
+	}
+	if (fclose(out) != 0 || !ok) {
+		remove(filename);
+		sprintf(error_string, "Unable to write rotamer library %.900s.", filename);
+		stop(error_string);
+	}
+}
+
+/* the built-in libraries of canonicalAA.c, then those of filename if not NULL. CYS is scored by its
+   rotamers if cys, otherwise by its gamma atom; budget > 0 keeps that many rotamers per type */
+void rotlib_initialise(const char *filename, int budget, int cys)
+{
+#define ROTLIB_BUILD(id, mode, L) rotlib_build(id, mode, L.nbRot, L.nbAtoms, L.atypes, L.charges, NULL, &L.coords[0][0][0])
+	int i, k;
+
+	rotlib_finalise();
+	for (i = 0; i < ROTLIB_JITTERS; i++)
+		for (k = 0; k < 3; k++)
+			rotlib_jitters[i][k] = i == 0 ? 0.0 : 0.5 * rotlib_halton(i, k == 0 ? 2 : (k == 1 ? 3 : 5)) - 0.25;
+	ROTLIB_BUILD('R', ROTLIB_NOCLASH, ARG);
+	ROTLIB_BUILD('N', ROTLIB_NOCLASH, ASN);
+	ROTLIB_BUILD('D', ROTLIB_NOCLASH, ASP);
+	ROTLIB_BUILD('C', ROTLIB_GAMMA, CYS);
+	ROTLIB_BUILD('Q', ROTLIB_NOCLASH, GLN);
+	ROTLIB_BUILD('E', ROTLIB_NOCLASH, GLU);
+	ROTLIB_BUILD('H', ROTLIB_NOCLASH, HIS);
+	ROTLIB_BUILD('I', ROTLIB_NOCLASH, ILE);
+	ROTLIB_BUILD('L', ROTLIB_NOCLASH, LEU);
+	ROTLIB_BUILD('K', ROTLIB_NOCLASH, LYS);
+	ROTLIB_BUILD('M', ROTLIB_NOCLASH, MET);
+	ROTLIB_BUILD('F', ROTLIB_NOCLASH, PHE);
+	ROTLIB_BUILD('P', ROTLIB_BEST, PRO);
+	ROTLIB_BUILD('S', ROTLIB_NOCLASH, SER);
+	ROTLIB_BUILD('T', ROTLIB_NOCLASH, THR);
+	ROTLIB_BUILD('W', ROTLIB_NOCLASH, TRP);
+	ROTLIB_BUILD('Y', ROTLIB_NOCLASH, TYR);
+	ROTLIB_BUILD('V', ROTLIB_NOCLASH, VAL);
+	rotlib_ready = 1;
+	if (filename) rotlib_read(filename);
+	if (cys && rotlibs['C' - 'A'].nbRot > 0) rotlibs['C' - 'A'].mode = ROTLIB_NOCLASH;
+	for (i = 0; i < 26; i++)
+		if (rotlibs[i].nbRot > 0) rotlib_budget(rotlibs + i, budget);
+	/* the scratch arrays hold every atom of the largest library */
+	for (i = 0; i < 26; i++) {
+		if (rotlibs[i].nbAtoms > rotlib_max_atoms) rotlib_max_atoms = rotlibs[i].nbAtoms;
+		if (rotlibs[i].n > rotlib_max_n) rotlib_max_n = rotlibs[i].n;
+	}
+	for (k = 0; k < ROTLIB_SCRATCHES; k++) {
+		Rotlib_scratch *s = rotlib_scratches + k;
+		s->x = rotlib_alloc(rotlib_max_n * sizeof(double));
+		s->y = rotlib_alloc(rotlib_max_n * sizeof(double));
+		s->z = rotlib_alloc(rotlib_max_n * sizeof(double));
+		s->energies = rotlib_alloc(rotlib_max_n * sizeof(double));
+	}
+#undef ROTLIB_BUILD
+}
+
+void rotlib_finalise()
+{
+	int i;
+	for (i = 0; i < 26; i++) rotlib_free(rotlibs + i);
+	for (i = 0; i < ROTLIB_SCRATCHES; i++) {
+		free(rotlib_scratches[i].x);
+		free(rotlib_scratches[i].y);
+		free(rotlib_scratches[i].z);
+		free(rotlib_scratches[i].energies);
+		memset(rotlib_scratches + i, 0, sizeof(Rotlib_scratch));
+	}
+	rotlib_max_atoms = rotlib_max_n = 0;
+	rotlib_ready = 0;
+}
+
+/* the most atoms of a rotamer of the libraries in use */
+int rotlib_atoms()
+{
+	if (!rotlib_ready) rotlib_initialise(NULL, 0, 0);
+	return rotlib_max_atoms;
+}
+
+/* the scratch arrays of user, ROTLIB_SCRATCH_SCAN or ROTLIB_SCRATCH_PACK */
+const Rotlib_scratch *rotlib_scratch(int user)
+{
+	if (!rotlib_ready) rotlib_initialise(NULL, 0, 0);
+	return rotlib_scratches + user;
+}
+
+/* N of a in trial t of a side chain scan */
+void rotlib_jitter(const AA *a, int trial, float N[3])
+{
+	int k;
+	if (!rotlib_ready) rotlib_initialise(NULL, 0, 0);
+	for (k = 0; k < 3; k++) N[k] = a->n[k] + rotlib_jitters[trial % ROTLIB_JITTERS][k];
+}
+
+/* the library of a residue type, NULL without one (G, A) */
+const Rotlib *rotlib(char id)
+{
+	if (!rotlib_ready) rotlib_initialise(NULL, 0, 0);
+	if (id < 'A' || id > 'Z' || rotlibs[id - 'A'].nbRot == 0) return NULL;
+	return rotlibs + (id - 'A');
+}
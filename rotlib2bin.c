@@ -0,0 +1,62 @@
+/*
+**  This program writes the built-in rotamer libraries of canonicalAA.c to
+**  the binary rotamer library file adcp reads with -p Rotlib=, as a start
+**  for libraries with other rotamers, priors or residue types.
+**
+**  Copyright (c) Yuqi Zhang, Michel Sanner, CCSB Scripps
+*/
+
+#define VER "rotlib2bin 1.0, Copyright (c) Yuqi Zhang, Michel Sanner, CCSB Scripps\n"
+#define USE "Usage: %s [options]\n\
+Options:\n\
+ -o rotamers.rot      output binary rotamer library\n\
+ -c 0                 1 to score CYS by its rotamers instead of its gamma atom\n"
+
+#include<stdio.h>
+#include<stdlib.h>
+
+#include"canonicalAA.h"
+#include"error.h"
+#include"params.h"
+#include"vector.h"
+#include"rotation.h"
+#include"aadict.h"
+#include"peptide.h"
+#include"vdw.h"
+#include"energy.h"
+
+char *outfile = "rotamers.rot";
+int cys = 0;
+
+void read_options(int argc, char *argv[])
+{
+	int i, opt;
+
+	for (i = 1; i < argc; i++) {
+		opt = argv[i][0] == '-' ? argv[i][1] : 0;
+		if (++i >= argc)
+			opt = 0;
+
+		switch (opt) {
+		case 'o':
+			outfile = argv[i];
+			break;
+		case 'c':
+			cys = atoi(argv[i]);
+			break;
+		default:
+			fprintf(stderr, VER USE, argv[0]);
+			exit(EXIT_FAILURE);
+		}
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	read_options(argc, argv);
+	rotlib_initialise(NULL, 0, cys);
+	rotlib_write(outfile);
+	rotlib_finalise();
+	fprintf(stderr, "rotamer library %s written\n", outfile);
+	return EXIT_SUCCESS;
+}
@@ -44,18 +44,6 @@ class runADCP:
 
     def myexit(self):
         if self.targetFile is not None:
-            print "clean up unzipped map files"
-            try:
-                shutil.rmtree('./tmp_%s'%self.jobName)
-            except OSError:
-                pass        
-            for element in ['C','A','SA','N','NA','OA','HD','d','e']:
-                if os.path.isfile('rigidReceptor.%s.map'%element):
-                    os.remove('rigidReceptor.%s.map'%element)
-            if os.path.isfile('transpoints'):
-                os.remove('transpoints')
-            if os.path.isfile('translationPoints.npy'):
-                os.remove('translationPoints.npy')
             if os.path.isfile('con'):
                 os.remove('con')
         sys.exit(0)
@@ -138,22 +126,10 @@ class runADCP:
             self.myexit()
         # if transpoints file does not exists
         elif targetFile is not None:
-            # unzip mapsFile
-            import zipfile
-            with zipfile.ZipFile(targetFile, 'r') as zip_ref:
-                zip_ref.extractall('./tmp_%s/'%jobName)
-            for element in ['C','A','SA','N','NA','OA','HD','d','e']:
-                try:
-                #print("warningsaqd")
-                    shutil.copy(os.path.join('./tmp_%s/'%jobName,targetFile[:-4],'rigidReceptor.%s.map'%element),os.getcwd())
-                except IOError:
-                    print "WARNING: cannot locate map file for %s"%element
-            shutil.copy(os.path.join('./tmp_%s/'%jobName,targetFile[:-4],'translationPoints.npy'),os.getcwd())
-            ttt = numpy.load('translationPoints.npy')
-            fff = open('transpoints','w+')
-            fff.write('%s\n'%len(ttt))
-            numpy.savetxt(fff,ttt,fmt='%7.3f')
-            fff.close()
+            # adcp reads the maps and translation points straight from the archive (-T)
+            if not os.path.isfile(targetFile):
+                print "ERROR: cannot find target file %s"%targetFile
+                self.myexit()
         else:
             for element in ['C','A','SA','N','NA','OA','HD','d','e']:
                 if not os.path.isfile("rigidReceptor.%s.map"%element):
@@ -180,6 +156,8 @@ class runADCP:
 
         # build cmdline args for adcp binary
         argv = self._argv
+        if targetFile is not None:
+            argv.extend(['-T', targetFile])
 
         if kw['sequence'] is None:
             if kw['input'] is None or kw['input'][-3:] != 'pdb':
@@ -0,0 +1,420 @@
+/*
+** Reader of .trg target archives: the zip files written by agfr that hold
+** the AutoGrid maps and translationPoints.npy of a receptor. Entries are
+** inflated straight into memory, nothing is extracted to disk.
+**
+** Copyright (c) Yuqi Zhang, Michel Sanner, CCSB Scripps
+*/
+
+#include<stdlib.h>
+#include<stdio.h>
+#include<string.h>
+
+#include"error.h"
+#include"trg_io.h"
+
+#define TRG_LOCAL_SIGNATURE 0x04034b50u
+#define TRG_CENTRAL_SIGNATURE 0x02014b50u
+#define TRG_END_SIGNATURE 0x06054b50u
+#define TRG_END_SIZE 22
+#define TRG_MAX_COMMENT 65535
+
+/* bits of a huffman code resolved by one table lookup, longer codes are decoded bit by bit */
+#define TRG_FAST_BITS 10
+
+static unsigned int get16(const unsigned char *p) {
+	return p[0] | (p[1] << 8);
+}
+
+static unsigned int get32(const unsigned char *p) {
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned int)p[3] << 24);
+}
+
+static void trg_stop(const Trg_archive *trg, const char *what) {
+	char error_string[1024];
+	sprintf(error_string, "Target archive %.500s: %.400s", trg->filename, what);
+	stop(error_string);
+}
+
+/* open a target archive and read its central directory, stops if it is missing or not a zip file */
+void trg_open(Trg_archive *trg, const char *filename) {
+	unsigned char *tail, *p;
+	long size = 0, tailsize, pos;
+	size_t cdsize;
+	int i;
+
+	trg->filename = malloc(strlen(filename) + 1);
+	if (!trg->filename) stop("Unable to allocate memory in trg_open.");
+	strcpy(trg->filename, filename);
+	trg->nentries = 0;
+	trg->entries = NULL;
+	if ((trg->file = fopen(filename, "rb")) == NULL) trg_stop(trg, "unable to open the file.");
+
+	/* the end of central directory record is followed by a comment of at most 64 KB */
+	if (fseek(trg->file, 0, SEEK_END) != 0 || (size = ftell(trg->file)) < TRG_END_SIZE) trg_stop(trg, "not a zip file.");
+	tailsize = size < TRG_END_SIZE + TRG_MAX_COMMENT ? size : TRG_END_SIZE + TRG_MAX_COMMENT;
+	tail = malloc(tailsize);
+	if (!tail) stop("Unable to allocate memory in trg_open.");
+	if (fseek(trg->file, size - tailsize, SEEK_SET) != 0 || fread(tail, 1, tailsize, trg->file) != (size_t)tailsize)
+		trg_stop(trg, "unable to read the file.");
+	for (pos = tailsize - TRG_END_SIZE; pos >= 0; pos--)
+		if (get32(tail + pos) == TRG_END_SIGNATURE) break;
+	if (pos < 0) trg_stop(trg, "not a zip file.");
+	trg->nentries = get16(tail + pos + 10);
+	cdsize = get32(tail + pos + 12);
+	long cdoffset = get32(tail + pos + 16);
+	free(tail);
+	if (trg->nentries == 0xffff || cdoffset == 0xffffffffL) trg_stop(trg, "zip64 archives are not supported.");
+	if (cdoffset + (long)cdsize > size) trg_stop(trg, "truncated central directory.");
+
+	unsigned char *cd = malloc(cdsize + 1);
+	trg->entries = calloc(trg->nentries + 1, sizeof(Trg_entry));
+	if (!cd || !trg->entries) stop("Unable to allocate memory in trg_open.");
+	if (fseek(trg->file, cdoffset, SEEK_SET) != 0 || fread(cd, 1, cdsize, trg->file) != cdsize)
+		trg_stop(trg, "unable to read the central directory.");
+
+	for (i = 0, p = cd; i < trg->nentries; i++) {
+		Trg_entry *entry = trg->entries + i;
+		if (p + 46 > cd + cdsize || get32(p) != TRG_CENTRAL_SIGNATURE) trg_stop(trg, "corrupted central directory.");
+		unsigned int namelen = get16(p + 28), extralen = get16(p + 30), commentlen = get16(p + 32);
+		if (p + 46 + namelen > cd + cdsize) trg_stop(trg, "corrupted central directory.");
+		if (get16(p + 8) & 1) trg_stop(trg, "encrypted entries are not supported.");
+		entry->method = get16(p + 10);
+		entry->crc = get32(p + 16);
+		entry->csize = get32(p + 20);
+		entry->usize = get32(p + 24);
+		entry->offset = get32(p + 42);
+		if (entry->csize == 0xffffffffu || entry->usize == 0xffffffffu || entry->offset == 0xffffffffL)
+			trg_stop(trg, "zip64 entries are not supported.");
+		entry->name = malloc(namelen + 1);
+		if (!entry->name) stop("Unable to allocate memory in trg_open.");
+		memcpy(entry->name, p + 46, namelen);
+		entry->name[namelen] = '\0';
+		p += 46 + namelen + extralen + commentlen;
+	}
+	free(cd);
+}
+
+void trg_close(Trg_archive *trg) {
+	int i;
+	if (trg->file) fclose(trg->file);
+	for (i = 0; i < trg->nentries; i++) free(trg->entries[i].name);
+	free(trg->entries);
+	free(trg->filename);
+	trg->file = NULL;
+	trg->entries = NULL;
+	trg->filename = NULL;
+	trg->nentries = 0;
+}
+
+/* the entry whose file name, in whatever folder of the archive, is name. NULL if there is none */
+const Trg_entry *trg_find(const Trg_archive *trg, const char *name) {
+	int i;
+	for (i = 0; i < trg->nentries; i++) {
+		const char *base = strrchr(trg->entries[i].name, '/');
+		base = base ? base + 1 : trg->entries[i].name;
+		if (strcmp(base, name) == 0) return trg->entries + i;
+	}
+	return NULL;
+}
+
+/* crc-32 of the zip format */
+static unsigned int trg_crc32(const unsigned char *data, size_t size) {
+	static unsigned int table[256];
+	static int initialised = 0;
+	unsigned int crc = 0xffffffffu;
+	size_t n;
+	int i, k;
+
+	if (!initialised) {
+		for (i = 0; i < 256; i++) {
+			unsigned int c = i;
+			for (k = 0; k < 8; k++) c = c & 1 ? 0xedb88320u ^ (c >> 1) : c >> 1;
+			table[i] = c;
+		}
+		initialised = 1;
+	}
+	for (n = 0; n < size; n++) crc = table[(crc ^ data[n]) & 0xff] ^ (crc >> 8);
+	return crc ^ 0xffffffffu;
+}
+
+/* deflate (RFC 1951) decoder state, the whole output is known in advance */
+typedef struct _Trg_inflate {
+	const Trg_archive *trg;
+	const unsigned char *in;
+	size_t inlen, inpos;
+	unsigned long long bitbuf;
+	int bitcnt;
+	int overrun;		/* zero bytes read past the end of the input */
+	unsigned char *out;
+	size_t outlen, outpos;
+} Trg_inflate;
+
+/* canonical huffman code: code lengths count, symbols sorted by code, and the fast table
+   fast[bits] = symbol << 4 | length for the codes of at most TRG_FAST_BITS bits, 0 otherwise */
+typedef struct _Trg_huffman {
+	short count[16];
+	short symbol[288];
+	unsigned short fast[1 << TRG_FAST_BITS];
+} Trg_huffman;
+
+static void inflate_refill(Trg_inflate *s) {
+	while (s->bitcnt <= 56) {
+		unsigned long long byte = 0;
+		if (s->inpos < s->inlen) byte = s->in[s->inpos++];
+		else if (++s->overrun > 8) trg_stop(s->trg, "truncated deflate stream.");
+		s->bitbuf |= byte << s->bitcnt;
+		s->bitcnt += 8;
+	}
+}
+
+static unsigned int inflate_bits(Trg_inflate *s, int n) {
+	unsigned int v;
+	if (s->bitcnt < n) inflate_refill(s);
+	v = (unsigned int)(s->bitbuf & ((1ull << n) - 1));
+	s->bitbuf >>= n;
+	s->bitcnt -= n;
+	return v;
+}
+
+static void huffman_build(Trg_inflate *s, Trg_huffman *h, const unsigned char *length, int n) {
+	short offs[16];
+	int len, sym, left = 1, code = 0, index = 0;
+
+	memset(h->count, 0, sizeof(h->count));
+	for (sym = 0; sym < n; sym++) h->count[length[sym]]++;
+	h->count[0] = 0;
+	for (len = 1; len < 16; len++) {
+		left = (left << 1) - h->count[len];
+		if (left < 0) trg_stop(s->trg, "over-subscribed huffman code.");
+	}
+	offs[1] = 0;
+	for (len = 1; len < 15; len++) offs[len + 1] = offs[len] + h->count[len];
+	for (sym = 0; sym < n; sym++)
+		if (length[sym]) h->symbol[offs[length[sym]]++] = sym;
+
+	memset(h->fast, 0, sizeof(h->fast));
+	for (len = 1; len <= TRG_FAST_BITS; len++) {
+		for (int k = 0; k < h->count[len]; k++, code++) {
+			int rev = 0, r;
+			for (int b = 0; b < len; b++) rev |= ((code >> b) & 1) << (len - 1 - b);
+			for (r = rev; r < (1 << TRG_FAST_BITS); r += 1 << len)
+				h->fast[r] = (unsigned short)(h->symbol[index] << 4 | len);
+			index++;
+		}
+		code <<= 1;
+	}
+}
+
+static int huffman_decode(Trg_inflate *s, const Trg_huffman *h) {
+	unsigned int e;
+	int len, code = 0, first = 0, index = 0;
+
+	if (s->bitcnt < 15) inflate_refill(s);
+	e = h->fast[s->bitbuf & ((1u << TRG_FAST_BITS) - 1)];
+	if (e) {
+		s->bitbuf >>= e & 15;
+		s->bitcnt -= e & 15;
+		return e >> 4;
+	}
+	for (len = 1; len < 16; len++) {
+		code |= (int)(s->bitbuf & 1);
+		s->bitbuf >>= 1;
+		s->bitcnt--;
+		if (code - h->count[len] < first) return h->symbol[index + (code - first)];
+		index += h->count[len];
+		first = (first + h->count[len]) << 1;
+		code <<= 1;
+	}
+	trg_stop(s->trg, "invalid huffman code.");
+	return -1;
+}
+
+static void inflate_stored(Trg_inflate *s) {
+	unsigned int len, nlen;
+	inflate_bits(s, s->bitcnt & 7);
+	len = inflate_bits(s, 16);
+	nlen = inflate_bits(s, 16);
+	if (len != (~nlen & 0xffff)) trg_stop(s->trg, "corrupted stored block.");
+	if (s->outpos + len > s->outlen) trg_stop(s->trg, "entry larger than its declared size.");
+	if ((long)len > s->bitcnt / 8 - s->overrun + (long)(s->inlen - s->inpos)) trg_stop(s->trg, "truncated stored block.");
+	/* the bytes already in the bit buffer first, then straight from the input */
+	while (len > 0 && s->bitcnt >= 8) {
+		s->out[s->outpos++] = (unsigned char)inflate_bits(s, 8);
+		len--;
+	}
+	memcpy(s->out + s->outpos, s->in + s->inpos, len);
+	s->outpos += len;
+	s->inpos += len;
+}
+
+static void inflate_codes(Trg_inflate *s, const Trg_huffman *lencode, const Trg_huffman *distcode) {
+	static const short lbase[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+		35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+	static const short lext[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+		3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+	static const short dbase[30] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+		257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+	static const short dext[30] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+		7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+	int symbol;
+
+	while ((symbol = huffman_decode(s, lencode)) != 256) {
+		if (symbol < 256) {
+			if (s->outpos >= s->outlen) trg_stop(s->trg, "entry larger than its declared size.");
+			s->out[s->outpos++] = (unsigned char)symbol;
+			continue;
+		}
+		symbol -= 257;
+		if (symbol >= 29) trg_stop(s->trg, "invalid length code.");
+		size_t len = lbase[symbol] + inflate_bits(s, lext[symbol]);
+		symbol = huffman_decode(s, distcode);
+		if (symbol >= 30) trg_stop(s->trg, "invalid distance code.");
+		size_t dist = dbase[symbol] + inflate_bits(s, dext[symbol]);
+		if (dist > s->outpos) trg_stop(s->trg, "distance too far back.");
+		if (s->outpos + len > s->outlen) trg_stop(s->trg, "entry larger than its declared size.");
+		unsigned char *to = s->out + s->outpos, *from = to - dist;
+		s->outpos += len;
+		while (len--) *to++ = *from++;
+	}
+}
+
+static void inflate_dynamic(Trg_inflate *s, Trg_huffman *lencode, Trg_huffman *distcode) {
+	static const unsigned char order[19] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+	unsigned char lengths[320];
+	int nlen, ndist, ncode, index, symbol, len, rep;
+
+	nlen = inflate_bits(s, 5) + 257;
+	ndist = inflate_bits(s, 5) + 1;
+	ncode = inflate_bits(s, 4) + 4;
+	if (nlen > 286 || ndist > 30) trg_stop(s->trg, "bad dynamic block counts.");
+	memset(lengths, 0, sizeof(lengths));
+	for (index = 0; index < ncode; index++) lengths[order[index]] = (unsigned char)inflate_bits(s, 3);
+	huffman_build(s, lencode, lengths, 19);
+
+	for (index = 0; index < nlen + ndist;) {
+		symbol = huffman_decode(s, lencode);
+		if (symbol < 16) {
+			lengths[index++] = (unsigned char)symbol;
+			continue;
+		}
+		len = 0;
+		if (symbol == 16) {
+			if (index == 0) trg_stop(s->trg, "repeat with no previous length.");
+			len = lengths[index - 1];
+			rep = 3 + inflate_bits(s, 2);
+		} else if (symbol == 17) rep = 3 + inflate_bits(s, 3);
+		else rep = 11 + inflate_bits(s, 7);
+		if (index + rep > nlen + ndist) trg_stop(s->trg, "too many code lengths.");
+		while (rep--) lengths[index++] = (unsigned char)len;
+	}
+	if (lengths[256] == 0) trg_stop(s->trg, "no end-of-block code.");
+	huffman_build(s, lencode, lengths, nlen);
+	huffman_build(s, distcode, lengths + nlen, ndist);
+}
+
+static void trg_inflate(const Trg_archive *trg, const unsigned char *in, size_t inlen, unsigned char *out, size_t outlen) {
+	static Trg_huffman fixedlen, fixeddist;
+	static int fixed = 0;
+	Trg_huffman lencode, distcode;
+	Trg_inflate s = { trg, in, inlen, 0, 0, 0, 0, out, outlen, 0 };
+	int last, type;
+
+	if (!fixed) {
+		unsigned char lengths[288];
+		int i;
+		for (i = 0; i < 144; i++) lengths[i] = 8;
+		for (; i < 256; i++) lengths[i] = 9;
+		for (; i < 280; i++) lengths[i] = 7;
+		for (; i < 288; i++) lengths[i] = 8;
+		huffman_build(&s, &fixedlen, lengths, 288);
+		for (i = 0; i < 30; i++) lengths[i] = 5;
+		huffman_build(&s, &fixeddist, lengths, 30);
+		fixed = 1;
+	}
+	do {
+		last = inflate_bits(&s, 1);
+		type = inflate_bits(&s, 2);
+		if (type == 0) inflate_stored(&s);
+		else if (type == 1) inflate_codes(&s, &fixedlen, &fixeddist);
+		else if (type == 2) {
+			inflate_dynamic(&s, &lencode, &distcode);
+			inflate_codes(&s, &lencode, &distcode);
+		} else trg_stop(trg, "invalid deflate block type.");
+	} while (!last);
+	if (8 * s.overrun > s.bitcnt) trg_stop(trg, "truncated deflate stream.");
+	if (s.outpos != outlen) trg_stop(trg, "entry shorter than its declared size.");
+}
+
+/* read an entry into a malloc'ed buffer of entry->usize bytes plus a terminating '\0',
+   stops on an unsupported compression method or a crc mismatch */
+char *trg_read(Trg_archive *trg, const Trg_entry *entry) {
+	unsigned char local[30];
+	char error_string[512];
+
+	if (entry->method != TRG_METHOD_STORED && entry->method != TRG_METHOD_DEFLATED) {
+		sprintf(error_string, "entry %.300s uses compression method %u, only stored and deflated are supported.", entry->name, entry->method);
+		trg_stop(trg, error_string);
+	}
+	if (fseek(trg->file, entry->offset, SEEK_SET) != 0 || fread(local, 1, 30, trg->file) != 30 || get32(local) != TRG_LOCAL_SIGNATURE)
+		trg_stop(trg, "corrupted local file header.");
+	if (fseek(trg->file, get16(local + 26) + get16(local + 28), SEEK_CUR) != 0)
+		trg_stop(trg, "corrupted local file header.");
+
+	unsigned char *data = malloc(entry->usize + 1);
+	unsigned char *packed = entry->method == TRG_METHOD_STORED ? data : malloc(entry->csize);
+	if (!data || !packed) stop("Unable to allocate memory in trg_read.");
+	if (entry->method == TRG_METHOD_STORED && entry->csize != entry->usize) trg_stop(trg, "stored entry with two sizes.");
+	if (fread(packed, 1, entry->csize, trg->file) != entry->csize) trg_stop(trg, "truncated entry.");
+	if (entry->method == TRG_METHOD_DEFLATED) {
+		trg_inflate(trg, packed, entry->csize, data, entry->usize);
+		free(packed);
+	}
+	if (trg_crc32(data, entry->usize) != entry->crc) {
+		sprintf(error_string, "crc mismatch in entry %.300s.", entry->name);
+		trg_stop(trg, error_string);
+	}
+	data[entry->usize] = '\0';
+	return (char *)data;
+}
+
+/* the points of an (n, 3) float64 or float32 .npy array as n xyz triplets, NULL if it is not one */
+double *trg_npy_points(const char *data, size_t size, int *npoints) {
+	const unsigned char *p = (const unsigned char *)data;
+	size_t headerlen, start, n, k;
+	int rows, cols, fortran, single;
+	char header[1024], order[8] = "";
+	const char *field;
+
+	if (size < 10 || memcmp(p, "\x93NUMPY", 6) != 0) return NULL;
+	headerlen = p[6] == 1 ? get16(p + 8) : get32(p + 8);
+	start = (p[6] == 1 ? 10 : 12) + headerlen;
+	if (start > size || headerlen >= sizeof(header)) return NULL;
+	memcpy(header, data + start - headerlen, headerlen);
+	header[headerlen] = '\0';
+
+	if (strstr(header, "'<f8'") || strstr(header, "'|f8'")) single = 0;
+	else if (strstr(header, "'<f4'") || strstr(header, "'|f4'")) single = 1;
+	else return NULL;
+	if ((field = strstr(header, "'fortran_order'"))) sscanf(field, "'fortran_order' : %5s", order);
+	fortran = strncmp(order, "True", 4) == 0;
+	if (!(field = strstr(header, "'shape'")) || !(field = strchr(field, '(')) ||
+	    sscanf(field, "(%d , %d", &rows, &cols) != 2 || cols != 3 || rows < 0)
+		return NULL;
+	if (start + (size_t)rows * 3 * (single ? 4 : 8) > size) return NULL;
+
+	double *xyz = malloc(((size_t)rows * 3 + 1) * sizeof(double));
+	if (!xyz) stop("Unable to allocate memory in trg_npy_points.");
+	for (n = 0; n < (size_t)rows; n++) {
+		for (k = 0; k < 3; k++) {
+			size_t index = fortran ? k * rows + n : 3 * n + k;
+			if (single) {
+				float f;
+				memcpy(&f, data + start + 4 * index, 4);
+				xyz[3 * n + k] = f;
+			} else memcpy(xyz + 3 * n + k, data + start + 8 * index, 8);
+		}
+	}
+	*npoints = rows;
+	return xyz;
+}
@@ -0,0 +1,32 @@
+/*
+** Reader of .trg target archives: the zip files written by agfr that hold
+** the AutoGrid maps and translationPoints.npy of a receptor. Entries are
+** inflated straight into memory, nothing is extracted to disk.
+**
+** Copyright (c) Yuqi Zhang, Michel Sanner, CCSB Scripps
+*/
+
+#define TRG_METHOD_STORED 0
+#define TRG_METHOD_DEFLATED 8
+
+typedef struct _Trg_entry {
+  char *name;		/* full path inside the archive */
+  unsigned int method;
+  unsigned int crc;
+  size_t csize;		/* compressed size */
+  size_t usize;		/* uncompressed size */
+  long offset;		/* offset of the local file header */
+} Trg_entry;
+
+typedef struct _Trg_archive {
+  FILE *file;
+  char *filename;
+  int nentries;
+  Trg_entry *entries;
+} Trg_archive;
+
+void trg_open(Trg_archive *trg, const char *filename);
+void trg_close(Trg_archive *trg);
+const Trg_entry *trg_find(const Trg_archive *trg, const char *name);
+char *trg_read(Trg_archive *trg, const Trg_entry *entry);
+double *trg_npy_points(const char *data, size_t size, int *npoints);
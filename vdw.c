@@ -1481,8 +1481,8 @@ void vdw_cutoff_distances_calculate(simulation_params *sim_params, FILE *outfile
 	Chain *chain = (Chain *)malloc(sizeof(Chain)*28); chain->NAA = 0;
         Chaint* chaint = (Chaint *)malloc(sizeof(Chaint));
       	chain->NAA =0; chain->Nchains = 0;
-      	chain->aa = NULL; chain->xaa = NULL; chain->xaa_prev = NULL; chain->erg = NULL;
-      	chaint->aat = NULL; chaint->xaat = NULL; chaint->xaat_prev = NULL; chaint->ergt = NULL;  
+      	chain->aa = NULL; chain->xaa = NULL; chain->xaa_prev = NULL; chain->erg = NULL; chain->sc = NULL;
+      	chaint->aat = NULL; chaint->xaat = NULL; chaint->xaat_prev = NULL; chaint->ergt = NULL; chaint->sct = NULL;
 	if (my_sim_params->seq) free(my_sim_params->seq);
 	copy_string(&(my_sim_params->seq),"ABCDEFGHIGKLMNGPQRSTGVWGYZ");
 	build_peptide_from_sequence(chain,chaint,my_sim_params->seq, my_sim_params);
@@ -1499,10 +1499,12 @@ void vdw_cutoff_distances_calculate(simulation_params *sim_params, FILE *outfile
 
 	/* gamma-gamma and gamma-nongamma vdW cutoffs */
 	vdw_maxgamma_calc(chain, &(sim_params->protein_model), stderr, /* verbose = */ 0);
-	/* to be on the safe side, let's add 1 to all */
-	for (int i=0; i<702 ; i++) {
-		sim_params->protein_model.vdw_gamma_gamma_cutoff[i] += 10.0;
-		sim_params->protein_model.vdw_gamma_nongamma_cutoff[i] += 10.0;
+	/* to be on the safe side, let's add 1 to all (there are none without gamma atoms) */
+	if (sim_params->protein_model.use_gamma_atoms != NO_GAMMA) {
+		for (int i=0; i<702 ; i++) {
+			sim_params->protein_model.vdw_gamma_gamma_cutoff[i] += 10.0;
+			sim_params->protein_model.vdw_gamma_nongamma_cutoff[i] += 10.0;
+		}
 	}
 
 	if (verbose) print_vdw_cutoff_distances(&(sim_params->protein_model),outfile);